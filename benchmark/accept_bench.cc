@@ -0,0 +1,124 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "wnet.h"
+
+using namespace wnet;
+
+// connection churn: CLIENT_THREAD_COUNT blocking clients connect, send one byte, read its echo and reset the connection,
+// against the master thread accepting in either reactor mode, and against an SO_REUSEPORT acceptor per EventLoop,
+// every connection must be echoed, exit with EXIT_FAILURE otherwise
+
+constexpr short PORT = 10010;
+constexpr int CLIENT_THREAD_COUNT = 4;
+constexpr int CONNECTION_PER_CLIENT = 5000;
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count();
+}
+
+// return false if the connection is not echoed
+bool churnOnce(const struct sockaddr_in& address) {
+	int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+	if(fd == -1) {
+		return false;
+	}
+	// reset on close, no TIME_WAIT to run out of local ports
+	struct linger lingerOption = {1, 0};
+	::setsockopt(fd, SOL_SOCKET, SO_LINGER, &lingerOption, sizeof lingerOption);
+
+	bool echoed = false;
+	if(::connect(fd, reinterpret_cast<const struct sockaddr*>(&address), sizeof address) == 0) {
+		char data = 'x';
+		echoed = ::write(fd, &data, 1) == 1 && ::read(fd, &data, 1) == 1 && data == 'x';
+	}
+	::close(fd);
+	return echoed;
+}
+
+// connections per second, -1 if any of them failed
+double runChurn(ReactorMode mode, bool reusePortAcceptors) {
+	auto server = std::make_shared<TCPServer>(PORT, mode);
+	if(reusePortAcceptors) {
+		server->setEnableReusePortAcceptors();
+	}
+	server->setOnReceiveDataHandler(
+		[](Connection* const connection) {
+			connection->writeData(connection->getInputBuffer());
+			connection->getInputBuffer()->clear();
+		}
+	);
+
+	struct sockaddr_in address;
+	bzero(&address, sizeof address);
+	address.sin_family = AF_INET;
+	address.sin_port = htons(PORT);
+	::inet_pton(AF_INET, "127.0.0.1", &address.sin_addr);
+
+	std::atomic<int> echoedCount(0);
+	double seconds = 0;
+	std::thread clientThread([&] {
+		// wait for the server to listen
+		while(!churnOnce(address)) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+
+		auto start = std::chrono::steady_clock::now();
+		std::vector<std::thread> clientList;
+		for(int index = 0; index < CLIENT_THREAD_COUNT; index++) {
+			clientList.push_back(std::thread([&] {
+				for(int count = 0; count < CONNECTION_PER_CLIENT; count++) {
+					if(churnOnce(address)) {
+						echoedCount++;
+					}
+				}
+			}));
+		}
+		for(auto &client : clientList) {
+			client.join();
+		}
+		seconds = secondsSince(start);
+		server->shutdown();
+	});
+
+	server->run();
+	clientThread.join();
+
+	return echoedCount == CLIENT_THREAD_COUNT * CONNECTION_PER_CLIENT ? echoedCount / seconds : -1;
+}
+
+int main(int argc, char *argv[]) {
+	Log::setLogLevel(LogLevel::FATAL);
+
+	struct Case {
+		const char* name;
+		ReactorMode mode;
+		bool reusePortAcceptors;
+	};
+
+	bool passed = true;
+	::printf("%d clients, %d connections each, %d EventLoops\n", CLIENT_THREAD_COUNT, CONNECTION_PER_CLIENT, EVENT_LOOP_COUNT);
+	for(auto &churnCase : { Case{"MASTER_DISPATCH", ReactorMode::MASTER_DISPATCH, false},
+	                        Case{"LOOP_PER_THREAD", ReactorMode::LOOP_PER_THREAD, false},
+	                        Case{"LOOP_PER_THREAD reuse port", ReactorMode::LOOP_PER_THREAD, true} }) {
+		double connectsPerSecond = runChurn(churnCase.mode, churnCase.reusePortAcceptors);
+		if(connectsPerSecond < 0) {
+			::printf("  %-28s  connections lost\n", churnCase.name);
+			passed = false;
+		} else {
+			::printf("  %-28s  %8.0f connects/s\n", churnCase.name, connectsPerSecond);
+		}
+	}
+
+	return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
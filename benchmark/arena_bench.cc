@@ -0,0 +1,115 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+
+#include "message/request.simpledata.pb.h"
+#include "wnet.h"
+
+using namespace wnet;
+
+// one request the way complex_server handles it: decode the request, build the request data of a sub request,
+// decode the sub response, build the response, all dropped before the next request,
+// messages on the heap ( one allocation each and more for their fields ) against the request arena reset between requests,
+// every message is checked, exit with EXIT_FAILURE on mismatch
+
+static std::atomic<bool> counting(false);
+static std::atomic<long> allocationCount(0);
+
+void* operator new(size_t size) {
+	if(counting.load(std::memory_order_relaxed)) {
+		allocationCount.fetch_add(1, std::memory_order_relaxed);
+	}
+	if(void* ptr = ::malloc(size == 0 ? 1 : size)) {
+		return ptr;
+	}
+	throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept {
+	::free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+	::free(ptr);
+}
+
+constexpr int REQUEST_COUNT = 500000;
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count();
+}
+
+template<typename MESSAGE>
+std::shared_ptr<MESSAGE> createMessage(const std::shared_ptr<MessageArena>& arena) {
+	return arena ? arena->create<MESSAGE>() : std::make_shared<MESSAGE>();
+}
+
+// requests and sub responses interleaved in frames, arena nullptr for the heap
+bool handleAll(std::shared_ptr<Buffer> frames, const std::shared_ptr<MessageArena>& arena, const std::string& text) {
+	for(int count = 0; count < REQUEST_COUNT; count++) {
+		{
+			auto request = std::static_pointer_cast<request::simpledata>(ProtoBuf::decodeFromBuffer(frames, arena.get()));
+			if(!request || request->id() != count || request->msg() != text) {
+				return false;
+			}
+			auto requestData = createMessage<request::simpledata>(arena);
+			requestData->set_id(request->id());
+			requestData->set_msg(request->msg());
+
+			auto subResponse = std::static_pointer_cast<request::simpledata>(ProtoBuf::decodeFromBuffer(frames, arena.get()));
+			if(!subResponse || subResponse->id() != count + 1) {
+				return false;
+			}
+			auto response = createMessage<request::simpledata>(arena);
+			response->set_id(subResponse->id());
+			response->set_msg(subResponse->msg() + requestData->msg());
+			if(response->msg().size() != text.size() * 2) {
+				return false;
+			}
+		}
+		// what Connection::process() does once the request is done
+		if(arena && arena.use_count() == 1) {
+			arena->reset();
+		}
+	}
+	return frames->empty();
+}
+
+int main(int argc, char *argv[]) {
+	ProtoBuf::registerMessageType<request::simpledata>();
+
+	// long enough not to fit the small string buffer
+	const std::string text(100, 'w');
+	auto frames = std::make_shared<Buffer>();
+	auto message = std::make_shared<request::simpledata>();
+	message->set_msg(text);
+	for(int count = 0; count < REQUEST_COUNT; count++) {
+		message->set_id(count);
+		frames->append(std::static_pointer_cast<Message>(message));
+		message->set_id(count + 1);
+		frames->append(std::static_pointer_cast<Message>(message));
+	}
+
+	bool passed = true;
+	::printf("%d requests, 4 request::simpledata each\n", REQUEST_COUNT);
+	for(bool onArena : {false, true}) {
+		auto buffer = std::make_shared<Buffer>(frames->size());
+		buffer->append(frames);
+		auto arena = onArena ? std::make_shared<MessageArena>() : nullptr;
+		allocationCount.store(0);
+		counting.store(true);
+		auto start = std::chrono::steady_clock::now();
+		passed = handleAll(buffer, arena, text) && passed;
+		double seconds = secondsSince(start);
+		counting.store(false);
+		::printf("  %-14s  %8.1f ns/request, %.2f allocations/request\n",
+					 onArena ? "request arena" : "heap",
+					 seconds * 1e9 / REQUEST_COUNT, 1.0 * allocationCount.load() / REQUEST_COUNT);
+	}
+
+	return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
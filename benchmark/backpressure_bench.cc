@@ -0,0 +1,172 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "wnet.h"
+
+using namespace wnet;
+
+// slow reader, e.g. behind a proxy: a client writes REQUEST_COUNT requests as fast as the server takes them,
+// every one answered with RESPONSE_SIZE bytes, but reads responses at READ_RATE_MB_PER_SECOND only,
+// peak of Connection::getTotalPendingOutputSize() without watermarks against with them,
+// every response byte must arrive, and output must stay bounded with watermarks, exit with EXIT_FAILURE otherwise
+
+constexpr short PORT = 10012;
+constexpr int REQUEST_SIZE = 64 * 1024;
+constexpr int RESPONSE_SIZE = 64 * 1024;
+constexpr int REQUEST_COUNT = 1000;
+constexpr int READ_RATE_MB_PER_SECOND = 64;
+constexpr size_t HIGH_WATERMARK = 1024 * 1024;
+constexpr size_t LOW_WATERMARK = 256 * 1024;
+
+// input of one turn ( read budget ) answered at once, on top of the output pending then
+constexpr size_t BOUNDED_OUTPUT = 4 * HIGH_WATERMARK;
+
+struct Result {
+	bool passed;
+	size_t peakPendingOutput;
+	double seconds;
+};
+
+bool runClient(const struct sockaddr_in& address) {
+	int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+	if(::connect(fd, reinterpret_cast<const struct sockaddr*>(&address), sizeof address) != 0) {
+		::close(fd);
+		return false;
+	}
+
+	std::thread writer([fd] {
+		std::string request(REQUEST_SIZE, 'q');
+		for(int index = 0; index < REQUEST_COUNT; index++) {
+			size_t written = 0;
+			while(written < request.size()) {
+				ssize_t writeLen = ::write(fd, request.data() + written, request.size() - written);
+				if(writeLen <= 0) {
+					return;
+				}
+				written += static_cast<size_t>(writeLen);
+			}
+		}
+	});
+
+	// READ_RATE_MB_PER_SECOND, 64 KiB a millisecond
+	bool passed = true;
+	std::vector<char> data(RESPONSE_SIZE);
+	size_t remaining = static_cast<size_t>(REQUEST_COUNT) * RESPONSE_SIZE;
+	while(passed && remaining > 0) {
+		auto next = std::chrono::steady_clock::now() + std::chrono::microseconds(RESPONSE_SIZE / READ_RATE_MB_PER_SECOND);
+		ssize_t readLen = ::read(fd, data.data(), std::min(remaining, data.size()));
+		if(readLen <= 0) {
+			passed = false;
+			break;
+		}
+		passed = std::all_of(data.begin(), data.begin() + readLen, [](char byte) { return byte == 'r'; });
+		remaining -= static_cast<size_t>(readLen);
+		std::this_thread::sleep_until(next);
+	}
+
+	::shutdown(fd, SHUT_RDWR);
+	writer.join();
+	::close(fd);
+	return passed;
+}
+
+Result runSlowReader(IOBackend backend, bool watermarks) {
+	auto server = std::make_shared<TCPServer>(PORT, ReactorMode::LOOP_PER_THREAD);
+	server->setIOBackend(backend);
+	if(watermarks) {
+		server->setOutputWatermarks(HIGH_WATERMARK, LOW_WATERMARK);
+	} else {
+		server->setOutputWatermarks(SIZE_MAX, 0);
+	}
+	auto response = std::string(RESPONSE_SIZE, 'r');
+	server->setOnReceiveDataHandler(
+		[response](Connection* const connection) {
+			auto input = connection->getInputBuffer();
+			while(input->size() >= REQUEST_SIZE) {
+				connection->writeData(response);
+				input->consume(REQUEST_SIZE);
+			}
+		}
+	);
+
+	struct sockaddr_in address;
+	bzero(&address, sizeof address);
+	address.sin_family = AF_INET;
+	address.sin_port = htons(PORT);
+	::inet_pton(AF_INET, "127.0.0.1", &address.sin_addr);
+
+	Result result = {false, 0, 0};
+	std::atomic<bool> done(false);
+	std::thread sampler([&] {
+		while(!done) {
+			result.peakPendingOutput = std::max(result.peakPendingOutput, Connection::getTotalPendingOutputSize());
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	});
+	std::thread clientThread([&] {
+		// wait for the server to listen
+		int probe_fd;
+		while((probe_fd = ::socket(AF_INET, SOCK_STREAM, 0)) >= 0 &&
+					::connect(probe_fd, reinterpret_cast<const struct sockaddr*>(&address), sizeof address) != 0) {
+			::close(probe_fd);
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+		::close(probe_fd);
+
+		auto start = std::chrono::steady_clock::now();
+		result.passed = runClient(address);
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		result.seconds = elapsed.count();
+		server->shutdown();
+	});
+
+	server->run();
+	clientThread.join();
+	done = true;
+	sampler.join();
+	return result;
+}
+
+int main(int argc, char *argv[]) {
+	Log::setLogLevel(LogLevel::FATAL);
+
+	struct Case {
+		const char* name;
+		IOBackend backend;
+		bool watermarks;
+	};
+
+	bool passed = true;
+	::printf("%d requests of %d bytes, %d bytes each response, read at %d MB/s, watermarks %zu / %zu bytes\n",
+					 REQUEST_COUNT, REQUEST_SIZE, RESPONSE_SIZE, READ_RATE_MB_PER_SECOND, HIGH_WATERMARK, LOW_WATERMARK);
+	for(auto &slowCase : { Case{"epoll, no watermarks", IOBackend::EPOLL, false},
+	                       Case{"epoll", IOBackend::EPOLL, true},
+	                       Case{"io_uring", IOBackend::IO_URING, true} }) {
+		Result result = runSlowReader(slowCase.backend, slowCase.watermarks);
+		if(!result.passed) {
+			::printf("  %-22s  responses lost or changed\n", slowCase.name);
+			passed = false;
+			continue;
+		}
+		bool bounded = !slowCase.watermarks || result.peakPendingOutput <= BOUNDED_OUTPUT;
+		::printf("  %-22s  peak pending output %10zu bytes, %.2f s%s%s\n", slowCase.name, result.peakPendingOutput, result.seconds,
+						 slowCase.backend != EventPoll::getIOBackend() ? "  ( unsupported, fell back to epoll )" : "",
+						 bounded ? "" : "  unbounded");
+		passed = passed && bounded;
+	}
+
+	return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,74 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "message/request.simpledata.pb.h"
+#include "wnet.h"
+
+using namespace wnet;
+
+// a pipelining client sends PIPELINE_DEPTH request::simpledata frames per receive event,
+// decoded one decodeFromBuffer() per frame against decodeAllFromBuffer() walking them in place,
+// both on every event, in turns, so that drift of the machine weighs on them alike,
+// every message is checked, exit with EXIT_FAILURE on mismatch
+
+constexpr int PIPELINE_DEPTH = 64;
+constexpr int EVENT_COUNT = 20000;
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count();
+}
+
+int main(int argc, char *argv[]) {
+	ProtoBuf::registerMessageType<request::simpledata>();
+
+	auto frames = std::make_shared<Buffer>();
+	auto message = std::make_shared<request::simpledata>();
+	message->set_msg("hello wnet");
+	for(int count = 0; count < PIPELINE_DEPTH; count++) {
+		message->set_id(count);
+		frames->append(std::static_pointer_cast<Message>(message));
+	}
+
+	bool passed = true;
+	auto buffer = std::make_shared<Buffer>(frames->size());
+	std::vector<std::shared_ptr<Message>> messageList;
+	FrameTypeTable typeTables[2];
+	double seconds[2] = {0, 0};
+	::printf("%d events, %d frames each\n", EVENT_COUNT, PIPELINE_DEPTH);
+	for(int event = 0; event < EVENT_COUNT; event++) {
+		for(int turn = 0; turn < 2; turn++) {
+			bool batch = (event + turn) % 2 == 1;
+			buffer->clear();
+			buffer->append(frames);
+			messageList.clear();
+			auto start = std::chrono::steady_clock::now();
+			ParseResult parseResult;
+			if(batch) {
+				parseResult = ProtoBuf::decodeAllFromBuffer(buffer, typeTables[batch], messageList);
+			} else {
+				while(true) {
+					auto decoded = ProtoBuf::decodeFromBuffer(buffer, typeTables[batch]);
+					parseResult = ProtoBuf::getParseResult();
+					if(parseResult != ParseResult::PARSE_SUCCESS) {
+						break;
+					}
+					messageList.push_back(decoded);
+				}
+			}
+			seconds[batch] += secondsSince(start);
+
+			passed = passed && parseResult == ParseResult::MESSAGE_INCOMPLETED && buffer->empty() && messageList.size() == PIPELINE_DEPTH;
+			for(int count = 0; passed && count < PIPELINE_DEPTH; count++) {
+				passed = messageList[count] && std::static_pointer_cast<request::simpledata>(messageList[count])->id() == count;
+			}
+		}
+	}
+	for(bool batch : {false, true}) {
+		::printf("  %-22s  %6.1f ns/frame\n", batch ? "decodeAllFromBuffer()" : "decodeFromBuffer() x n", seconds[batch] * 1e9 / (EVENT_COUNT * PIPELINE_DEPTH));
+	}
+
+	return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
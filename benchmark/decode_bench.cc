@@ -0,0 +1,120 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+
+#include <google/protobuf/descriptor.h>
+
+#include "message/request.simpledata.pb.h"
+#include "wnet.h"
+
+using namespace wnet;
+
+// decode a buffer full of request::simpledata frames,
+// with the descriptor pool lookup every frame ( as decodeFromBuffer() used to do ) against the per thread prototype cache,
+// every decoded message is checked, exit with EXIT_FAILURE on mismatch
+
+static std::atomic<bool> counting(false);
+static std::atomic<long> allocationCount(0);
+
+void* operator new(size_t size) {
+	if(counting.load(std::memory_order_relaxed)) {
+		allocationCount.fetch_add(1, std::memory_order_relaxed);
+	}
+	if(void* ptr = ::malloc(size == 0 ? 1 : size)) {
+		return ptr;
+	}
+	throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept {
+	::free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+	::free(ptr);
+}
+
+constexpr int FRAME_COUNT = 1000000;
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count();
+}
+
+// message of one frame, the way decodeFromBuffer() found it before the cache
+std::shared_ptr<Message> lookUpEveryFrame(const char* typeName, size_t length) {
+	const google::protobuf::Descriptor* descriptor = google::protobuf::DescriptorPool::generated_pool()->FindMessageTypeByName(std::string(typeName, length));
+	if(!descriptor) {
+		return nullptr;
+	}
+	const Message* prototype = google::protobuf::MessageFactory::generated_factory()->GetPrototype(descriptor);
+	return prototype ? std::shared_ptr<Message>(prototype->New()) : nullptr;
+}
+
+std::shared_ptr<Message> lookUpCached(const char* typeName, size_t length) {
+	const Message* prototype = ProtoBuf::getPrototype(typeName, length);
+	return prototype ? std::shared_ptr<Message>(prototype->New()) : nullptr;
+}
+
+// decode every frame in buffer with lookUp, same framing as ProtoBuf::decodeFromBuffer()
+template<typename LOOK_UP>
+bool decodeAll(std::shared_ptr<Buffer> buffer, LOOK_UP lookUp) {
+	for(int count = 0; count < FRAME_COUNT; count++) {
+		uint32_t typeNameSize = buffer->fetch_uint32();
+		const char* typeName = buffer->begin() + sizeof(uint32_t);
+		uint32_t messageSize = buffer->fetch_uint32(buffer->begin() + sizeof(uint32_t) + typeNameSize);
+		auto message = lookUp(typeName, typeNameSize);
+		if(!message || !message->ParseFromArray(typeName + typeNameSize + sizeof(uint32_t), static_cast<int>(messageSize))) {
+			return false;
+		}
+		buffer->consume(sizeof(uint32_t) * 2 + typeNameSize + messageSize);
+		if(std::static_pointer_cast<request::simpledata>(message)->id() != count) {
+			return false;
+		}
+	}
+	return buffer->empty();
+}
+
+int main(int argc, char *argv[]) {
+	ProtoBuf::registerMessageType<request::simpledata>();
+
+	auto frames = std::make_shared<Buffer>();
+	auto message = std::make_shared<request::simpledata>();
+	message->set_msg("hello wnet");
+	for(int count = 0; count < FRAME_COUNT; count++) {
+		message->set_id(count);
+		frames->append(std::static_pointer_cast<Message>(message));
+	}
+
+	bool passed = true;
+	::printf("%d request::simpledata frames, %zu bytes\n", FRAME_COUNT, frames->size());
+	for(bool cached : {false, true}) {
+		auto buffer = std::make_shared<Buffer>(frames->size());
+		buffer->append(frames);
+		allocationCount.store(0);
+		counting.store(true);
+		auto start = std::chrono::steady_clock::now();
+		passed = passed && (cached ? decodeAll(buffer, lookUpCached) : decodeAll(buffer, lookUpEveryFrame));
+		double seconds = secondsSince(start);
+		counting.store(false);
+		::printf("  %-22s  %8.1f ns/frame, %.2f allocations/frame\n",
+					 cached ? "per thread cache" : "descriptor pool lookup",
+					 seconds * 1e9 / FRAME_COUNT, 1.0 * allocationCount.load() / FRAME_COUNT);
+	}
+
+	// whole decodeFromBuffer() path, cached
+	auto buffer = std::make_shared<Buffer>(frames->size());
+	buffer->append(frames);
+	auto start = std::chrono::steady_clock::now();
+	for(int count = 0; count < FRAME_COUNT; count++) {
+		ParseResult parseResult;
+		auto decoded = buffer->fetchMessage(parseResult);
+		passed = passed && parseResult == ParseResult::PARSE_SUCCESS && std::static_pointer_cast<request::simpledata>(decoded)->id() == count;
+	}
+	::printf("  decodeFromBuffer()      %8.1f ns/frame\n", secondsSince(start) * 1e9 / FRAME_COUNT);
+
+	return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
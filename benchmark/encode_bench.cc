@@ -0,0 +1,104 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "message/request.simpledata.pb.h"
+#include "wnet.h"
+
+using namespace wnet;
+
+// encode request::simpledata frames into a Buffer,
+// the way encodeIntoBuffer() used to ( ByteSize() three times, header appended piece by piece ) against
+// one size computation serialized in place, and against batches of BATCH_SIZE through one reservation,
+// the bytes produced have to be the same, exit with EXIT_FAILURE otherwise
+
+constexpr int MESSAGE_COUNT = 1000000;
+constexpr int BATCH_SIZE = 16;
+constexpr int ROUND_COUNT = MESSAGE_COUNT / BATCH_SIZE;
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count();
+}
+
+void encodeAsBefore(std::shared_ptr<Message> message, std::shared_ptr<Buffer> buffer) {
+	const std::string& typeName = message->GetDescriptor()->full_name();
+	buffer->append_uint32(static_cast<uint32_t>(typeName.size()));
+	buffer->append(typeName);
+	buffer->append_uint32(static_cast<uint32_t>(message->ByteSizeLong()));
+	message->SerializeToArray(buffer->occupy(message->ByteSizeLong()), static_cast<int>(message->ByteSizeLong()));
+}
+
+// messages of one round, ids set by setIds()
+std::vector<std::shared_ptr<Message>> makeBatch() {
+	std::vector<std::shared_ptr<Message>> messageList;
+	for(int index = 0; index < BATCH_SIZE; index++) {
+		auto message = std::make_shared<request::simpledata>();
+		message->set_msg("hello wnet, response of a pipelined request");
+		messageList.push_back(message);
+	}
+	return messageList;
+}
+
+void setIds(std::vector<std::shared_ptr<Message>>& messageList, int round) {
+	for(int index = 0; index < BATCH_SIZE; index++) {
+		std::static_pointer_cast<request::simpledata>(messageList[index])->set_id(round * BATCH_SIZE + index);
+	}
+}
+
+// encode every round with way into buffer, cleared after each round unless kept
+void encodeAll(int way, std::vector<std::shared_ptr<Message>>& messageList, std::shared_ptr<Buffer> buffer, bool kept) {
+	FrameTypeTable typeTable;
+	for(int round = 0; round < ROUND_COUNT; round++) {
+		setIds(messageList, round);
+		if(way == 2) {
+			ProtoBuf::encodeIntoBuffer(messageList, buffer, typeTable);
+		} else {
+			for(auto &message : messageList) {
+				if(way == 0) {
+					encodeAsBefore(message, buffer);
+				} else {
+					ProtoBuf::encodeIntoBuffer(message, buffer, typeTable);
+				}
+			}
+		}
+		if(!kept) {
+			buffer->clear();
+		}
+	}
+}
+
+int main(int argc, char *argv[]) {
+	auto messageList = makeBatch();
+	const char* nameList[] = { "size computed x3", "ByteSizeLong() once", "batch of 16" };
+
+	bool passed = true;
+	std::shared_ptr<Buffer> expected;
+	::printf("%d request::simpledata frames\n", ROUND_COUNT * BATCH_SIZE);
+	for(int way = 0; way < 3; way++) {
+		auto start = std::chrono::steady_clock::now();
+		encodeAll(way, messageList, std::make_shared<Buffer>(), false);
+		double seconds = secondsSince(start);
+		::printf("  %-20s  %6.1f ns/frame\n", nameList[way], seconds * 1e9 / (ROUND_COUNT * BATCH_SIZE));
+
+		// same bytes every way
+		auto buffer = std::make_shared<Buffer>();
+		encodeAll(way, messageList, buffer, true);
+		if(!expected) {
+			expected = buffer;
+		}
+		passed = passed && buffer->size() == expected->size() && ::memcmp(buffer->begin(), expected->begin(), buffer->size()) == 0;
+	}
+
+	// and decoded back
+	for(int count = 0; passed && count < ROUND_COUNT * BATCH_SIZE; count++) {
+		ParseResult parseResult;
+		auto decoded = expected->fetchMessage(parseResult);
+		passed = parseResult == ParseResult::PARSE_SUCCESS && std::static_pointer_cast<request::simpledata>(decoded)->id() == count;
+	}
+
+	return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
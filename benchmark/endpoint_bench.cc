@@ -0,0 +1,52 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "wnet.h"
+
+using namespace wnet;
+
+// a master connection fanning out to BACKEND_COUNT backends, the pool of every backend looked up per sub request,
+// by ip / port string ( what initSubRequest(ip, port, ...) does ) against a BackendEndpoint resolved once,
+// both must reach the same pool, exit with EXIT_FAILURE otherwise
+
+constexpr int BACKEND_COUNT = 8;
+constexpr int ROUND_COUNT = 200000;
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count();
+}
+
+int main(int argc, char *argv[]) {
+	std::vector<std::shared_ptr<BackendEndpoint>> endpointList;
+	for(int index = 0; index < BACKEND_COUNT; index++) {
+		endpointList.push_back(Connector::getEndpoint("127.0.0.1", static_cast<short>(10001 + index)));
+	}
+
+	bool passed = true;
+	std::vector<ActiveConnectionSet*> poolList(BACKEND_COUNT);
+	::printf("%d rounds, %d backends each\n", ROUND_COUNT, BACKEND_COUNT);
+	for(bool resolved : {false, true}) {
+		auto start = std::chrono::steady_clock::now();
+		for(int round = 0; round < ROUND_COUNT; round++) {
+			for(int index = 0; index < BACKEND_COUNT; index++) {
+				if(resolved) {
+					poolList[index] = endpointList[index]->getConnectionPool(round % EVENT_LOOP_COUNT);
+				} else {
+					poolList[index] = Connector::getEndpoint("127.0.0.1", static_cast<short>(10001 + index))->getConnectionPool(round % EVENT_LOOP_COUNT);
+				}
+			}
+			for(int index = 0; passed && index < BACKEND_COUNT; index++) {
+				passed = poolList[index] == endpointList[index]->getConnectionPool(round % EVENT_LOOP_COUNT);
+			}
+		}
+		double seconds = secondsSince(start);
+		::printf("  %-22s  %6.1f ns/sub request\n", resolved ? "BackendEndpoint" : "ip / port string", seconds * 1e9 / (ROUND_COUNT * BACKEND_COUNT));
+	}
+
+	return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,121 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <thread>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "wnet.h"
+
+using namespace wnet;
+
+// count heap allocations of the whole process while one client keeps echoing through the server,
+// after warming up, the steady-state event path (epoll -> EventQueue -> EventLoop -> Connection) 
+// should make no allocation at all, exit with EXIT_FAILURE otherwise
+
+static std::atomic<bool> counting(false);
+static std::atomic<long> allocationCount(0);
+
+void* operator new(size_t size) {
+	if(counting.load(std::memory_order_relaxed)) {
+		allocationCount.fetch_add(1, std::memory_order_relaxed);
+	}
+	if(void* ptr = ::malloc(size == 0 ? 1 : size)) {
+		return ptr;
+	}
+	throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept {
+	::free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+	::free(ptr);
+}
+
+constexpr short BENCHMARK_PORT = 10099;
+constexpr int WARM_UP_ROUND = 1000;
+constexpr int BENCHMARK_ROUND = 100000;
+constexpr int MESSAGE_SIZE = 64;
+
+bool echo(int client_fd, char* message, char* reply) {
+	if(::write(client_fd, message, MESSAGE_SIZE) != MESSAGE_SIZE) {
+		return false;
+	}
+	int received = 0;
+	while(received < MESSAGE_SIZE) {
+		ssize_t readLen = ::read(client_fd, reply + received, static_cast<size_t>(MESSAGE_SIZE - received));
+		if(readLen <= 0) {
+			return false;
+		}
+		received += static_cast<int>(readLen);
+	}
+	return true;
+}
+
+long measure(ReactorMode mode) {
+	auto server = std::make_shared<TCPServer>(BENCHMARK_PORT, mode);
+	// idle timeout bookkeeping is not part of the event path
+	server->setEnableConnectionKeepAlive();
+	server->setOnReceiveDataHandler(
+		[](Connection* const connection) {
+			connection->writeData(connection->getInputBuffer());
+			connection->getInputBuffer()->clear();
+		}
+	);
+	std::thread serverThread([=] {
+		server->run();
+	});
+	std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+	int client_fd = ::socket(AF_INET, SOCK_STREAM, 0);
+	struct sockaddr_in serverAddr;
+	::memset(&serverAddr, 0, sizeof serverAddr);
+	serverAddr.sin_family = AF_INET;
+	serverAddr.sin_addr.s_addr = ::inet_addr("127.0.0.1");
+	serverAddr.sin_port = htons(BENCHMARK_PORT);
+	if(::connect(client_fd, reinterpret_cast<struct sockaddr*>(&serverAddr), sizeof serverAddr) == -1) {
+		::printf("connect failed\n");
+		::exit(EXIT_FAILURE);
+	}
+
+	char message[MESSAGE_SIZE], reply[MESSAGE_SIZE];
+	::memset(message, 'w', MESSAGE_SIZE);
+	for(int round = 0; round < WARM_UP_ROUND; round++) {
+		echo(client_fd, message, reply);
+	}
+
+	allocationCount.store(0);
+	counting.store(true);
+	for(int round = 0; round < BENCHMARK_ROUND; round++) {
+		if(!echo(client_fd, message, reply)) {
+			::printf("echo failed\n");
+			::exit(EXIT_FAILURE);
+		}
+	}
+	counting.store(false);
+
+	::close(client_fd);
+	server->shutdown();
+	serverThread.join();
+	return allocationCount.load();
+}
+
+int main(int argc, char *argv[]) {
+	Log::setLogLevel(LogLevel::FATAL);
+	Signal::setSignalHandler(SIGPIPE, []{});
+
+	long masterDispatch = measure(ReactorMode::MASTER_DISPATCH);
+	long loopPerThread = measure(ReactorMode::LOOP_PER_THREAD);
+
+	::printf("heap allocations over %d echo round trips\n", BENCHMARK_ROUND);
+	::printf("  ReactorMode::MASTER_DISPATCH  %ld\n", masterDispatch);
+	::printf("  ReactorMode::LOOP_PER_THREAD  %ld\n", loopPerThread);
+
+	return (masterDispatch == 0 && loopPerThread == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
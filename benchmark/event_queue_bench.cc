@@ -0,0 +1,74 @@
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#include "wnet.h"
+
+using namespace wnet;
+
+// compare the lock-free EventQueue with the former mutex + condition_variable queue
+// several producers (master thread / worker threads) feed one consumer (EventLoop)
+
+constexpr int EVENT_PER_PRODUCER = 1000000;
+
+template<typename PRODUCE, typename CONSUME>
+double runBenchmark(int producerCount, PRODUCE produce, CONSUME consume) {
+	auto start = std::chrono::steady_clock::now();
+
+	std::vector<std::thread> producerList;
+	for(int index = 0; index < producerCount; index++) {
+		producerList.push_back(std::thread([=] {
+			for(int count = 0; count < EVENT_PER_PRODUCER; count++) {
+				produce();
+			}
+		}));
+	}
+	consume(producerCount * EVENT_PER_PRODUCER);
+	for(auto &producer : producerList) {
+		producer.join();
+	}
+
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count();
+}
+
+int main(int argc, char *argv[]) {
+	Log::setLogLevel(LogLevel::FATAL);
+
+	for(int producerCount : {1, 2, 4}) {
+		MutexEventQueue mutexQueue(0);
+		double mutexSeconds = runBenchmark(
+			producerCount,
+			[&] { mutexQueue.addEvent(Event::makeTimeoutEvent(1)); },
+			[&](int total) {
+				for(int count = 0; count < total; count++) {
+					mutexQueue.fetchEvent();
+				}
+			}
+		);
+
+		EventQueue lockFreeQueue(0);
+		size_t passCount = 0;
+		double lockFreeSeconds = runBenchmark(
+			producerCount,
+			[&] { lockFreeQueue.addEvent(Event::makeTimeoutEvent(1)); },
+			[&](int total) {
+				std::vector<Event> batch;
+				for(int count = 0; count < total; ) {
+					lockFreeQueue.fetchEvents(batch);
+					count += static_cast<int>(batch.size());
+					batch.clear();
+					passCount++;
+				}
+			}
+		);
+
+		double total = static_cast<double>(producerCount) * EVENT_PER_PRODUCER;
+		::printf("producers: %d\n", producerCount);
+		::printf("  MutexEventQueue  %10.0f events/s\n", total / mutexSeconds);
+		::printf("  EventQueue       %10.0f events/s  (%.1f events per drain)\n", total / lockFreeSeconds, total / static_cast<double>(passCount));
+	}
+
+	return 0;
+}
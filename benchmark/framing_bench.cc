@@ -0,0 +1,62 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+
+#include "message/request.simpledata.pb.h"
+#include "wnet.h"
+
+using namespace wnet;
+
+// request::simpledata frames encoded and decoded in legacy framing ( type name every frame )
+// against compact framing ( type name once per connection, id + length afterwards ),
+// every decoded message is checked, exit with EXIT_FAILURE on mismatch
+
+constexpr int FRAME_COUNT = 1000000;
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count();
+}
+
+int main(int argc, char *argv[]) {
+	ProtoBuf::registerMessageType<request::simpledata>();
+
+	auto message = std::make_shared<request::simpledata>();
+	message->set_msg("hello wnet");
+
+	bool passed = true;
+	::printf("%d request::simpledata frames\n", FRAME_COUNT);
+	for(bool compact : {false, true}) {
+		// one table for each side of the connection
+		FrameTypeTable encodeTable, decodeTable;
+		if(compact) {
+			encodeTable.setCompact();
+		}
+
+		auto buffer = std::make_shared<Buffer>();
+		auto start = std::chrono::steady_clock::now();
+		for(int count = 0; count < FRAME_COUNT; count++) {
+			message->set_id(count);
+			ProtoBuf::encodeIntoBuffer(message, buffer, encodeTable);
+		}
+		double encodeSeconds = secondsSince(start);
+		size_t encodedSize = buffer->size();
+
+		start = std::chrono::steady_clock::now();
+		for(int count = 0; count < FRAME_COUNT; count++) {
+			auto decoded = ProtoBuf::decodeFromBuffer(buffer, decodeTable);
+			passed = passed && ProtoBuf::getParseResult() == ParseResult::PARSE_SUCCESS
+											&& std::static_pointer_cast<request::simpledata>(decoded)->id() == count;
+		}
+		double decodeSeconds = secondsSince(start);
+		// the receiving side answers in the framing it was spoken to
+		passed = passed && buffer->empty() && decodeTable.isCompact() == compact;
+
+		::printf("  %-8s  %6.1f bytes/frame, encode %6.1f ns/frame, decode %6.1f ns/frame\n",
+					 compact ? "compact" : "legacy", 1.0 * encodedSize / FRAME_COUNT,
+					 encodeSeconds * 1e9 / FRAME_COUNT, decodeSeconds * 1e9 / FRAME_COUNT);
+	}
+
+	return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,149 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "wnet.h"
+
+using namespace wnet;
+
+// echo over loopback, ReactorMode::LOOP_PER_THREAD with IOBackend::EPOLL against IOBackend::IO_URING,
+// CLIENT_THREAD_COUNT clients each write MESSAGE_SIZE bytes to all their connections, then read every echo back,
+// every byte must come back unchanged, exit with EXIT_FAILURE otherwise
+
+constexpr short PORT = 10011;
+constexpr int CLIENT_THREAD_COUNT = 4;
+constexpr int CONNECTION_PER_CLIENT = 16;
+constexpr int ROUND_COUNT = 5000;
+constexpr int MESSAGE_SIZE = 64;
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count();
+}
+
+bool readFully(int fd, char* data, size_t length) {
+	while(length > 0) {
+		ssize_t readLen = ::read(fd, data, length);
+		if(readLen <= 0) {
+			return false;
+		}
+		data += readLen;
+		length -= static_cast<size_t>(readLen);
+	}
+	return true;
+}
+
+// return false if any echo is lost or changed
+bool runClient(const struct sockaddr_in& address, int clientIndex) {
+	std::vector<int> fdList;
+	bool passed = true;
+	for(int index = 0; passed && index < CONNECTION_PER_CLIENT; index++) {
+		int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+		int flag = 1;
+		::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof flag);
+		passed = ::connect(fd, reinterpret_cast<const struct sockaddr*>(&address), sizeof address) == 0;
+		fdList.push_back(fd);
+	}
+
+	char message[MESSAGE_SIZE], echo[MESSAGE_SIZE];
+	for(int round = 0; passed && round < ROUND_COUNT; round++) {
+		::memset(message, 'a' + (clientIndex + round) % 26, sizeof message);
+		for(int fd : fdList) {
+			passed = passed && ::write(fd, message, sizeof message) == MESSAGE_SIZE;
+		}
+		for(int fd : fdList) {
+			passed = passed && readFully(fd, echo, sizeof echo) && ::memcmp(message, echo, sizeof echo) == 0;
+		}
+	}
+
+	for(int fd : fdList) {
+		::close(fd);
+	}
+	return passed;
+}
+
+// round trips per second, -1 if any echo is lost or changed
+double runEcho(IOBackend backend, IOBackend& backendUsed) {
+	auto server = std::make_shared<TCPServer>(PORT, ReactorMode::LOOP_PER_THREAD);
+	server->setIOBackend(backend);
+	server->setEnableReusePortAcceptors();
+	server->setOnReceiveDataHandler(
+		[](Connection* const connection) {
+			connection->writeData(connection->getInputBuffer());
+			connection->getInputBuffer()->clear();
+		}
+	);
+
+	struct sockaddr_in address;
+	bzero(&address, sizeof address);
+	address.sin_family = AF_INET;
+	address.sin_port = htons(PORT);
+	::inet_pton(AF_INET, "127.0.0.1", &address.sin_addr);
+
+	bool passed = true;
+	double seconds = 0;
+	std::thread clientThread([&] {
+		// wait for the server to listen
+		int probe_fd;
+		while((probe_fd = ::socket(AF_INET, SOCK_STREAM, 0)) >= 0 &&
+					::connect(probe_fd, reinterpret_cast<const struct sockaddr*>(&address), sizeof address) != 0) {
+			::close(probe_fd);
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+		::close(probe_fd);
+
+		auto start = std::chrono::steady_clock::now();
+		std::vector<std::thread> clientList;
+		std::vector<char> passedList(CLIENT_THREAD_COUNT, 0);
+		for(int index = 0; index < CLIENT_THREAD_COUNT; index++) {
+			clientList.push_back(std::thread([&, index] {
+				passedList[static_cast<size_t>(index)] = runClient(address, index);
+			}));
+		}
+		for(auto &client : clientList) {
+			client.join();
+		}
+		seconds = secondsSince(start);
+		for(char clientPassed : passedList) {
+			passed = passed && clientPassed;
+		}
+		server->shutdown();
+	});
+
+	server->run();
+	clientThread.join();
+	backendUsed = EventPoll::getIOBackend();
+
+	return passed ? CLIENT_THREAD_COUNT * CONNECTION_PER_CLIENT * ROUND_COUNT / seconds : -1;
+}
+
+int main(int argc, char *argv[]) {
+	Log::setLogLevel(LogLevel::FATAL);
+
+	bool passed = true;
+	::printf("%d clients, %d connections each, %d rounds of %d bytes, %d EventLoops\n",
+					 CLIENT_THREAD_COUNT, CONNECTION_PER_CLIENT, ROUND_COUNT, MESSAGE_SIZE, EVENT_LOOP_COUNT);
+	for(IOBackend backend : {IOBackend::EPOLL, IOBackend::IO_URING}) {
+		IOBackend backendUsed;
+		double roundTripsPerSecond = runEcho(backend, backendUsed);
+		const char* name = backend == IOBackend::EPOLL ? "epoll" : "io_uring";
+		if(roundTripsPerSecond < 0) {
+			::printf("  %-10s  echo lost or changed\n", name);
+			passed = false;
+		} else {
+			::printf("  %-10s  %9.0f round trips/s%s\n", name, roundTripsPerSecond,
+							 backend != backendUsed ? "  ( unsupported, fell back to epoll )" : "");
+		}
+	}
+
+	return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,101 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <dirent.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "wnet.h"
+
+using namespace wnet;
+
+// cost of LOG() seen by the logging threads, one per EventLoop plus the master thread,
+// synchronous file logging (fopen / fclose every line) against the asynchronous writer thread
+
+constexpr int THREAD_COUNT = EVENT_LOOP_COUNT + 1;
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count();
+}
+
+// seconds until every thread finished its LOG() calls
+double logFromThreads(int linePerThread) {
+	auto start = std::chrono::steady_clock::now();
+	std::vector<std::thread> threadList;
+	for(int id = 0; id < THREAD_COUNT; id++) {
+		threadList.push_back(std::thread([=] {
+			for(int line = 0; line < linePerThread; line++) {
+				LOG(LogLevel::INFO, "[EventLoop][id %d] loop id: %d, event_fd: %d, event: %d, handled", id, id, line, 1);
+			}
+		}));
+	}
+	for(auto &thread : threadList) {
+		thread.join();
+	}
+	return secondsSince(start);
+}
+
+// lines written to every file in directory, removing them
+long countAndRemoveLines(const std::string& directory) {
+	long lineCount = 0;
+	DIR* dir = ::opendir(directory.c_str());
+	while(struct dirent* entry = ::readdir(dir)) {
+		if(entry->d_name[0] == '.') {
+			continue;
+		}
+		std::string path = directory + "/" + entry->d_name;
+		FILE* file = ::fopen(path.c_str(), "r");
+		for(int ch = ::fgetc(file); ch != EOF; ch = ::fgetc(file)) {
+			lineCount += ch == '\n';
+		}
+		::fclose(file);
+		::unlink(path.c_str());
+	}
+	::closedir(dir);
+	return lineCount;
+}
+
+int main(int argc, char *argv[]) {
+	char directoryTemplate[] = "/tmp/wnet_log_bench_XXXXXX";
+	std::string directory = ::mkdtemp(directoryTemplate);
+	Log::setLogLevel(LogLevel::INFO);
+	Log::setLogFile(directory);
+	countAndRemoveLines(directory);
+	bool passed = true;
+
+	printf("%d logging threads\n", THREAD_COUNT);
+
+	int syncLines = 20000;
+	double syncSeconds = logFromThreads(syncLines);
+	long syncWritten = countAndRemoveLines(directory);
+	printf("  synchronous            %8.1f ns/line, %ld of %d lines written\n",
+				 syncSeconds * 1e9 / syncLines, syncWritten, syncLines * THREAD_COUNT);
+	passed = passed && syncWritten == static_cast<long>(syncLines) * THREAD_COUNT;
+
+	int asyncLines = 1000000;
+	for(LogFullPolicy policy : {LogFullPolicy::BLOCK, LogFullPolicy::DROP}) {
+		uint64_t droppedBefore = AsyncLog::getDroppedCount();
+		Log::setAsync(policy);
+		double asyncSeconds = logFromThreads(asyncLines);
+		auto flushStart = std::chrono::steady_clock::now();
+		AsyncLog::stop();
+		double flushSeconds = secondsSince(flushStart);
+		long asyncWritten = countAndRemoveLines(directory);
+		uint64_t dropped = AsyncLog::getDroppedCount() - droppedBefore;
+		// DROP writes one extra report line per batch with drops in it
+		printf("  async %-5s            %8.1f ns/line, %ld of %d lines written, %llu dropped, %.3f s to flush on stop\n",
+					 policy == LogFullPolicy::BLOCK ? "BLOCK" : "DROP",
+					 asyncSeconds * 1e9 / asyncLines, asyncWritten, asyncLines * THREAD_COUNT,
+					 static_cast<unsigned long long>(dropped), flushSeconds);
+		if(policy == LogFullPolicy::BLOCK) {
+			passed = passed && asyncWritten == static_cast<long>(asyncLines) * THREAD_COUNT && dropped == 0;
+		} else {
+			passed = passed && asyncWritten >= static_cast<long>(asyncLines * THREAD_COUNT - dropped);
+		}
+	}
+
+	::rmdir(directory.c_str());
+	return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,102 @@
+#include <arpa/inet.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+#include "wnet.h"
+
+using namespace wnet;
+
+// what the DEBUG statements on the event path cost when filtered out
+// built twice by `make benchmark`:
+//   benchmark/log_level_bench           default objects, DEBUG filtered by Log::setLogLevel() at runtime
+//   benchmark/log_level_bench_release   `make release` objects, DEBUG compiled out ( WNET_LOG_MIN_LEVEL )
+
+constexpr int FILTERED_LOG_COUNT = 10000000;
+constexpr int ROUND_TRIP_COUNT = 100000;
+constexpr int MESSAGE_SIZE = 64;
+constexpr short PORT = 10098;
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count();
+}
+
+int main(int argc, char *argv[]) {
+	Log::setLogLevel(LogLevel::ERROR);
+	Signal::setSignalHandler(SIGPIPE, []{});
+
+	// same shape as the statements in EventLoop::handleEvent()
+	auto start = std::chrono::steady_clock::now();
+	for(int count = 0; count < FILTERED_LOG_COUNT; count++) {
+		LOG(LogLevel::DEBUG, "[EventLoop] loop id: %d, event_fd: %d, event: %d, start handling", count & 1, count, 1);
+	}
+	double filteredSeconds = secondsSince(start);
+
+	// what every filtered statement used to cost, a call into addLog() before the level check
+	start = std::chrono::steady_clock::now();
+	for(int count = 0; count < FILTERED_LOG_COUNT; count++) {
+		Log::addLog(__FILE__, __FUNCTION__, __LINE__, LogLevel::DEBUG, "[EventLoop] loop id: %d, event_fd: %d, event: %d, start handling", count & 1, count, 1);
+	}
+	double formerSeconds = secondsSince(start);
+
+	// whole event path, master thread -> EventLoop -> Connection, echoing over loopback
+	auto server = std::make_shared<TCPServer>(PORT);
+	server->setEnableConnectionKeepAlive();
+	server->setOnReceiveDataHandler(
+		[](Connection* const connection) {
+			connection->writeData(connection->getInputBuffer());
+			connection->getInputBuffer()->clear();
+		}
+	);
+	std::thread serverThread([server] {
+		server->run();
+	});
+	std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+	int client_fd = ::socket(AF_INET, SOCK_STREAM, 0);
+	struct sockaddr_in serverAddr;
+	::memset(&serverAddr, 0, sizeof serverAddr);
+	serverAddr.sin_family = AF_INET;
+	serverAddr.sin_port = htons(PORT);
+	serverAddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if(::connect(client_fd, reinterpret_cast<struct sockaddr*>(&serverAddr), sizeof serverAddr) == -1) {
+		printf("connect failed: %s\n", ::strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	char message[MESSAGE_SIZE];
+	::memset(message, 'w', MESSAGE_SIZE);
+	char response[MESSAGE_SIZE];
+	start = std::chrono::steady_clock::now();
+	for(int count = 0; count < ROUND_TRIP_COUNT; count++) {
+		if(::write(client_fd, message, MESSAGE_SIZE) != MESSAGE_SIZE) {
+			printf("write failed: %s\n", ::strerror(errno));
+			return EXIT_FAILURE;
+		}
+		for(ssize_t received = 0; received < MESSAGE_SIZE; ) {
+			ssize_t readLen = ::read(client_fd, response + received, static_cast<size_t>(MESSAGE_SIZE - received));
+			if(readLen <= 0) {
+				printf("read failed: %s\n", ::strerror(errno));
+				return EXIT_FAILURE;
+			}
+			received += readLen;
+		}
+	}
+	double roundTripSeconds = secondsSince(start);
+	::close(client_fd);
+
+	server->shutdown();
+	serverThread.join();
+
+	printf("WNET_LOG_MIN_LEVEL %d, runtime level ERROR\n", WNET_LOG_MIN_LEVEL);
+	printf("  filtered LOG(DEBUG)  %8.2f ns/statement\n", filteredSeconds * 1e9 / FILTERED_LOG_COUNT);
+	printf("  former LOG(DEBUG)    %8.2f ns/statement\n", formerSeconds * 1e9 / FILTERED_LOG_COUNT);
+	printf("  echo round trip      %8.2f us\n", roundTripSeconds * 1e6 / ROUND_TRIP_COUNT);
+	return EXIT_SUCCESS;
+}
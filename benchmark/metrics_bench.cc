@@ -0,0 +1,415 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "message/request.simpledata.pb.h"
+#include "wnet.h"
+
+using namespace wnet;
+
+// 1. every value lands in a bucket whose upper bound is off by 1 / 16 at most
+// 2. echo round trips with latency histograms off against on, with them on a fan out client to three backends
+//    ( echoing, silent, closing at once ) as well, the snapshot pulled from the admin port and dumped on SIGUSR1
+//    must count what was sent, accepted, resolved, timed out and rejected
+// 3. cost of recording
+// exit with EXIT_FAILURE otherwise
+
+constexpr short PORT = 10014;
+constexpr short ECHO_BACKEND_PORT = 10015;
+constexpr short METRICS_PORT = 10016;
+constexpr short SILENT_BACKEND_PORT = 10017;
+constexpr short CLOSING_BACKEND_PORT = 10018;
+constexpr const char* DUMP_PATH = "/tmp/wnet_metrics_bench.txt";
+
+constexpr int RECORD_COUNT = 10000000;
+constexpr int CLIENT_COUNT = 8;
+constexpr int ROUND_COUNT = 10000;
+constexpr int MESSAGE_SIZE = 64;
+constexpr int FAN_OUT_ROUND_COUNT = 20;
+constexpr int SUB_REQUEST_TIMEOUT_MS = 50;
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count();
+}
+
+struct sockaddr_in addressOf(short port) {
+	struct sockaddr_in address;
+	bzero(&address, sizeof address);
+	address.sin_family = AF_INET;
+	address.sin_port = htons(port);
+	::inet_pton(AF_INET, "127.0.0.1", &address.sin_addr);
+	return address;
+}
+
+int connectTo(short port) {
+	struct sockaddr_in address = addressOf(port);
+	int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+	int flag = 1;
+	::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof flag);
+	if(::connect(fd, reinterpret_cast<const struct sockaddr*>(&address), sizeof address) != 0) {
+		::close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+bool readFully(int fd, char* data, size_t length) {
+	while(length > 0) {
+		ssize_t readLen = ::read(fd, data, length);
+		if(readLen <= 0) {
+			return false;
+		}
+		data += readLen;
+		length -= static_cast<size_t>(readLen);
+	}
+	return true;
+}
+
+// "name{label} value" lines
+std::map<std::string, uint64_t> parseSnapshot(const std::string& text) {
+	std::map<std::string, uint64_t> values;
+	std::istringstream lines(text);
+	std::string name;
+	unsigned long long value;
+	while(lines >> name >> value) {
+		values[name] = value;
+	}
+	return values;
+}
+
+// a listening socket on port, every connection handled by a detached thread, never joined
+void startBackend(short port, void (*handle)(int)) {
+	struct sockaddr_in address = addressOf(port);
+	int listen_fd = ::socket(AF_INET, SOCK_STREAM, 0);
+	int flag = 1;
+	::setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof flag);
+	if(::bind(listen_fd, reinterpret_cast<const struct sockaddr*>(&address), sizeof address) != 0 || ::listen(listen_fd, 128) != 0) {
+		::printf("backend port %d unavailable\n", port);
+		::exit(EXIT_FAILURE);
+	}
+	std::thread([listen_fd, handle] {
+		int fd;
+		while((fd = ::accept(listen_fd, nullptr, nullptr)) >= 0) {
+			std::thread(handle, fd).detach();
+		}
+	}).detach();
+}
+
+void echoBackend(int fd) {
+	char data[4096];
+	ssize_t readLen;
+	while((readLen = ::read(fd, data, sizeof data)) > 0) {
+		if(::write(fd, data, static_cast<size_t>(readLen)) != readLen) {
+			break;
+		}
+	}
+	::close(fd);
+}
+
+void silentBackend(int fd) {
+	char data[4096];
+	while(::read(fd, data, sizeof data) > 0) {}
+	::close(fd);
+}
+
+void closingBackend(int fd) {
+	::close(fd);
+}
+
+bool checkBuckets() {
+	std::mt19937_64 random(7);
+	for(int round = 0; round < 1000000; round++) {
+		uint64_t value = random() >> (random() % 64);
+		value = std::min<uint64_t>(value, (1ULL << METRICS_HISTOGRAM_MAX_BITS) - 1);
+		int index = HistogramBuckets::indexOf(value);
+		uint64_t upperBound = HistogramBuckets::upperBoundOf(index);
+		uint64_t lowerBound = index == 0 ? 0 : HistogramBuckets::upperBoundOf(index - 1) + 1;
+		if(index < 0 || index >= METRICS_HISTOGRAM_BUCKET_COUNT || value < lowerBound || value > upperBound ||
+			 static_cast<double>(upperBound - value) > static_cast<double>(value) / (1 << METRICS_HISTOGRAM_SUB_BUCKET_BITS)) {
+			::printf("  value %llu misplaced in bucket %d\n", static_cast<unsigned long long>(value), index);
+			return false;
+		}
+	}
+	return HistogramBuckets::indexOf(UINT64_MAX) == METRICS_HISTOGRAM_BUCKET_COUNT - 1;
+}
+
+void measureRecording() {
+	auto start = std::chrono::steady_clock::now();
+	for(int round = 0; round < RECORD_COUNT; round++) {
+		Metrics::add(MetricsCounter::EVENTS_HANDLED);
+	}
+	double sharedSeconds = secondsSince(start);
+
+	uint64_t sum = 0;
+	std::thread([&] {
+		// as if in EventLoop 0
+		Metrics::bindThread(0);
+		auto loopStart = std::chrono::steady_clock::now();
+		for(int round = 0; round < RECORD_COUNT; round++) {
+			Metrics::add(MetricsCounter::EVENTS_HANDLED);
+		}
+		double loopSeconds = secondsSince(loopStart);
+
+		loopStart = std::chrono::steady_clock::now();
+		for(int round = 0; round < RECORD_COUNT; round++) {
+			Metrics::record(MetricsHistogram::HANDLER_TIME, static_cast<uint64_t>(round));
+		}
+		double recordSeconds = secondsSince(loopStart);
+
+		loopStart = std::chrono::steady_clock::now();
+		for(int round = 0; round < RECORD_COUNT; round++) {
+			sum += Metrics::now();
+		}
+		double clockSeconds = secondsSince(loopStart);
+
+		::printf("  counter, EventLoop shard    %6.2f ns\n", loopSeconds * 1e9 / RECORD_COUNT);
+		::printf("  counter, shared shard       %6.2f ns\n", sharedSeconds * 1e9 / RECORD_COUNT);
+		::printf("  histogram record            %6.2f ns\n", recordSeconds * 1e9 / RECORD_COUNT);
+		::printf("  clock read                  %6.2f ns  ( twice per timed span )\n", clockSeconds * 1e9 / RECORD_COUNT);
+	}).join();
+	if(sum == 0) {
+		::printf("  clock never moved\n");
+	}
+}
+
+// false if any echo is lost or changed
+bool runEcho(int fd) {
+	char message[MESSAGE_SIZE], echo[MESSAGE_SIZE];
+	::memset(message, 'e', sizeof message);
+	for(int round = 0; round < ROUND_COUNT; round++) {
+		if(::write(fd, message, sizeof message) != MESSAGE_SIZE || !readFully(fd, echo, sizeof echo) || ::memcmp(message, echo, sizeof echo) != 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+struct Result {
+	bool passed;
+	double roundTripsPerSecond;
+	std::string snapshot;     // from the admin port
+	std::string dump;         // written on SIGUSR1
+};
+
+// backends and metrics exports only with latency metrics
+Result runServer(bool latency) {
+	auto server = std::make_shared<TCPServer>(PORT);
+	std::vector<std::shared_ptr<BackendEndpoint>> endpointList;
+	if(latency) {
+		server->setEnableLatencyMetrics();
+		server->setMetricsPort(METRICS_PORT);
+		server->setMetricsDump(SIGUSR1, DUMP_PATH);
+		for(short port : {ECHO_BACKEND_PORT, SILENT_BACKEND_PORT, CLOSING_BACKEND_PORT}) {
+			endpointList.push_back(Connector::getEndpoint("127.0.0.1", port));
+		}
+	}
+	// 'e' echoed, 'f' fanned out to every backend, answered with 'd' once all settled
+	server->setOnReceiveDataHandler(
+		[endpointList](Connection* const connection) {
+			auto input = connection->getInputBuffer();
+			if(input->begin()[0] == 'e') {
+				connection->writeData(input);
+				input->clear();
+				return;
+			}
+			input->clear();
+			auto requestData = std::make_shared<request::simpledata>();
+			requestData->set_id(0);
+			requestData->set_msg("metrics");
+			std::vector<std::shared_ptr<RequestResult>> requestResultList;
+			for(auto &endpoint : endpointList) {
+				requestResultList.push_back(Connector::initSubRequest(endpoint, requestData, connection->thisConnection(),
+																															std::chrono::milliseconds(SUB_REQUEST_TIMEOUT_MS)));
+			}
+			connection->await(requestResultList, [](Connection* const masterConnection) {
+				masterConnection->writeData("d");
+				masterConnection->requestResolved();
+			});
+		}
+	);
+
+	Result result = {true, 0, "", ""};
+	std::thread clientThread([&] {
+		// wait for the server to listen
+		int probe_fd;
+		while((probe_fd = connectTo(PORT)) < 0) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+		::close(probe_fd);
+
+		auto start = std::chrono::steady_clock::now();
+		std::vector<std::thread> threadList;
+		std::vector<char> passedList(CLIENT_COUNT + 1, 1);
+		for(int index = 0; index < CLIENT_COUNT; index++) {
+			threadList.push_back(std::thread([&, index] {
+				int fd = connectTo(PORT);
+				passedList[static_cast<size_t>(index)] = fd >= 0 && runEcho(fd);
+				::close(fd);
+			}));
+		}
+		if(latency) {
+			threadList.push_back(std::thread([&] {
+				int fd = connectTo(PORT);
+				char done;
+				for(int round = 0; fd >= 0 && round < FAN_OUT_ROUND_COUNT; round++) {
+					if(::write(fd, "f", 1) != 1 || !readFully(fd, &done, 1) || done != 'd') {
+						passedList[CLIENT_COUNT] = 0;
+						break;
+					}
+				}
+				::close(fd);
+			}));
+		}
+		for(auto &thread : threadList) {
+			thread.join();
+		}
+		double seconds = secondsSince(start);
+		for(char clientPassed : passedList) {
+			result.passed = result.passed && clientPassed;
+		}
+		result.roundTripsPerSecond = CLIENT_COUNT * ROUND_COUNT / seconds;
+
+		if(latency) {
+			int fd = connectTo(METRICS_PORT);
+			char data[4096];
+			ssize_t readLen;
+			while(fd >= 0 && (readLen = ::read(fd, data, sizeof data)) > 0) {
+				result.snapshot.append(data, static_cast<size_t>(readLen));
+			}
+			::close(fd);
+
+			::unlink(DUMP_PATH);
+			::kill(::getpid(), SIGUSR1);
+			for(int wait = 0; wait < 200 && result.dump.empty(); wait++) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(10));
+				std::ifstream dump(DUMP_PATH);
+				std::stringstream content;
+				content << dump.rdbuf();
+				result.dump = content.str();
+			}
+		}
+		server->shutdown();
+	});
+
+	server->run();
+	clientThread.join();
+	return result;
+}
+
+// what runServer(true) did, on top of the counts before it
+bool checkSnapshot(const std::map<std::string, uint64_t>& before, const std::map<std::string, uint64_t>& after) {
+	auto delta = [&](const std::string& name) -> uint64_t {
+		auto found = after.find(name);
+		auto was = before.find(name);
+		return (found == after.end() ? 0 : found->second) - (was == before.end() ? 0 : was->second);
+	};
+	auto endpoint = [](const char* name, short port) {
+		return std::string(name) + "{endpoint=\"127.0.0.1:" + std::to_string(port) + "\"}";
+	};
+
+	uint64_t echoedBytes = static_cast<uint64_t>(CLIENT_COUNT) * ROUND_COUNT * MESSAGE_SIZE;
+	struct Check {
+		const char* what;
+		bool passed;
+	};
+	bool passed = true;
+	for(auto &check : {
+		Check{"bytes_in", delta("bytes_in") >= echoedBytes + FAN_OUT_ROUND_COUNT},
+		Check{"bytes_out", delta("bytes_out") >= echoedBytes + FAN_OUT_ROUND_COUNT},
+		Check{"accepts", delta("accepts") == CLIENT_COUNT + 2},     // probe and fan out client
+		Check{"events_handled", delta("events_handled") >= static_cast<uint64_t>(CLIENT_COUNT) * ROUND_COUNT},
+		Check{"sub_requests_issued", delta("sub_requests_issued") == 3 * FAN_OUT_ROUND_COUNT},
+		Check{"sub_requests_resolved", delta(endpoint("sub_requests_resolved", ECHO_BACKEND_PORT)) == FAN_OUT_ROUND_COUNT &&
+																	 delta("sub_requests_resolved") == FAN_OUT_ROUND_COUNT},
+		Check{"sub_requests_timed_out", delta(endpoint("sub_requests_timed_out", SILENT_BACKEND_PORT)) == FAN_OUT_ROUND_COUNT &&
+																		delta("sub_requests_timed_out") == FAN_OUT_ROUND_COUNT},
+		Check{"sub_requests_rejected", delta(endpoint("sub_requests_rejected", CLOSING_BACKEND_PORT)) == FAN_OUT_ROUND_COUNT &&
+																	 delta("sub_requests_rejected") == FAN_OUT_ROUND_COUNT},
+		Check{"sub_requests_cancelled", delta("sub_requests_cancelled") == 0},
+		Check{"queue_wait_ns_count", delta("queue_wait_ns_count") > 0},
+		Check{"handler_time_ns_count", delta("handler_time_ns_count") >= static_cast<uint64_t>(CLIENT_COUNT) * ROUND_COUNT},
+		Check{"sub_request_rtt_ns_count", delta("sub_request_rtt_ns_count") == FAN_OUT_ROUND_COUNT},
+	}) {
+		if(!check.passed) {
+			::printf("  %s wrong\n", check.what);
+			passed = false;
+		}
+	}
+	return passed;
+}
+
+int main(int argc, char *argv[]) {
+	Log::setLogLevel(LogLevel::FATAL);
+	ProtoBuf::registerMessageType<request::simpledata>();
+	Signal::setSignalHandler(SIGPIPE, []{});
+
+	bool passed = true;
+	passed = checkBuckets();
+	::printf("histogram buckets %s\n", passed ? "checked" : "wrong");
+
+	startBackend(ECHO_BACKEND_PORT, echoBackend);
+	startBackend(SILENT_BACKEND_PORT, silentBackend);
+	startBackend(CLOSING_BACKEND_PORT, closingBackend);
+
+	::printf("%d clients, %d rounds of %d bytes, %d EventLoops\n", CLIENT_COUNT, ROUND_COUNT, MESSAGE_SIZE, EVENT_LOOP_COUNT);
+	auto before = parseSnapshot(Metrics::snapshot());
+	for(bool latency : {false, true}) {
+		if(latency) {
+			before = parseSnapshot(Metrics::snapshot());
+		}
+		Result result = runServer(latency);
+		const char* name = latency ? "latency metrics" : "counters only";
+		if(!result.passed) {
+			::printf("  %-16s  echo lost or changed\n", name);
+			passed = false;
+			continue;
+		}
+		::printf("  %-16s  %9.0f round trips/s\n", name, result.roundTripsPerSecond);
+		if(!latency) {
+			continue;
+		}
+
+		auto after = parseSnapshot(result.snapshot);
+		auto dumped = parseSnapshot(result.dump);
+		if(!checkSnapshot(before, after)) {
+			::printf("  admin port snapshot:\n%s", result.snapshot.c_str());
+			passed = false;
+		} else if(!checkSnapshot(before, dumped)) {
+			::printf("  SIGUSR1 dump:\n%s", result.dump.c_str());
+			passed = false;
+		} else {
+			for(const char* histogram : {"queue_wait_ns", "handler_time_ns", "sub_request_rtt_ns"}) {
+				std::string quantile = std::string(histogram) + "{quantile=\"";
+				::printf("    %-20s  p50 %8llu  p99 %8llu  max %10llu ns\n", histogram,
+								 static_cast<unsigned long long>(after[quantile + "0.5\"}"]),
+								 static_cast<unsigned long long>(after[quantile + "0.99\"}"]),
+								 static_cast<unsigned long long>(after[std::string(histogram) + "_max"]));
+			}
+		}
+	}
+
+	// last, values recorded here would show up in the snapshots above
+	::printf("recording cost, %d records each\n", RECORD_COUNT);
+	measureRecording();
+
+	return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
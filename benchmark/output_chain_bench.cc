@@ -0,0 +1,133 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <thread>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "wnet.h"
+
+using namespace wnet;
+
+// a pre-serialized response much larger than a request, written by copying into the connection
+// ( writeData(std::string) ) against referencing the shared payload ( writeData(std::shared_ptr<const std::string>) ),
+// every response is checked byte by byte, exit with EXIT_FAILURE on mismatch
+
+static std::atomic<bool> counting(false);
+static std::atomic<long> allocationBytes(0);
+
+void* operator new(size_t size) {
+	if(counting.load(std::memory_order_relaxed)) {
+		allocationBytes.fetch_add(static_cast<long>(size), std::memory_order_relaxed);
+	}
+	if(void* ptr = ::malloc(size == 0 ? 1 : size)) {
+		return ptr;
+	}
+	throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept {
+	::free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+	::free(ptr);
+}
+
+constexpr short BENCHMARK_PORT = 10096;
+constexpr int PAYLOAD_SIZE = 256 * 1024;
+constexpr int WARM_UP_ROUND = 100;
+constexpr int BENCHMARK_ROUND = 4000;
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count();
+}
+
+// request byte 'c' for a copied response, 'r' for a referenced one
+bool request(int client_fd, char mode, const std::string& payload, std::string& response) {
+	if(::write(client_fd, &mode, 1) != 1) {
+		return false;
+	}
+	size_t received = 0;
+	while(received < payload.size()) {
+		ssize_t readLen = ::read(client_fd, &response[received], payload.size() - received);
+		if(readLen <= 0) {
+			return false;
+		}
+		received += static_cast<size_t>(readLen);
+	}
+	return response == payload;
+}
+
+int main(int argc, char *argv[]) {
+	Log::setLogLevel(LogLevel::FATAL);
+	Signal::setSignalHandler(SIGPIPE, []{});
+
+	auto payload = std::make_shared<std::string>(PAYLOAD_SIZE, '\0');
+	for(size_t index = 0; index < payload->size(); index++) {
+		(*payload)[index] = static_cast<char>(index * 131);
+	}
+	std::shared_ptr<const std::string> sharedPayload = payload;
+
+	auto server = std::make_shared<TCPServer>(BENCHMARK_PORT);
+	server->setEnableConnectionKeepAlive();
+	server->setOnReceiveDataHandler(
+		[=](Connection* const connection) {
+			auto inputBuf = connection->getInputBuffer();
+			while(!inputBuf->empty()) {
+				char mode;
+				inputBuf->fetch(&mode, 1);
+				if(mode == 'c') {
+					connection->writeData(*sharedPayload);
+				} else {
+					connection->writeData(sharedPayload);
+				}
+			}
+		}
+	);
+	std::thread serverThread([server] {
+		server->run();
+	});
+	std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+	int client_fd = ::socket(AF_INET, SOCK_STREAM, 0);
+	struct sockaddr_in serverAddr;
+	::memset(&serverAddr, 0, sizeof serverAddr);
+	serverAddr.sin_family = AF_INET;
+	serverAddr.sin_addr.s_addr = ::inet_addr("127.0.0.1");
+	serverAddr.sin_port = htons(BENCHMARK_PORT);
+	if(::connect(client_fd, reinterpret_cast<struct sockaddr*>(&serverAddr), sizeof serverAddr) == -1) {
+		::printf("connect failed\n");
+		return EXIT_FAILURE;
+	}
+
+	std::string response(PAYLOAD_SIZE, '\0');
+	bool passed = true;
+	::printf("%d responses of %d bytes\n", BENCHMARK_ROUND, PAYLOAD_SIZE);
+	for(char mode : {'c', 'r'}) {
+		for(int round = 0; round < WARM_UP_ROUND; round++) {
+			passed = passed && request(client_fd, mode, *payload, response);
+		}
+		allocationBytes.store(0);
+		counting.store(true);
+		auto start = std::chrono::steady_clock::now();
+		for(int round = 0; round < BENCHMARK_ROUND; round++) {
+			passed = passed && request(client_fd, mode, *payload, response);
+		}
+		double seconds = secondsSince(start);
+		counting.store(false);
+		::printf("  %-10s  %8.1f us/response, %ld bytes allocated\n",
+					 mode == 'c' ? "copied" : "referenced", seconds * 1e6 / BENCHMARK_ROUND, allocationBytes.load());
+	}
+
+	::close(client_fd);
+	server->shutdown();
+	serverThread.join();
+	return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,176 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "wnet.h"
+
+using namespace wnet;
+
+// fairness: BLASTER_COUNT clients write BLAST_CHUNK_SIZE chunks as fast as they can, the server drops them,
+// while PING_CLIENT_COUNT clients on the same EventLoops time ping pong rounds of PING_SIZE bytes echoed,
+// with the default read budget against reading until EAGAIN, every echo must come back, exit with EXIT_FAILURE otherwise
+
+constexpr short PORT = 10013;
+constexpr int BLASTER_COUNT = EVENT_LOOP_COUNT;
+constexpr int BLAST_CHUNK_SIZE = 256 * 1024;
+constexpr int PING_CLIENT_COUNT = 8;
+constexpr int PING_SIZE = 64;
+constexpr int RUN_MS = 2000;
+
+struct Result {
+	bool passed;
+	long rounds;
+	double p99LatencyUs;
+	double maxLatencyUs;
+	double blastMBPerSecond;
+};
+
+int connectTo(const struct sockaddr_in& address) {
+	int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+	int flag = 1;
+	::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof flag);
+	if(::connect(fd, reinterpret_cast<const struct sockaddr*>(&address), sizeof address) != 0) {
+		::close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+Result runFairness(bool readBudget) {
+	auto server = std::make_shared<TCPServer>(PORT, ReactorMode::LOOP_PER_THREAD);
+	if(!readBudget) {
+		// input isn't cut at the high watermark either
+		server->setReadBudget(SIZE_MAX, INT_MAX);
+		server->setOutputWatermarks(SIZE_MAX, 0);
+	}
+	// blasters say so with their first byte, only pings are echoed
+	server->setOnReceiveDataHandler(
+		[](Connection* const connection) {
+			auto input = connection->getInputBuffer();
+			if(input->size() > 0 && input->begin()[0] == 'p') {
+				connection->writeData(input);
+			}
+			input->clear();
+		}
+	);
+
+	struct sockaddr_in address;
+	bzero(&address, sizeof address);
+	address.sin_family = AF_INET;
+	address.sin_port = htons(PORT);
+	::inet_pton(AF_INET, "127.0.0.1", &address.sin_addr);
+
+	Result result = {true, 0, 0, 0, 0};
+	std::thread clientThread([&] {
+		// wait for the server to listen
+		int probe_fd;
+		while((probe_fd = connectTo(address)) < 0) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+		::close(probe_fd);
+
+		// blasters connected first, one after another, so fd % EVENT_LOOP_COUNT spreads them over every EventLoop
+		std::atomic<bool> stop(false);
+		std::atomic<long> blastBytes(0);
+		std::vector<std::thread> threadList;
+		for(int index = 0; index < BLASTER_COUNT; index++) {
+			int fd = connectTo(address);
+			threadList.push_back(std::thread([&, fd] {
+				std::vector<char> chunk(BLAST_CHUNK_SIZE, 'b');
+				while(!stop && fd >= 0) {
+					ssize_t writeLen = ::write(fd, chunk.data(), chunk.size());
+					if(writeLen <= 0) {
+						break;
+					}
+					blastBytes += writeLen;
+				}
+				::close(fd);
+			}));
+		}
+
+		std::vector<std::vector<double>> latencyList(PING_CLIENT_COUNT);
+		std::vector<char> passedList(PING_CLIENT_COUNT, 1);
+		for(int index = 0; index < PING_CLIENT_COUNT; index++) {
+			int fd = connectTo(address);
+			threadList.push_back(std::thread([&, fd, index] {
+				char ping[PING_SIZE], echo[PING_SIZE];
+				::memset(ping, 'p', sizeof ping);
+				while(!stop) {
+					auto start = std::chrono::steady_clock::now();
+					size_t received = 0;
+					bool ok = fd >= 0 && ::write(fd, ping, sizeof ping) == PING_SIZE;
+					while(ok && received < sizeof echo) {
+						ssize_t readLen = ::read(fd, echo + received, sizeof echo - received);
+						ok = readLen > 0;
+						received += ok ? static_cast<size_t>(readLen) : 0;
+					}
+					if(!ok || ::memcmp(ping, echo, sizeof echo) != 0) {
+						passedList[static_cast<size_t>(index)] = 0;
+						break;
+					}
+					std::chrono::duration<double, std::micro> latency = std::chrono::steady_clock::now() - start;
+					latencyList[static_cast<size_t>(index)].push_back(latency.count());
+				}
+				::close(fd);
+			}));
+		}
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(RUN_MS));
+		stop = true;
+		for(auto &thread : threadList) {
+			thread.join();
+		}
+
+		std::vector<double> allLatency;
+		for(int index = 0; index < PING_CLIENT_COUNT; index++) {
+			result.passed = result.passed && passedList[static_cast<size_t>(index)];
+			allLatency.insert(allLatency.end(), latencyList[static_cast<size_t>(index)].begin(), latencyList[static_cast<size_t>(index)].end());
+		}
+		std::sort(allLatency.begin(), allLatency.end());
+		result.rounds = static_cast<long>(allLatency.size());
+		if(!allLatency.empty()) {
+			result.p99LatencyUs = allLatency[allLatency.size() * 99 / 100];
+			result.maxLatencyUs = allLatency.back();
+		}
+		result.blastMBPerSecond = static_cast<double>(blastBytes) / (1024 * 1024) / (RUN_MS / 1000.0);
+		server->shutdown();
+	});
+
+	server->run();
+	clientThread.join();
+	return result;
+}
+
+int main(int argc, char *argv[]) {
+	Log::setLogLevel(LogLevel::FATAL);
+
+	bool passed = true;
+	::printf("%d blasters of %d byte chunks, %d ping pong clients of %d bytes, %d ms, %d EventLoops\n",
+					 BLASTER_COUNT, BLAST_CHUNK_SIZE, PING_CLIENT_COUNT, PING_SIZE, RUN_MS, EVENT_LOOP_COUNT);
+	for(bool readBudget : {false, true}) {
+		Result result = runFairness(readBudget);
+		const char* name = readBudget ? "read budget" : "unlimited";
+		if(!result.passed) {
+			::printf("  %-12s  echo lost or changed\n", name);
+			passed = false;
+		} else {
+			::printf("  %-12s  %8ld rounds, p99 %8.0f us, max %8.0f us, blasted %7.0f MB/s\n", name,
+							 result.rounds, result.p99LatencyUs, result.maxLatencyUs, result.blastMBPerSecond);
+		}
+	}
+
+	return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
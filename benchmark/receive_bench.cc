@@ -0,0 +1,182 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "wnet.h"
+
+using namespace wnet;
+
+// clients send bursts much larger than DEFAULT_BUFFER_SIZE, the server acknowledges every whole burst,
+// counts receive syscalls and heap allocations / bytes while receiving,
+// then leaves the connections idle and checks every buffer shrank back to DEFAULT_BUFFER_SIZE
+
+static std::atomic<bool> counting(false);
+static std::atomic<long> allocationCount(0);
+static std::atomic<long> allocationBytes(0);
+
+void* operator new(size_t size) {
+	if(counting.load(std::memory_order_relaxed)) {
+		allocationCount.fetch_add(1, std::memory_order_relaxed);
+		allocationBytes.fetch_add(static_cast<long>(size), std::memory_order_relaxed);
+	}
+	if(void* ptr = ::malloc(size == 0 ? 1 : size)) {
+		return ptr;
+	}
+	throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept {
+	::free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+	::free(ptr);
+}
+
+// clients only read() the 1 byte acknowledgement, anything larger is the server receiving
+static std::atomic<long> receiveCallCount(0);
+
+extern "C" ssize_t read(int fd, void* buf, size_t count) {
+	if(count > 1) {
+		receiveCallCount.fetch_add(1, std::memory_order_relaxed);
+	}
+	return ::syscall(SYS_read, fd, buf, count);
+}
+
+extern "C" ssize_t readv(int fd, const struct iovec* iov, int iovcnt) {
+	receiveCallCount.fetch_add(1, std::memory_order_relaxed);
+	return ::syscall(SYS_readv, fd, iov, iovcnt);
+}
+
+constexpr short BENCHMARK_PORT = 10097;
+constexpr int CONNECTION_COUNT = 32;
+constexpr int BURST_SIZE = 1024 * 1024;
+constexpr int BURST_ROUND = 16;
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count();
+}
+
+int main(int argc, char *argv[]) {
+	Log::setLogLevel(LogLevel::FATAL);
+	Signal::setSignalHandler(SIGPIPE, []{});
+
+	std::mutex connectionListMutex;
+	std::vector<std::weak_ptr<Connection>> connectionList;
+	std::atomic<size_t> peakCapacity(0);
+
+	auto server = std::make_shared<TCPServer>(BENCHMARK_PORT);
+	server->setEnableConnectionKeepAlive();
+	server->setOnConnectedHandler(
+		[&](Connection* const connection) {
+			std::lock_guard<std::mutex> guard(connectionListMutex);
+			connectionList.push_back(connection->thisConnection());
+		}
+	);
+	server->setOnReceiveDataHandler(
+		[&](Connection* const connection) {
+			auto inputBuf = connection->getInputBuffer();
+			if(inputBuf->getCapacity() > peakCapacity.load()) {
+				peakCapacity.store(inputBuf->getCapacity());
+			}
+			// a burst is done once it's all in, like a length-prefixed request
+			if(inputBuf->size() >= static_cast<size_t>(BURST_SIZE)) {
+				inputBuf->consume(BURST_SIZE);
+				connection->writeData("k");
+			}
+		}
+	);
+	std::thread serverThread([server] {
+		server->run();
+	});
+	std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+	std::vector<int> clientList;
+	struct sockaddr_in serverAddr;
+	::memset(&serverAddr, 0, sizeof serverAddr);
+	serverAddr.sin_family = AF_INET;
+	serverAddr.sin_addr.s_addr = ::inet_addr("127.0.0.1");
+	serverAddr.sin_port = htons(BENCHMARK_PORT);
+	for(int id = 0; id < CONNECTION_COUNT; id++) {
+		int client_fd = ::socket(AF_INET, SOCK_STREAM, 0);
+		if(::connect(client_fd, reinterpret_cast<struct sockaddr*>(&serverAddr), sizeof serverAddr) == -1) {
+			::printf("connect failed\n");
+			return EXIT_FAILURE;
+		}
+		clientList.push_back(client_fd);
+	}
+
+	std::vector<char> burst(BURST_SIZE, 'w');
+	auto start = std::chrono::steady_clock::now();
+	receiveCallCount.store(0);
+	counting.store(true);
+	std::vector<std::thread> clientThreadList;
+	for(int client_fd : clientList) {
+		clientThreadList.push_back(std::thread([&burst, client_fd] {
+			for(int round = 0; round < BURST_ROUND; round++) {
+				for(size_t written = 0; written < burst.size(); ) {
+					ssize_t writeLen = ::write(client_fd, burst.data() + written, burst.size() - written);
+					if(writeLen <= 0) {
+						::printf("write failed\n");
+						::exit(EXIT_FAILURE);
+					}
+					written += static_cast<size_t>(writeLen);
+				}
+				char ack;
+				if(::read(client_fd, &ack, 1) != 1) {
+					::printf("read failed\n");
+					::exit(EXIT_FAILURE);
+				}
+			}
+		}));
+	}
+	for(auto &thread : clientThreadList) {
+		thread.join();
+	}
+	counting.store(false);
+	double seconds = secondsSince(start);
+
+	::printf("%d connections X %d bursts of %d bytes\n", CONNECTION_COUNT, BURST_ROUND, BURST_SIZE);
+	::printf("  received            %8.1f MB/s\n", 1.0 * CONNECTION_COUNT * BURST_ROUND * BURST_SIZE / seconds / 1e6);
+	::printf("  receive syscalls    %8ld\n", receiveCallCount.load());
+	::printf("  heap allocations    %8ld, %ld bytes\n", allocationCount.load(), allocationBytes.load());
+	::printf("  peak input buffer   %8zu bytes\n", peakCapacity.load());
+
+	// every buffer shrinks within two BUFFER_SHRINK_IDLE_MS periods of going idle
+	std::this_thread::sleep_for(std::chrono::milliseconds(2 * BUFFER_SHRINK_IDLE_MS + 500));
+	size_t totalCapacity = 0;
+	bool passed = true;
+	{
+		std::lock_guard<std::mutex> guard(connectionListMutex);
+		for(auto &weakConnection : connectionList) {
+			auto connection = weakConnection.lock();
+			if(!connection) {
+				passed = false;
+				continue;
+			}
+			totalCapacity += connection->getInputBuffer()->getCapacity() + connection->getOutputBuffer()->getCapacity();
+		}
+		passed = passed && connectionList.size() == static_cast<size_t>(CONNECTION_COUNT);
+	}
+	::printf("  buffers after idle  %8zu bytes per connection\n", totalCapacity / CONNECTION_COUNT);
+	passed = passed && totalCapacity == 2 * static_cast<size_t>(DEFAULT_BUFFER_SIZE) * CONNECTION_COUNT;
+
+	for(int client_fd : clientList) {
+		::close(client_fd);
+	}
+	server->shutdown();
+	serverThread.join();
+	return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
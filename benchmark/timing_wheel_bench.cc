@@ -0,0 +1,86 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "wnet.h"
+
+using namespace wnet;
+
+// cost of setTimeout() / cancel() / reschedule() on the timing wheel,
+// and check every timeout fires on the exact tick it was scheduled for
+
+constexpr int TIMEOUT_COUNT = 1000000;
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count();
+}
+
+int main(int argc, char *argv[]) {
+	Log::setLogLevel(LogLevel::FATAL);
+
+	TimeoutManager timeoutManager;
+	std::mt19937 random(20);
+	// mostly sub request deadlines in tens of milliseconds, some idle timeouts of minutes
+	std::uniform_int_distribution<int> shortTimeout(1, 2000);
+	std::uniform_int_distribution<int> longTimeout(2000, 30 * 60 * 1000);
+
+	std::vector<uint64_t> expectedTick(TIMEOUT_COUNT), firedTick(TIMEOUT_COUNT, 0);
+	std::vector<std::shared_ptr<TimeoutEntry>> entryList(TIMEOUT_COUNT);
+	uint64_t currentTick = 0;
+	uint64_t maxTick = 0;
+
+	auto start = std::chrono::steady_clock::now();
+	for(int index = 0; index < TIMEOUT_COUNT; index++) {
+		int timeoutMs = index % 10 == 0 ? longTimeout(random) : shortTimeout(random);
+		expectedTick[index] = (timeoutMs + TIMER_RESOLUTION_MS - 1) / TIMER_RESOLUTION_MS;
+		maxTick = std::max(maxTick, expectedTick[index]);
+		entryList[index] = timeoutManager.setTimeout(std::chrono::milliseconds(timeoutMs), nullptr, [&, index] {
+			firedTick[index] = currentTick;
+		});
+	}
+	double insertSeconds = secondsSince(start);
+
+	// cancel every 4th, push every 7th 5 seconds further
+	start = std::chrono::steady_clock::now();
+	for(int index = 0; index < TIMEOUT_COUNT; index++) {
+		if(index % 4 == 0) {
+			timeoutManager.cancel(entryList[index]);
+			expectedTick[index] = 0;
+		} else if(index % 7 == 0) {
+			timeoutManager.reschedule(entryList[index], std::chrono::milliseconds(5000));
+			expectedTick[index] = 5000 / TIMER_RESOLUTION_MS;
+		}
+	}
+	double updateSeconds = secondsSince(start);
+	entryList.clear();    // the wheel keeps scheduled entries alive by itself
+
+	start = std::chrono::steady_clock::now();
+	while(currentTick < maxTick) {
+		currentTick += 1;
+		timeoutManager.tickTock(1);
+	}
+	double tickSeconds = secondsSince(start);
+
+	int wrongCount = 0;
+	for(int index = 0; index < TIMEOUT_COUNT; index++) {
+		if(firedTick[index] != expectedTick[index]) {
+			if(wrongCount < 5) {
+				printf("timeout %d fired on tick %llu, expected %llu\n", index,
+							 static_cast<unsigned long long>(firedTick[index]), static_cast<unsigned long long>(expectedTick[index]));
+			}
+			wrongCount++;
+		}
+	}
+
+	printf("%d timeouts, %d ms per tick, %llu ticks\n", TIMEOUT_COUNT, TIMER_RESOLUTION_MS, static_cast<unsigned long long>(maxTick));
+	printf("  setTimeout()          %7.1f ns/op\n", insertSeconds * 1e9 / TIMEOUT_COUNT);
+	printf("  cancel()/reschedule() %7.1f ns/op\n", updateSeconds * 1e9 / TIMEOUT_COUNT);
+	printf("  tickTock() total      %7.3f s\n", tickSeconds);
+	printf("  left scheduled        %zu\n", timeoutManager.size());
+	printf("  fired on wrong tick   %d\n", wrongCount);
+
+	return wrongCount == 0 && timeoutManager.size() == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
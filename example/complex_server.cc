@@ -16,8 +16,14 @@ int main(int argc, char *argv[]) {
 
 	// Log::setLogLevel(INFO);
 	// only log higher than or equal to level INFO will print
+
+	// Log::setAsync();
+	// write logs in a background thread, records dropped when it falls behind ( LogFullPolicy::BLOCK to wait instead )
 	// Log::setLogWithLocation();
 
+	ProtoBuf::registerMessageType<request::simpledata>();
+	// look up message types once at startup, instead of on the first message of every EventLoop
+
 	auto server = std::make_shared<TCPServer>(10004);
 
 	// singal handler for SIGINT (ctrl-c)
@@ -27,6 +33,13 @@ int main(int argc, char *argv[]) {
 
 	// ignore SIGPIPE 
 	Signal::setSignalHandler(SIGPIPE, []{});
+
+	// Connector::setMultiplexing();
+	// sub requests to one server share a couple of connections, tagged with request ids, 
+	// needs servers echoing them, e.g. simple_server_1 / simple_server_3
+
+	server->setEnableRequestArena();
+	// messages of a request and responses of its sub requests allocated on one protobuf Arena, freed all at once
 	
 	server->setOnReceiveDataHandler(
 		[](Connection* const masterConnection) {
@@ -34,7 +47,7 @@ int main(int argc, char *argv[]) {
 
 			auto masterConnectionPtr = masterConnection->thisConnection();
 
-			auto requestData = std::make_shared<request::simpledata>();
+			auto requestData = masterConnection->createMessage<request::simpledata>();
 			requestData->set_id(42);
 			requestData->set_msg("origin msg");
 			
@@ -14,6 +14,9 @@ int main(int argc, char *argv[]) {
 	// Log::setLogLevel(INFO);
 	// only log higher than or equal to level INFO will print
 
+	// Log::setAsync();
+	// write logs in a background thread, records dropped when it falls behind ( LogFullPolicy::BLOCK to wait instead )
+
 	auto server = std::make_shared<TCPServer>(10007);
 
 	// singal handler for SIGINT (ctrl-c)
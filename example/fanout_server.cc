@@ -0,0 +1,99 @@
+#include "message/request.simpledata.pb.h"
+#include "wnet.h"
+
+using namespace wnet;
+
+int main(int argc, char *argv[]) {
+
+	// require simple_server_1, simple_server_2, simple_server_3 to run
+
+	// SET_DAEMON_MODE();
+	// current directory will be changed to /
+
+	// Log::setLogLevel(INFO);
+	// only log higher than or equal to level INFO will print
+
+	ProtoBuf::registerMessageType<request::simpledata>();
+	// look up message types once at startup, instead of on the first message of every EventLoop
+
+	auto server = std::make_shared<TCPServer>(10006);
+
+	// singal handler for SIGINT (ctrl-c)
+	Signal::setSignalHandler(SIGINT, [server]{
+		server->shutdown();
+	});
+
+	// ignore SIGPIPE
+	Signal::setSignalHandler(SIGPIPE, []{});
+
+	// 127.0.0.1:10002 responses nothing, the other two answer right away
+	std::vector<std::shared_ptr<BackendEndpoint>> endpointList;
+	for(short port : {10001, 10002, 10003}) {
+		endpointList.push_back(Connector::getEndpoint("127.0.0.1", port));
+	}
+
+	// every request fans out to all three backends, the first byte received picks when to answer:
+	// '0' all of them ( after 127.0.0.1:10002 times out in 1 s ), '1' the first success,
+	// '2' any two successes, '3' whatever has come back after 200 ms
+	server->setOnReceiveDataHandler(
+		[endpointList](Connection* const masterConnection) {
+			char policyId = *masterConnection->getInputBuffer()->begin();
+			masterConnection->getInputBuffer()->clear();
+
+			AwaitPolicy policy = AwaitPolicy::makeAll();
+			switch(policyId) {
+				case '1':
+					policy = AwaitPolicy::makeFirstSuccess();
+					break;
+				case '2':
+					policy = AwaitPolicy::makeQuorum(2);
+					break;
+				case '3':
+					policy = AwaitPolicy::makeDeadline(std::chrono::milliseconds(200));
+					break;
+				default:
+					break;
+			}
+
+			auto requestData = std::make_shared<request::simpledata>();
+			requestData->set_id(0);
+			requestData->set_msg("fan out");
+
+			std::vector<std::shared_ptr<RequestResult>> requestResultList;
+			for(auto &endpoint : endpointList) {
+				requestResultList.push_back(Connector::initSubRequest(endpoint,
+																															requestData,
+																															masterConnection->thisConnection(),
+																															std::chrono::milliseconds(1000)));
+			}
+
+			masterConnection->await(
+				requestResultList,
+				policy,
+				// called once the policy is met, sub requests still pending then are cancelled,
+				// their connections go back to the pool once the responses on the way are drained
+				[=](Connection* const masterConnection) {
+					for(size_t index = 0; index < requestResultList.size(); index++) {
+						auto &requestResult = requestResultList[index];
+						masterConnection->writeData("127.0.0.1:" + std::to_string(endpointList[index]->getPort()) + " ");
+						if(requestResult->resolved()) {
+							masterConnection->writeData(std::static_pointer_cast<request::simpledata>(requestResult->getData())->msg());
+						} else if(requestResult->cancelled()) {
+							masterConnection->writeData("cancelled");
+						} else {
+							masterConnection->writeData("rejected");
+						}
+						masterConnection->writeData("\n");
+					}
+
+					// Connection::requestResolved() must be called to get connection ready to handle new request
+					masterConnection->requestResolved();
+				}
+			);
+		}
+	);
+
+	server->run();
+
+	return 0;
+}
@@ -0,0 +1,81 @@
+#include "message/request.simpledata.pb.h"
+#include "wnet.h"
+
+using namespace wnet;
+
+int main(int argc, char *argv[]) {
+
+	// require simple_server_1, simple_server_2, simple_server_3 to run
+
+	// SET_DAEMON_MODE();
+	// current directory will be changed to /
+
+	// Log::setLogLevel(INFO);
+	// only log higher than or equal to level INFO will print
+
+	ProtoBuf::registerMessageType<request::simpledata>();
+	// look up message types once at startup, instead of on the first message of every EventLoop
+
+	auto server = std::make_shared<TCPServer>(10005);
+
+	// singal handler for SIGINT (ctrl-c)
+	Signal::setSignalHandler(SIGINT, [server]{
+		server->shutdown();
+	});
+
+	// ignore SIGPIPE
+	Signal::setSignalHandler(SIGPIPE, []{});
+
+	// backends resolved once, sub requests to them look up no ip / port string
+	std::vector<std::shared_ptr<BackendEndpoint>> endpointList;
+	for(short port : {10001, 10002, 10003}) {
+		endpointList.push_back(Connector::getEndpoint("127.0.0.1", port));
+	}
+
+	// every request a client pipelines is handled at once, up to 32 per connection,
+	// each awaits its own sub request, responses still go back in request order
+	server->setPipelinedRequestHandler(
+		[endpointList](RequestContext* const context, std::shared_ptr<Message> rawMessage) {
+			if(!rawMessage) {
+				auto message = std::make_shared<request::simpledata>();
+				message->set_id(0);
+				message->set_msg("bad data for pipelined server");
+				context->writeData(message);
+				context->finish();
+				return;
+			}
+
+			auto requestData = std::static_pointer_cast<request::simpledata>(rawMessage);
+			// 127.0.0.1:10002 responses nothing, requests sent there are rejected after 1 s,
+			// while the requests behind them are answered by 127.0.0.1:10001 / 127.0.0.1:10003 right away
+			auto &endpoint = endpointList[requestData->id() % 3];
+			short port = endpoint->getPort();
+			auto requestResult = Connector::initSubRequest(endpoint,
+																										requestData,
+																										context->getConnection()->thisConnection(),
+																										std::chrono::milliseconds(1000));
+
+			context->await(
+				{requestResult},
+				[=](RequestContext* const context) {
+					auto message = std::make_shared<request::simpledata>();
+					message->set_id(requestData->id());
+					if(requestResult->resolved()) {
+						message->set_msg(std::static_pointer_cast<request::simpledata>(requestResult->getData())->msg());
+					} else {
+						message->set_msg("request to 127.0.0.1:" + std::to_string(port) + " rejected");
+					}
+					context->writeData(message);
+
+					// RequestContext::finish() must be called to let the responses behind it go
+					context->finish();
+				}
+			);
+		},
+		32
+	);
+
+	server->run();
+
+	return 0;
+}
@@ -15,6 +15,12 @@ int main(int argc, char *argv[]) {
 	// Log::setLogLevel(INFO);
 	// only log higher than or equal to level INFO will print
 
+	// Log::setAsync();
+	// write logs in a background thread, records dropped when it falls behind ( LogFullPolicy::BLOCK to wait instead )
+
+	ProtoBuf::registerMessageType<request::simpledata>();
+	// look up message types once at startup, instead of on the first message of every EventLoop
+
 	auto server = std::make_shared<TCPServer>(10003);
 
 	// singal handler for SIGINT (ctrl-c)
@@ -27,21 +33,37 @@ int main(int argc, char *argv[]) {
 
 	server->setOnReceiveDataHandler(
 		[](Connection* const connection) {
-			ParseResult parseResult;
-			auto rawMessage = connection->decodeMessage(parseResult);
+			// every request the client has pipelined so far, answered in one go,
+			// request ids of a multiplexing client ( Connector::setMultiplexing() ) echoed back
+			std::vector<std::shared_ptr<Message>> messageList;
+			std::vector<uint32_t> requestIdList;
+			ParseResult parseResult = connection->decodeMessages(messageList, &requestIdList);
 
-			if(parseResult == ParseResult::PARSE_SUCCESS) {
-				auto message = std::static_pointer_cast<request::simpledata>(rawMessage);
-				message->set_id(message->id() + 3);
-				message->set_msg("data processed by simple server 3");
-				connection->writeData(message);
-			} else {
-				if(parseResult == ParseResult::UNKNOWN_MESSAGE_TYPE || parseResult == ParseResult::PARSE_ERROR) {
+			for(auto &rawMessage : messageList) {
+				if(!rawMessage) {
+					// unknown type or bad body, skipped, answered in its place
 					auto message = std::make_shared<request::simpledata>();
 					message->set_id(0);
 					message->set_msg("bad data for simple server 3");
-					connection->writeData(message);
+					rawMessage = message;
+					continue;
 				}
+				auto message = std::static_pointer_cast<request::simpledata>(rawMessage);
+				message->set_id(message->id() + 3);
+				message->set_msg("data processed by simple server 3");
+			}
+			if(parseResult == ParseResult::PARSE_ERROR) {
+				// frame boundary lost, nothing after it can be decoded
+				auto message = std::make_shared<request::simpledata>();
+				message->set_id(0);
+				message->set_msg("bad data for simple server 3");
+				messageList.push_back(message);
+				requestIdList.push_back(0);
+			}
+			connection->writeMessages(messageList, &requestIdList);
+			if(parseResult == ParseResult::PARSE_ERROR) {
+				// answers above sent first
+				connection->shutdown();
 			}
 		}
 	);
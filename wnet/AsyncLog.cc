@@ -0,0 +1,195 @@
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "AsyncLog.h"
+
+using namespace wnet;
+
+std::atomic<bool> AsyncLog::running(false);
+LogFullPolicy AsyncLog::fullPolicy = LogFullPolicy::DROP;
+std::string AsyncLog::logDirectory = "";
+std::atomic<uint64_t> AsyncLog::droppedCount(0);
+
+std::mutex AsyncLog::ringListMutex;
+std::vector<std::shared_ptr<AsyncLog::Ring>> AsyncLog::ringList;
+thread_local AsyncLog::RingHolder AsyncLog::ringHolder;
+
+std::thread AsyncLog::writerThread;
+std::mutex AsyncLog::wakeupMutex;
+std::condition_variable AsyncLog::wakeupCondVar;
+
+namespace {
+
+// write the whole buffer, the writer thread owns the fd so partial writes only come from signals / full disks
+void writeAll(int fd, const char* data, size_t length) {
+  while(length > 0) {
+    ssize_t writeLen = ::write(fd, data, length);
+    if(writeLen == -1) {
+      if(errno == EINTR) {
+        continue;
+      }
+      ::fprintf(stderr, "[AsyncLog][write()] write log failed, error: [%d]%s\n", errno, ::strerror(errno));
+      return;
+    }
+    data += writeLen;
+    length -= static_cast<size_t>(writeLen);
+  }
+}
+
+}
+
+AsyncLog::Ring* AsyncLog::getRing() {
+  if(!ringHolder.ring) {
+    ringHolder.ring = std::make_shared<Ring>();
+    std::lock_guard<std::mutex> guard(ringListMutex);
+    ringList.push_back(ringHolder.ring);
+  }
+  return ringHolder.ring.get();
+}
+
+AsyncLog::Record* AsyncLog::claim() {
+  Ring* ring = getRing();
+  Record* record = ring->claim();
+  while(!record) {
+    if(fullPolicy == LogFullPolicy::DROP || !isRunning()) {
+      droppedCount.fetch_add(1, std::memory_order_relaxed);
+      return nullptr;
+    }
+    wakeup();
+    std::this_thread::yield();
+    record = ring->claim();
+  }
+  return record;
+}
+
+void AsyncLog::commit() {
+  // the writer wakes up by itself every ASYNC_LOG_FLUSH_INTERVAL_MS, only hurry it when filling up
+  if(ringHolder.ring->publish() >= static_cast<size_t>(ASYNC_LOG_RING_SIZE / 2)) {
+    wakeup();
+  }
+}
+
+void AsyncLog::writerLoop() {
+  std::vector<std::shared_ptr<Ring>> snapshot;
+  std::vector<char> writeBuf;
+  writeBuf.reserve(ASYNC_LOG_WRITE_BUF_SIZE);
+
+  int log_fd = logDirectory.empty() ? STDOUT_FILENO : -1;
+  char fileNameBuf[LOG_FILE_NAME_BUF_SIZE] = "";
+  uint64_t reportedDroppedCount = 0;
+
+  auto flush = [&] {
+    if(writeBuf.empty()) {
+      return;
+    }
+    if(!logDirectory.empty()) {
+      // rotate hourly, file name checked once a batch instead of once a record
+      char timeBuf[LOG_TIME_BUF_SIZE];
+      char newFileNameBuf[LOG_FILE_NAME_BUF_SIZE];
+      time_t now = ::time(NULL);
+      struct tm tm;
+      ::localtime_r(&now, &tm);
+      ::strftime(timeBuf, LOG_TIME_BUF_SIZE, "%m_%d_%H", &tm);
+      ::snprintf(newFileNameBuf, LOG_FILE_NAME_BUF_SIZE, "%s%s%s%s", logDirectory.c_str(), "/", timeBuf, ".log");
+      if(log_fd == -1 || ::strcmp(newFileNameBuf, fileNameBuf) != 0) {
+        if(log_fd != -1) {
+          ::close(log_fd);
+        }
+        ::strcpy(fileNameBuf, newFileNameBuf);
+        log_fd = ::open(fileNameBuf, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if(log_fd == -1) {
+          ::fprintf(stderr, "[AsyncLog][logFile %s] open log file failed, error: [%d]%s\n", fileNameBuf, errno, ::strerror(errno));
+        }
+      }
+    }
+    if(log_fd != -1) {
+      writeAll(log_fd, writeBuf.data(), writeBuf.size());
+    }
+    writeBuf.clear();
+  };
+
+  while(true) {
+    bool stopping = !isRunning();
+
+    {
+      std::lock_guard<std::mutex> guard(ringListMutex);
+      snapshot = ringList;
+    }
+
+    bool drained = false;
+    for(auto &ring : snapshot) {
+      while(Record* record = ring->front()) {
+        if(writeBuf.size() + record->length > ASYNC_LOG_WRITE_BUF_SIZE) {
+          flush();
+        }
+        writeBuf.insert(writeBuf.end(), record->data, record->data + record->length);
+        ring->pop();
+        drained = true;
+      }
+    }
+
+    uint64_t dropped = getDroppedCount();
+    if(dropped != reportedDroppedCount) {
+      char reportBuf[LOG_BUF_SIZE];
+      int reportLen = ::snprintf(reportBuf, LOG_BUF_SIZE, "[ERROR] [AsyncLog] %llu log records dropped, ring full\n",
+                                 static_cast<unsigned long long>(dropped - reportedDroppedCount));
+      writeBuf.insert(writeBuf.end(), reportBuf, reportBuf + reportLen);
+      reportedDroppedCount = dropped;
+    }
+    flush();
+
+    {
+      // rings of exited threads, nothing more would be published
+      std::lock_guard<std::mutex> guard(ringListMutex);
+      for(auto iterator = ringList.begin(); iterator != ringList.end(); ) {
+        if((*iterator)->closed.load(std::memory_order_acquire) && !(*iterator)->front()) {
+          iterator = ringList.erase(iterator);
+        } else {
+          ++iterator;
+        }
+      }
+    }
+    snapshot.clear();
+
+    if(stopping) {
+      break;
+    }
+    if(!drained) {
+      std::unique_lock<std::mutex> lock(wakeupMutex);
+      wakeupCondVar.wait_for(lock, std::chrono::milliseconds(ASYNC_LOG_FLUSH_INTERVAL_MS));
+    }
+  }
+
+  if(log_fd != -1 && log_fd != STDOUT_FILENO) {
+    ::close(log_fd);
+  }
+}
+
+void AsyncLog::start(std::string _logDirectory, LogFullPolicy policy) {
+  static std::once_flag atexitFlag;
+  if(isRunning()) {
+    return;
+  }
+  logDirectory = _logDirectory;
+  fullPolicy = policy;
+  running.store(true, std::memory_order_release);
+  writerThread = std::thread(writerLoop);
+  // flush what's left when exit() is called, FATAL logs are always followed by one
+  std::call_once(atexitFlag, [] {
+    std::atexit(stop);
+  });
+}
+
+void AsyncLog::stop() {
+  if(!running.exchange(false)) {
+    return;
+  }
+  wakeup();
+  writerThread.join();
+}
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Config.h"
+#include "Noncopyable.h"
+
+namespace wnet {
+
+// what a logging thread does when its ring is full
+enum class LogFullPolicy {
+  DROP = 1,   // discard the record and count it, never stall an EventLoop
+  BLOCK       // wait for the writer thread to make room
+};
+
+// backend of Log once Log::setAsync() is called
+// every logging thread formats into its own lock-free single-producer / single-consumer ring,
+// one writer thread drains all rings, keeps the log file open and writes in batches,
+// rotating hourly with the same %m_%d_%H.log naming as the synchronous Log
+class AsyncLog : public noncopyable {
+  public:
+    struct Record {
+      uint32_t length;
+      char data[LOG_BUF_SIZE];
+    };
+
+  private:
+    class Ring : public noncopyable {
+      private:
+        Record* records;
+        alignas(64) std::atomic<size_t> head;    // next to read, only written by the writer thread
+        alignas(64) std::atomic<size_t> tail;    // next to write, only written by the owner thread
+
+      public:
+        std::atomic<bool> closed;   // owner thread exited, drop once drained
+
+        Ring(): head(0), tail(0), closed(false) {
+          records = new Record[ASYNC_LOG_RING_SIZE];
+        }
+
+        ~Ring() {
+          delete[] records;
+        }
+
+        // owner thread only, nullptr when full
+        Record* claim() {
+          size_t position = tail.load(std::memory_order_relaxed);
+          if(position - head.load(std::memory_order_acquire) >= static_cast<size_t>(ASYNC_LOG_RING_SIZE)) {
+            return nullptr;
+          }
+          return &records[position % ASYNC_LOG_RING_SIZE];
+        }
+
+        // owner thread only, publish the record returned by claim(), return records pending
+        size_t publish() {
+          size_t position = tail.load(std::memory_order_relaxed) + 1;
+          tail.store(position, std::memory_order_release);
+          return position - head.load(std::memory_order_relaxed);
+        }
+
+        // writer thread only, nullptr when empty
+        Record* front() {
+          size_t position = head.load(std::memory_order_relaxed);
+          if(position == tail.load(std::memory_order_acquire)) {
+            return nullptr;
+          }
+          return &records[position % ASYNC_LOG_RING_SIZE];
+        }
+
+        // writer thread only
+        void pop() {
+          head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+    };
+
+    // marks the ring of a thread closed when the thread exits
+    struct RingHolder {
+      std::shared_ptr<Ring> ring;
+
+      ~RingHolder() {
+        if(ring) {
+          ring->closed.store(true, std::memory_order_release);
+        }
+      }
+    };
+
+    static std::atomic<bool> running;
+    static LogFullPolicy fullPolicy;
+    static std::string logDirectory;      // empty for stdout
+    static std::atomic<uint64_t> droppedCount;
+
+    static std::mutex ringListMutex;
+    static std::vector<std::shared_ptr<Ring>> ringList;
+    static thread_local RingHolder ringHolder;
+
+    static std::thread writerThread;
+    static std::mutex wakeupMutex;
+    static std::condition_variable wakeupCondVar;
+
+    static Ring* getRing();
+
+    static void wakeup() {
+      wakeupCondVar.notify_one();
+    }
+
+    static void writerLoop();
+
+  public:
+    // start the writer thread, log to logDirectory (stdout if empty)
+    // call after Daemon::setDaemonMode(), the writer thread doesn't survive fork()
+    static void start(std::string _logDirectory, LogFullPolicy policy);
+
+    // drain every ring and join the writer thread, registered with atexit() by start()
+    static void stop();
+
+    static bool isRunning() {
+      return running.load(std::memory_order_acquire);
+    }
+
+    // slot for the calling thread to format a record into, nullptr if dropped
+    // must be followed by commit() when not nullptr
+    static Record* claim();
+
+    static void commit();
+
+    static uint64_t getDroppedCount() {
+      return droppedCount.load(std::memory_order_relaxed);
+    }
+};
+
+}
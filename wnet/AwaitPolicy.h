@@ -0,0 +1,60 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+
+namespace wnet {
+
+enum class AwaitPolicyType {
+  ALL = 1,      // every sub request settled
+  QUORUM,       // quorum of them resolved, or too many rejected for that to happen
+  DEADLINE      // every sub request settled, or the deadline passed without the stragglers
+};
+
+// when a list of sub requests passed to await() counts as complete,
+// the ones still pending then are cancelled ( RequestResult::cancel() )
+class AwaitPolicy {
+  private:
+    AwaitPolicyType type;
+    size_t quorum;
+    std::chrono::milliseconds deadline;
+
+    AwaitPolicy(AwaitPolicyType _type,
+                size_t _quorum = 0,
+                std::chrono::milliseconds _deadline = std::chrono::milliseconds(0)): type(_type),
+                                                                                     quorum(_quorum),
+                                                                                     deadline(_deadline) {}
+
+  public:
+    static AwaitPolicy makeAll() {
+      return AwaitPolicy(AwaitPolicyType::ALL);
+    }
+
+    static AwaitPolicy makeFirstSuccess() {
+      return AwaitPolicy(AwaitPolicyType::QUORUM, 1);
+    }
+
+    // any quorum of them, all if more than there are
+    static AwaitPolicy makeQuorum(size_t quorum) {
+      return AwaitPolicy(AwaitPolicyType::QUORUM, quorum > 0 ? quorum : 1);
+    }
+
+    // deadline rounded up to TIMER_RESOLUTION_MS, counted from await()
+    static AwaitPolicy makeDeadline(std::chrono::milliseconds deadline) {
+      return AwaitPolicy(AwaitPolicyType::DEADLINE, 0, deadline);
+    }
+
+    AwaitPolicyType getType() const {
+      return type;
+    }
+
+    size_t getQuorum() const {
+      return quorum;
+    }
+
+    std::chrono::milliseconds getDeadline() const {
+      return deadline;
+    }
+};
+
+}
@@ -76,6 +76,10 @@ class Buffer : public noncopyable, public std::enable_shared_from_this<Buffer> {
       return end_pos == begin_pos; 
     }
 
+    size_t getCapacity() const {
+      return capacity;
+    }
+
     size_t space() const {    // char length after remaining data, space before data excluded
       return capacity - end_pos + 1; 
     }
@@ -95,6 +99,21 @@ class Buffer : public noncopyable, public std::enable_shared_from_this<Buffer> {
       }
     }
     
+    // give back memory grown for a burst, data kept, nothing done if data doesn't fit in targetCapacity
+    void shrink(size_t targetCapacity = DEFAULT_BUFFER_SIZE) {
+      if(capacity <= targetCapacity || size() > targetCapacity) {
+        return;
+      }
+      char* newBuffer = new char[targetCapacity + 1];
+      std::copy(begin(), end(), newBuffer);
+      delete[] buffer;
+      buffer = newBuffer;
+      capacity = targetCapacity;
+
+      end_pos -= begin_pos;
+      begin_pos = 0;
+    }
+
     // update offset after fetching data from buffer
     void consume(size_t len) { 
       begin_pos += len; 
@@ -126,7 +145,7 @@ class Buffer : public noncopyable, public std::enable_shared_from_this<Buffer> {
     }
 
     void append(const std::string& str) { 
-      append(str.c_str()); 
+      append(str.data(), str.size());   // may hold '\0', e.g. encoded messages
     }
 
     void append(std::shared_ptr<Buffer> buf) {
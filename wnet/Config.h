@@ -5,28 +5,79 @@ namespace wnet {
 // used in Buffer
 constexpr int DEFAULT_BUFFER_SIZE = 1024;
 
+// used in Connection
+constexpr int RECEIVE_SCRATCH_BUFFER_SIZE = 64 * 1024;   // per thread, second iovec of readv() behind input buffer space
+constexpr int BUFFER_SHRINK_IDLE_MS = 5000;   // buffers grown beyond DEFAULT_BUFFER_SIZE shrink back after idle this long
+constexpr int PIPELINE_MAX_IN_FLIGHT = 16;    // requests of a pipelined connection handled at once, by default
+constexpr int READ_BUDGET_BYTES = 256 * 1024;   // read from a connection per turn of its EventLoop, by default, the rest on its next turn
+constexpr int READ_BUDGET_CALLS = 16;           // readv() calls per turn at most, by default
+constexpr int OUTPUT_HIGH_WATERMARK = 4 * 1024 * 1024;    // pending output bytes pausing reading of a connection, by default
+constexpr int OUTPUT_LOW_WATERMARK = 1024 * 1024;         // pending output bytes reading resumes below, by default
+constexpr int OUTPUT_MEMORY_BUDGET = 512 * 1024 * 1024;   // pending output bytes of every connection together, beyond it connections above the low watermark pause
+
+// used in OutputChain
+constexpr int OUTPUT_CHAIN_COPY_THRESHOLD = 256;    // shared payloads shorter than this are copied instead of referenced
+
 // used in Connector
 constexpr int SUB_REQUEST_TIMEOUT_SECONDS = 6;  
+constexpr int MULTIPLEX_CONNECTION_COUNT = 2;    // connections per backend once multiplexing is on
+
+// used in EventQueue
+constexpr int EVENT_QUEUE_CAPACITY = 16384;   // slots of the lock-free ring per EventLoop, rounded up to power of 2
+constexpr int EVENT_QUEUE_YIELD_BEFORE_PARK = 16;
+
+// used in ConnectionTable
+constexpr int CONNECTION_TABLE_CHUNK_SIZE = 1024;    // slots allocated at once
+constexpr int CONNECTION_TABLE_CHUNK_COUNT = 1024;   // max fd held = CONNECTION_TABLE_CHUNK_SIZE X CONNECTION_TABLE_CHUNK_COUNT - 1
 
 // used in EventPoll
 constexpr int EVENT_LOOP_COUNT = 2;  
 constexpr int MAX_READY_EVENT_PER_POLL = 20;
 constexpr int EPOLL_WAIT_TIMEOUT = 500;   // milliseconds
 
+// used in IOUring
+constexpr int IO_URING_ENTRIES = 1024;          // submission queue slots per EventLoop, completion queue twice as many
+constexpr int IO_URING_BUFFER_COUNT = 64;       // provided receive buffers per EventLoop, power of 2
+constexpr int IO_URING_BUFFER_SIZE = 16 * 1024;
+constexpr int IO_URING_SEND_IOV_COUNT = 64;     // iovecs of one sendmsg(), the rest goes in the next one
+
+// used in Metrics
+constexpr int METRICS_HISTOGRAM_SUB_BUCKET_BITS = 4;    // 16 buckets every power of 2, recorded values off by 1 / 16 at most
+constexpr int METRICS_HISTOGRAM_MAX_BITS = 36;          // nanoseconds up to ~68 s, longer ones land in the last bucket
+constexpr int METRICS_HISTOGRAM_BUCKET_COUNT = (METRICS_HISTOGRAM_MAX_BITS - METRICS_HISTOGRAM_SUB_BUCKET_BITS + 1) << METRICS_HISTOGRAM_SUB_BUCKET_BITS;
+
 // used in Log
-constexpr int LOG_BUF_SIZE = 512;
+#ifndef WNET_LOG_MIN_LEVEL
+#define WNET_LOG_MIN_LEVEL 1    // 1 DEBUG, 2 INFO, 3 ERROR, 4 FATAL, or -DWNET_LOG_MIN_LEVEL=n when building
+#endif
+constexpr int LOG_MIN_LEVEL = WNET_LOG_MIN_LEVEL;   // LOG() below this level compiles to nothing
+constexpr int LOG_BUF_SIZE = 512;   // longer records are truncated
 constexpr int LOG_TIME_BUF_SIZE = 64;
 constexpr int LOG_FILE_NAME_BUF_SIZE = 256;
-constexpr int LOG_FILE_LOCATION_BUF_SIZE = 256;
+
+// used in AsyncLog
+constexpr int ASYNC_LOG_RING_SIZE = 1024;   // records buffered per logging thread
+constexpr int ASYNC_LOG_FLUSH_INTERVAL_MS = 100;
+constexpr int ASYNC_LOG_WRITE_BUF_SIZE = 64 * 1024;
+
+// used in ProtoBuf
+constexpr int PROTOTYPE_CACHE_INITIAL_SIZE = 64;    // slots of the per thread type name -> prototype cache, power of 2
+constexpr int FRAME_TYPE_TABLE_SIZE = 256;    // message types of compact framing per connection, legacy framing beyond
+
+// used in MessageArena
+constexpr int MESSAGE_ARENA_INITIAL_BLOCK_SIZE = 4096;    // per connection with request arena, reused by every request
 
 // used in TCPServer
-constexpr int SERVER_LISTEN_QUEUE_LENGTH = 20;
+constexpr int SERVER_LISTEN_QUEUE_LENGTH = 1024;   // listen() backlog by default, TCPServer::setBacklog()
+constexpr int ACCEPT_BUDGET_PER_WAKEUP = 64;      // connections accepted per readable listen fd at most, the rest on the next poll
 
 // used in Timer
-constexpr int TIME_ACCURACY = 3;    // seconds
+constexpr int TIMER_RESOLUTION_MS = 10;   // length of one timing wheel tick
 
 // used in TimeoutManager
-constexpr int CONNECTION_MAX_SURVIVE_TICK_TOCK = 10;   
-//  max surviving time length for an idle connection = CONNECTION_MAX_SURVIVE_TICK_TOCK X TIME_ACCURACY
+constexpr int TIMING_WHEEL_SLOT_BITS = 8;     // 256 slots every level
+constexpr int TIMING_WHEEL_LEVEL_COUNT = 4;
+//  max timeout = 2 ^ (TIMING_WHEEL_SLOT_BITS X TIMING_WHEEL_LEVEL_COUNT) ticks, longer ones are clamped
+constexpr int CONNECTION_IDLE_TIMEOUT_MS = 30000;   // idle connections are terminated after this long
 
 }
\ No newline at end of file
@@ -1,21 +1,58 @@
 #include "Connection.h"
 #include "Connector.h"
 #include "EventPoll.h"
+#include "IOUring.h"
+#include "Metrics.h"
 #include "TimeoutManager.h"
 
 using namespace wnet;
 
+std::atomic<size_t> Connection::totalPendingOutputSize(0);
+size_t Connection::outputMemoryBudget = OUTPUT_MEMORY_BUDGET;
+
 void Connection::receiveData() {
+  // what doesn't fit in inputBuf lands here, so a burst is taken by few readv() calls
+  // and inputBuf grows once to the size needed instead of doubling ahead of every read()
+  static thread_local char scratchBuf[RECEIVE_SCRATCH_BUFFER_SIZE];
+
+  if(ioUring) {
+    // received by completions instead ( handleReceiveCompletion() )
+    readable = false;
+    armReceive();
+    return;
+  }
+
+  size_t readBytes = 0;
+  int readCalls = 0;
   while((isConnected() || isDisconnecting()) && readable) {
-    if(inputBuf->space() == 0) {
-      inputBuf->allocate();
+    if(readBytes >= readBudgetBytes || readCalls == readBudgetCalls) {
+      // still readable, handed to the handlers and their output checked against the watermarks first,
+      // the rest on the next turn ( EventLoop ready list )
+      return;
     }
-    ssize_t readLen = ::read(fd, inputBuf->end(), inputBuf->space());
+    // no more than what's left of the budget, however large inputBuf has grown
+    size_t budgetLeft = readBudgetBytes - readBytes;
+    size_t space = std::min(inputBuf->space(), budgetLeft);
+    struct iovec iov[2];
+    iov[0].iov_base = inputBuf->end();
+    iov[0].iov_len = space;
+    iov[1].iov_base = scratchBuf;
+    iov[1].iov_len = std::min(sizeof scratchBuf, budgetLeft - space);
+    ssize_t readLen = ::readv(fd, iov, 2);
+    readCalls++;
 
     if(readLen > 0) {     // read normally
+      readBytes += static_cast<size_t>(readLen);
+      Metrics::add(MetricsCounter::BYTES_IN, static_cast<uint64_t>(readLen));
       if(isConnected()) {
         // when ConnectionStatus::DISCONNECTING, input data is ignored
-        inputBuf->addSize(readLen);
+        size_t readSize = static_cast<size_t>(readLen);
+        if(readSize <= space) {
+          inputBuf->addSize(readSize);
+        } else {
+          inputBuf->addSize(space);
+          inputBuf->append(scratchBuf, readSize - space);
+        }
         LOG(LogLevel::DEBUG, "[Connection][fd %d] read %d bytes", fd, static_cast<int>(readLen));
       }
       continue;
@@ -33,7 +70,7 @@ void Connection::receiveData() {
         readable = false;
         return;
       }
-      LOG(LogLevel::DEBUG, "[Connection][fd %d][read() -1] error: [%d]%s", fd, errno, ::strerror(errno));
+      LOG(LogLevel::DEBUG, "[Connection][fd %d][readv() -1] error: [%d]%s", fd, errno, ::strerror(errno));
     }
     terminate();
     return;
@@ -41,16 +78,30 @@ void Connection::receiveData() {
 }
 
 void Connection::sendData() {
-  while((isConnected() || isDisconnecting()) && writable && !outputBuf->empty()) {
-
-    if(outputBuf->size() == 0) {
-      outputBuf->allocate();
+  if(ioUring) {
+    // output written meanwhile waits in outputChain, sendingChain is read by the kernel until the send completes
+    if((isConnected() || isDisconnecting()) && !sendInFlight) {
+      if(sendingChain.empty()) {
+        sendingChain.swap(outputChain);
+      }
+      if(!sendingChain.empty()) {
+        sendInFlight = true;
+        ioUring->send(shared_from_this(), fd, sendingChain);
+      }
     }
-    ssize_t writeLen = ::write(fd, outputBuf->begin(), outputBuf->size());
+    return;
+  }
+
+  while((isConnected() || isDisconnecting()) && writable && !outputChain.empty()) {
+    // copied data and referenced payloads go out together, in order
+    struct iovec iov[IOV_MAX];
+    int iovCount = outputChain.prepare(iov, IOV_MAX);
+    ssize_t writeLen = ::writev(fd, iov, iovCount);
     
     if(writeLen > 0) {
       LOG(LogLevel::DEBUG, "[Connection][fd %d] write %d bytes", fd, static_cast<int>(writeLen));
-      outputBuf->consume(writeLen);
+      outputChain.consume(static_cast<size_t>(writeLen));
+      Metrics::add(MetricsCounter::BYTES_OUT, static_cast<uint64_t>(writeLen));
       continue;
     }
 
@@ -62,55 +113,178 @@ void Connection::sendData() {
         writable = false;
         return;
       }
-      LOG(LogLevel::DEBUG, "[Connection][fd %d][write() -1] error: [%d]%s", fd, errno, ::strerror(errno));
+      LOG(LogLevel::DEBUG, "[Connection][fd %d][writev() -1] error: [%d]%s", fd, errno, ::strerror(errno));
       terminate();
     }
     return;
   }
 }
 
-std::shared_ptr<TimeoutEntry> Connection::setTimeoutEntry() {
-  auto _timeoutEntry = std::make_shared<TimeoutEntry>(shared_from_this());
-  timeoutEntry = _timeoutEntry;
-  return _timeoutEntry;
+void Connection::armReceive() {
+  if(status < ConnectionStatus::DISCONNECTED && !receiveRequest && !isReadingPaused()) {
+    receiveRequest = ioUring->receive(ioUringTag, fd);
+  }
 }
 
-std::shared_ptr<TimeoutEntry> Connection::getTimeoutEntry() {
-  if(auto timeoutEntryPtr = timeoutEntry.lock()) {
-    return timeoutEntryPtr;
+void Connection::handleReceiveCompletion(const char* data, int result, bool more) {
+  if(!more) {
+    receiveRequest = 0;   // armed again by process() if still wanted
+  }
+  if(result > 0) {
+    Metrics::add(MetricsCounter::BYTES_IN, static_cast<uint64_t>(result));
+    // when ConnectionStatus::DISCONNECTING, input data is ignored
+    if(isConnected()) {
+      inputBuf->append(data, static_cast<size_t>(result));
+      LOG(LogLevel::DEBUG, "[Connection][fd %d] received %d bytes", fd, result);
+    }
+  } else if(result == 0) {
+    LOG(LogLevel::INFO, "[Connection][fd %d] connection closed by peer", fd);
+    terminate();
+    return;
+  } else if(result == -ENOBUFS || result == -ECANCELED) {
+    // out of provided buffers, or cancelled once reading paused, nothing lost
   } else {
-    return nullptr;
+    LOG(LogLevel::DEBUG, "[Connection][fd %d][recv() %d] error: %s", fd, result, ::strerror(-result));
+    terminate();
+    return;
   }
+  process();
 }
 
-void Connection::await(std::vector<std::shared_ptr<RequestResult>> requestResultList, ConnectionHandler handler) {
-  // check if any subRequestResult still pending
-  for(auto subRequestResult : requestResultList) {
-    if(subRequestResult->pending()) {
-      // then await SubConnectionEvent
-      setSubConnectionCallBackHandler([=](Connection* const masterConnection) {
-        for(auto requestResult : requestResultList) {
-          if(requestResult->pending()) {
-            return;
-          }
-        }
-        handler(masterConnection);
-      });
-      return;
+void Connection::handleSendCompletion(int result) {
+  sendInFlight = false;
+  if(!isConnected() && !isDisconnecting()) {
+    return;   // terminated, cancelled or not, nothing left to send
+  }
+  if(result > 0) {
+    LOG(LogLevel::DEBUG, "[Connection][fd %d] sent %d bytes", fd, result);
+    sendingChain.consume(static_cast<size_t>(result));
+    Metrics::add(MetricsCounter::BYTES_OUT, static_cast<uint64_t>(result));
+  } else if(result != -EINTR && result != -EAGAIN) {
+    LOG(LogLevel::DEBUG, "[Connection][fd %d][sendmsg() %d] error: %s", fd, result, ::strerror(-result));
+    terminate();
+    return;
+  }
+  // the rest of sendingChain, or what's been written since
+  process();
+}
+
+void Connection::checkOutputWatermarks() {
+  if(status == ConnectionStatus::DISCONNECTED) {
+    return;   // taken off totalPendingOutputSize by terminate()
+  }
+  size_t pendingOutputSize = getPendingOutputSize();
+  if(pendingOutputSize != accountedOutputSize) {
+    if(pendingOutputSize > accountedOutputSize) {
+      totalPendingOutputSize.fetch_add(pendingOutputSize - accountedOutputSize, std::memory_order_relaxed);
+    } else {
+      totalPendingOutputSize.fetch_sub(accountedOutputSize - pendingOutputSize, std::memory_order_relaxed);
     }
+    accountedOutputSize = pendingOutputSize;
+  }
+
+  if(!outputBackpressured) {
+    if(pendingOutputSize >= highWatermark || 
+       (pendingOutputSize > lowWatermark && getTotalPendingOutputSize() > outputMemoryBudget)) {
+      outputBackpressured = true;
+      LOG(LogLevel::DEBUG, "[Connection][fd %d] %zu bytes of output pending, reading paused", fd, pendingOutputSize);
+      if(ioUring && receiveRequest) {
+        ioUring->cancelRequest(receiveRequest);
+      }
+      if(onHighWatermarkHandler) {
+        onHighWatermarkHandler(this);
+      }
+    }
+  } else if(pendingOutputSize <= lowWatermark) {
+    outputBackpressured = false;
+    LOG(LogLevel::DEBUG, "[Connection][fd %d] %zu bytes of output pending, reading resumed", fd, pendingOutputSize);
+    if(onLowWatermarkHandler) {
+      onLowWatermarkHandler(this);
+    }
+    if(isConnected() && !readingPaused) {
+      issueIOEventToSelf(IOEventType::READ_EVENT);    // as resumeReading()
+    }
+  }
+}
+
+void Connection::pauseReading() {
+  readingPaused = true;
+  if(ioUring && receiveRequest) {
+    ioUring->cancelRequest(receiveRequest);
+  }
+}
+
+void Connection::resumeReading() {
+  readingPaused = false;
+  if(isConnected() && !outputBackpressured) {
+    // no new readiness for what came meanwhile, and input kept may be waiting for its handler
+    issueIOEventToSelf(IOEventType::READ_EVENT);
+  }
+}
+
+void Connection::scheduleBufferShrink() {
+  bufferActive = false;
+  std::weak_ptr<Connection> weakConnection = shared_from_this();
+  bufferShrinkEntry = setTimeout(std::chrono::milliseconds(BUFFER_SHRINK_IDLE_MS), [weakConnection] {
+    auto connection = weakConnection.lock();
+    if(connection) {
+      connection->shrinkBuffers();
+    }
+  });
+}
+
+// called by the TimeoutManager of the EventLoop this connection belongs to, same thread as process()
+void Connection::shrinkBuffers() {
+  bufferShrinkEntry = nullptr;
+  if(!isConnected() && !isDisconnecting()) {
+    return;
+  }
+  if(!bufferActive) {
+    inputBuf->shrink();
+    outputChain.getBuffer()->shrink();
+    if(!sendInFlight) {
+      sendingChain.getBuffer()->shrink();
+    }
+    LOG(LogLevel::DEBUG, "[Connection][fd %d] buffers shrunk to %d / %d bytes", fd,
+        static_cast<int>(inputBuf->getCapacity()), static_cast<int>(outputChain.getBuffer()->getCapacity()));
+  }
+  // still busy, or data left that doesn't fit, check again one period later
+  if(inputBuf->getCapacity() > DEFAULT_BUFFER_SIZE || outputChain.getBuffer()->getCapacity() > DEFAULT_BUFFER_SIZE) {
+    scheduleBufferShrink();
   }
-  // none subRequestResult is pending, good to go, SubConnectionEvent won't disturb following request
-  handler(this);
+}
+
+void Connection::setIdleTimeout(std::shared_ptr<TimeoutManager> timeoutManager, std::shared_ptr<TimeoutEntry> entry) {
+  idleTimeoutManager = timeoutManager;
+  idleTimeoutEntry = entry;
+  clockIn();
+}
+
+void Connection::await(std::vector<std::shared_ptr<RequestResult>> requestResultList, ConnectionHandler handler) {
+  await(requestResultList, AwaitPolicy::makeAll(), handler);
+}
+
+void Connection::await(std::vector<std::shared_ptr<RequestResult>> requestResultList, AwaitPolicy policy, ConnectionHandler handler) {
+  auto awaitGroup = AwaitGroup::join(this, requestResultList, policy);
+  if(awaitGroup->tryComplete(this, requestResultList)) {
+    // policy met already, good to go, SubConnectionEvent won't disturb following request
+    handler(this);
+    return;
+  }
+  // then await SubConnectionEvent, only the settled counts of awaitGroup checked on each
+  setSubConnectionCallBackHandler([=](Connection* const masterConnection) {
+    if(awaitGroup->tryComplete(masterConnection, requestResultList)) {
+      handler(masterConnection);
+    }
+  });
 }
 
 void Connection::resolve(std::shared_ptr<Connection> masterConnection) {
-  EventDetail detail;
-  detail.subConnectionEvent = new SubConnectionEvent(
-    masterConnection, 
-    shared_from_this(), 
-    SubConnectionEventType::RESOLVED
-  );
-  issueEvent(std::make_shared<Event>(EventType::SUBCONNECTION_EVENT, detail));
+  issueEvent(Event::makeSubConnectionEvent(masterConnection, shared_from_this(), SubConnectionEventType::RESOLVED));
+  recycle();
+}
+
+void Connection::recycle() {
   // clear handlers
   onConnectedHandler = nullptr;
   onReceiveDataHandler = nullptr;
@@ -118,13 +292,7 @@ void Connection::resolve(std::shared_ptr<Connection> masterConnection) {
 }
 
 void Connection::reject(std::shared_ptr<Connection> masterConnection) {
-  EventDetail detail;
-  detail.subConnectionEvent = new SubConnectionEvent(
-    masterConnection, 
-    shared_from_this(), 
-    SubConnectionEventType::REJECTED
-  );
-  issueEvent(std::make_shared<Event>(EventType::SUBCONNECTION_EVENT, detail));
+  issueEvent(Event::makeSubConnectionEvent(masterConnection, shared_from_this(), SubConnectionEventType::REJECTED));
   terminate();
 }
 
@@ -135,36 +303,24 @@ void Connection::requestResolved() {
   }
 }
 
-void Connection::handleEvent(std::shared_ptr<Event> event) {
-  switch(event->getType()) {
+void Connection::handleEvent(const Event& event) {
+  switch(event.getType()) {
     case EventType::IO_EVENT:
-      {
-        // update readable & writable status according to IOEvent
-        IOEvent* activeIoEvent = event->getEventDetail().ioEvent;
-        switch(activeIoEvent->getEvent()) {
-          case IOEventType::READ_EVENT:
-            readable = true;
-            break;
-
-          case IOEventType::WRITE_EVENT:
-            writable = true;
-            break;
-            
-          case IOEventType::READ_AND_WRITE_EVENT:
-            readable = true;
-            writable = true;
-            break;
-        }
-      }
-      break;
+      handleIOEvent(event.getIOEvent());
+      return;
 
     case EventType::SUBCONNECTION_EVENT:
       {
-        SubConnectionEvent* activeSubConnectionEvent = event->getEventDetail().subConnectionEvent;
         if(isConnected() && subConnectionCallBackHandler) {
-          LOG(LogLevel::DEBUG, "[Connection][fd %d] SUBCONNECTION_EVENT activated, subconnection[fd %d]", fd, activeSubConnectionEvent->getSubConnection()->get_fd());
+          LOG(LogLevel::DEBUG, "[Connection][fd %d] SUBCONNECTION_EVENT activated, subconnection[fd %d]", fd, event.getSubConnection()->get_fd());
           subConnectionCallBackHandler(this);
         }
+        if(isConnected() && !pipeline.empty()) {
+          // the request awaiting it isn't known, every one in flight checks its own
+          for(size_t index = 0; index < pipeline.size(); index++) {
+            pipeline[index]->handleSubConnectionEvent();
+          }
+        }
       }
       break;
 
@@ -173,6 +329,36 @@ void Connection::handleEvent(std::shared_ptr<Event> event) {
       shutdown();
       break;
   }
+  process();
+}
+
+void Connection::handleIOEvent(IOEventType ioType) {
+  // update readable & writable status according to IOEvent
+  switch(ioType) {
+    case IOEventType::READ_EVENT:
+      readable = true;
+      break;
+
+    case IOEventType::WRITE_EVENT:
+      writable = true;
+      break;
+      
+    case IOEventType::READ_AND_WRITE_EVENT:
+      readable = true;
+      writable = true;
+      break;
+  }
+  process();
+}
+
+void Connection::handleReadyEvent() {
+  readyListed = false;
+  if(status < ConnectionStatus::DISCONNECTED) {
+    handleIOEvent(IOEventType::READ_EVENT);
+  }
+}
+
+void Connection::process() {
   LOG(LogLevel::DEBUG, "[Connection][fd %d][status %d][ readable %d][writable %d]", fd, status, readable, writable);
   
   // call on connected handler 
@@ -184,59 +370,136 @@ void Connection::handleEvent(std::shared_ptr<Event> event) {
     }
   }
 
+  if(isConnected() && wakeUpPending.exchange(false) && onWakeUpHandler) {
+    onWakeUpHandler(this);
+  }
+
   sendData();
-  receiveData();
+  checkOutputWatermarks();
+  if(!isReadingPaused()) {
+    receiveData();
+  }
 
-  if(isConnected()) {
-    if(inputBuf->size() > 0 && onReceiveDataHandler && !subConnectionCallBackHandler) {
+  if(isConnected() && pipelinedRequestHandler) {
+    handlePipelinedRequests();
+  } else if(isConnected()) {
+    if(inputBuf->size() > 0 && onReceiveDataHandler && !subConnectionCallBackHandler && !isReadingPaused()) {
       // data remain to handle, call onReceiveDataHandler 
       LOG(LogLevel::DEBUG, "[Connection][fd %d] call onReceiveDataHandler", fd);
+      uint64_t handlerStart = Metrics::startTiming();
       onReceiveDataHandler(this);
+      Metrics::stopTiming(MetricsHistogram::HANDLER_TIME, handlerStart);
     }
   }
   
   sendData();
+  checkOutputWatermarks();
+
+  // a burst grew the buffers, give the memory back once idle for BUFFER_SHRINK_IDLE_MS
+  if(bufferShrinkEntry) {
+    bufferActive = true;
+  } else if(isConnected() && (inputBuf->getCapacity() > DEFAULT_BUFFER_SIZE || outputChain.getBuffer()->getCapacity() > DEFAULT_BUFFER_SIZE)) {
+    scheduleBufferShrink();
+  }
   
-  // simulate level trigger mode readable event (EPOLLLT | EPOLLIN)
-  if(isConnected() && readable) {  
-    issueIOEventToSelf(IOEventType::READ_EVENT);
+  // every message of the finished requests dropped, pending sub requests hold the arena as well
+  if(requestArena && requestArena.use_count() == 1) {
+    requestArena->reset();
+  }
+
+  // simulate level trigger mode readable event (EPOLLLT | EPOLLIN), left readable while paused,
+  // another turn once every connection ready on this EventLoop had one, instead of an event through the queue
+  if(isConnected() && readable && !isReadingPaused() && !readyListed) {  
+    readyListed = eventPoll->addReadyConnection(shared_from_this());
+    if(!readyListed) {
+      issueIOEventToSelf(IOEventType::READ_EVENT);
+    }
   }
 
-  if(isDisconnecting() && outputBuf->empty()) {  
+  if(isDisconnecting() && outputChain.empty() && sendingChain.empty()) {  
     // connection ConnectionStatus::DISCONNECTING and all data have been sent 
     // send FIN to peer
     ::shutdown(fd, SHUT_WR);
   }
 }
 
-void Connection::setTimeout(int seconds, std::function<void()> timeoutHandler) {
-  eventPoll->setTimeout(seconds, shared_from_this(), timeoutHandler);
+void Connection::handlePipelinedRequests() {
+  flushPipeline();
+  while(isConnected() && pipeline.size() < maxInFlight && !inputBuf->empty() && !isReadingPaused()) {
+    ParseResult parseResult;
+    size_t sizeBefore = inputBuf->size();
+    auto message = decodeMessage(parseResult);
+    if(parseResult == ParseResult::MESSAGE_INCOMPLETED) {
+      break;
+    }
+    if(parseResult != ParseResult::PARSE_SUCCESS && inputBuf->size() == sizeBefore) {
+      // frame boundary lost, nothing after it can be decoded
+      LOG(LogLevel::ERROR, "[Connection][fd %d] undecodable frame in pipelined mode, shutting down", fd);
+      shutdown();
+      break;
+    }
+    auto context = std::make_shared<RequestContext>(this, nextSequence++, parseResult, lastRequestId);
+    pipeline.push_back(context);
+    LOG(LogLevel::DEBUG, "[Connection][fd %d] call pipelinedRequestHandler, request %lu, %zu in flight", fd, context->getSequence(), pipeline.size());
+    uint64_t handlerStart = Metrics::startTiming();
+    pipelinedRequestHandler(context.get(), message);
+    Metrics::stopTiming(MetricsHistogram::HANDLER_TIME, handlerStart);
+    flushPipeline();
+  }
 }
 
-void Connection::clockIn() {
-  if(getTimeoutEntry()) {
-    eventPoll->connectionClockIn(thisConnection());
-  } else {
-    LOG(LogLevel::DEBUG, "[Connection][fd %d] this connection doesn't support IDLE timeout", fd);
+void Connection::flushPipeline() {
+  while(!pipeline.empty()) {
+    auto &context = pipeline.front();
+    for(auto &output : context->outputList) {
+      if(output.message) {
+        writeMessage(output.message, context->requestId);
+      } else {
+        writeData(output.data);
+      }
+    }
+    context->outputList.clear();
+    if(!context->finished) {
+      return;
+    }
+    pipeline.pop_front();
   }
-  
 }
 
-void Connection::issueEvent(std::shared_ptr<Event> event) {
-  eventPoll->eventDispatcher(event);
+std::shared_ptr<TimeoutEntry> Connection::setTimeout(int seconds, std::function<void()> timeoutHandler) {
+  return eventPoll->setTimeout(std::chrono::seconds(seconds), shared_from_this(), timeoutHandler);
+}
+
+std::shared_ptr<TimeoutEntry> Connection::setTimeout(std::chrono::milliseconds timeout, std::function<void()> timeoutHandler) {
+  return eventPoll->setTimeout(timeout, shared_from_this(), timeoutHandler);
+}
+
+void Connection::cancelTimeout(const std::shared_ptr<TimeoutEntry>& entry) {
+  eventPoll->cancelTimeout(thisConnection(), entry);
+}
+
+
+
+void Connection::issueEvent(Event event) {
+  eventPoll->eventDispatcher(std::move(event));
 }
 
 std::shared_ptr<Message> Connection::decodeMessage(ParseResult& parseResult) {
-  return inputBuf->fetchMessage(parseResult);
+  return decodeMessage(parseResult, requestArena.get());
+}
+
+std::shared_ptr<Message> Connection::decodeMessage(ParseResult& parseResult, MessageArena* arena) {
+  std::shared_ptr<Message> message = ProtoBuf::decodeFromBuffer(inputBuf, frameTypeTable, arena);
+  parseResult = ProtoBuf::getParseResult();
+  lastRequestId = ProtoBuf::getRequestId();
+  return message;
 }
 
 void Connection::issueIOEventToSelf(IOEventType event) {
   // std::this_thread::sleep_for(std::chrono::seconds(1));   // for debug, will be removed
   LOG(LogLevel::DEBUG, "[Connection][fd %d][event %d] going back to queue, will process later", fd, event);
   
-  EventDetail detail;
-  detail.ioEvent = new IOEvent(fd, event, shared_from_this());
-  issueEvent(std::make_shared<Event>(EventType::IO_EVENT, detail));
+  issueEvent(Event::makeIOEvent(shared_from_this(), event));
 }
 
 void Connection::reInit(ConnectionHandler _onConnectedHandler, 
@@ -275,11 +538,19 @@ void Connection::terminate() {
       onDisconnectingHandler(this);
     }
     
-    eventPoll->removeEventListener(fd);
-    ::close(fd);
+    if(idleTimeoutEntry) {
+      // free the wheel slot now rather than waiting for it to expire
+      idleTimeoutManager->cancel(idleTimeoutEntry);
+    }
+
+    eventPoll->removeEventListener(this);
+    totalPendingOutputSize.fetch_sub(accountedOutputSize, std::memory_order_relaxed);
+    accountedOutputSize = 0;
 
-    // no new io event will come, so it's safe to remove this connection from connection set
+    // no new io event will come, so it's safe to remove this connection from connection set,
+    // and it must be removed before closing, once closed the fd may be reused by a new connection
     eventPoll->removeConnection(fd);
+    ::close(fd);
 
     // this connection is actually disconnected, 
     // and this connection instance will just remain  
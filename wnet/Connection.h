@@ -1,24 +1,36 @@
 #pragma once
 
+#include <atomic>
 #include <cerrno>
+#include <chrono>
+#include <climits>
 #include <cstring>
+#include <deque>
 #include <memory>
 #include <string>
+#include <type_traits>
 #include <vector>
 #include <unistd.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 
+#include "AwaitPolicy.h"
 #include "Buffer.h"
 #include "Event.h"
 #include "Log.h"
+#include "MessageArena.h"
 #include "Noncopyable.h"
+#include "OutputChain.h"
 #include "ProtoBuf.h"
+#include "RequestContext.h"
+#include "TimeoutManager.h"
 
 namespace wnet {
 
+class BackendEndpoint;
 class EventPoll;
+class IOUring;
 class RequestResult;
-class TimeoutEntry;
 
 enum class ConnectionType {
   ACTIVE = 1, 
@@ -34,37 +46,119 @@ enum class ConnectionStatus {
 
 using ConnectionHandler = std::function<void(Connection* const)>;
 
+// message nullptr if the request couldn't be decoded, see RequestContext::getParseResult()
+using RequestHandler = std::function<void(RequestContext* const, std::shared_ptr<Message>)>;
+
 class Connection : public noncopyable, public std::enable_shared_from_this<Connection> {
   private:
     const int fd;
     std::string serverIP = "";
     short serverPort = 0;
     std::string clientIP = "";
+    BackendEndpoint* endpoint = nullptr;    // active connections only, endpoints live as long as the process
 
     std::shared_ptr<EventPoll> eventPoll;
+    // EventLoop handling this connection, its events, timeouts and handlers, fd % EVENT_LOOP_COUNT unless pinned
+    int loopIndex;
 
-    std::weak_ptr<TimeoutEntry> timeoutEntry;
+    // idle timeout, only for connections constructed with it initiated ( EventPoll::connectionIniIdleTimeout() )
+    std::shared_ptr<TimeoutManager> idleTimeoutManager;
+    std::shared_ptr<TimeoutEntry> idleTimeoutEntry;
+    std::atomic<uint64_t> lastActiveTick;     // TimeoutManager::now() of last clockIn()
 
     ConnectionStatus status;
 
     ConnectionType type;
 
-    std::shared_ptr<Buffer> inputBuf,
-                            outputBuf;
+    std::shared_ptr<Buffer> inputBuf;
+    OutputChain outputChain;
+    FrameTypeTable frameTypeTable;    // ids of compact framing, both directions
+
+    // messages of requests and their sub request responses, only if setRequestArena() called
+    std::shared_ptr<MessageArena> requestArena;
     bool readable = false;
     bool writable = false;
 
+    // readv() per turn of the EventLoop, a connection left readable queued on its ready list for another turn
+    size_t readBudgetBytes = READ_BUDGET_BYTES;
+    int readBudgetCalls = READ_BUDGET_CALLS;
+    bool readyListed = false;
+    uint32_t lastRequestId = 0;    // of the message last decoded, 0 if not multiplexed
+
+    // set by wakeUp() from any thread, onWakeUpHandler called in the EventLoop of this connection
+    std::atomic<bool> wakeUpPending;
+    ConnectionHandler onWakeUpHandler;
+
+    // IOBackend::IO_URING, ring of its EventLoop once armed ( EventPoll::armIOUring() ), nullptr with epoll,
+    // received into by completions, sent from sendingChain, one send in flight at a time
+    IOUring* ioUring = nullptr;
+    uint64_t ioUringTag = 0;
+    uint64_t receiveRequest = 0;    // multishot receive armed, 0 if none
+    OutputChain sendingChain;
+    bool sendInFlight = false;
+
+    // reading and onReceiveDataHandler paused once pending output reaches highWatermark, or passes lowWatermark
+    // while all connections together are over the output memory budget, resumed once drained to lowWatermark
+    size_t highWatermark = OUTPUT_HIGH_WATERMARK;
+    size_t lowWatermark = OUTPUT_LOW_WATERMARK;
+    bool outputBackpressured = false;
+    bool readingPaused = false;         // by pauseReading()
+    size_t accountedOutputSize = 0;     // share of totalPendingOutputSize
+    ConnectionHandler onHighWatermarkHandler, onLowWatermarkHandler;
+
+    static std::atomic<size_t> totalPendingOutputSize;
+    static size_t outputMemoryBudget;
+
+    // pending while a buffer is larger than DEFAULT_BUFFER_SIZE, shrinks it back once idle
+    std::shared_ptr<TimeoutEntry> bufferShrinkEntry;
+    bool bufferActive = false;    // processed since bufferShrinkEntry scheduled
+
     ConnectionHandler onConnectedHandler, 
                       onReceiveDataHandler, 
                       onDisconnectingHandler,
                       subConnectionCallBackHandler; 
 
+    // pipelined mode, onReceiveDataHandler not used, only if setPipelinedRequestHandler() called
+    RequestHandler pipelinedRequestHandler;
+    size_t maxInFlight = PIPELINE_MAX_IN_FLIGHT;
+    std::deque<std::shared_ptr<RequestContext>> pipeline;    // requests in flight, in request order
+    uint64_t nextSequence = 0;
+
     int requestIDForTimeout = 0;    // record ID for sub request
 
     void receiveData();
 
     void sendData();
 
+    // IOBackend::IO_URING, multishot receive armed again unless armed already or reading paused
+    void armReceive();
+
+    // accounts pending output to totalPendingOutputSize, pauses or resumes reading across the watermarks
+    void checkOutputWatermarks();
+
+    // shared by handleEvent() and handleIOEvent() after readable / writable status updated
+    void process();
+
+    void scheduleBufferShrink();
+
+    // decode requests into new contexts while fewer than maxInFlight are in flight
+    void handlePipelinedRequests();
+
+    // output of the finished requests at the front, and whatever the first unfinished one has written so far
+    void flushPipeline();
+
+    void shrinkBuffers();
+
+    template<typename TYPE>
+    void appendOutput(const TYPE& data, std::false_type) {
+      outputChain.append(data);
+    }
+
+    // messages framed according to frameTypeTable
+    void appendOutput(const std::shared_ptr<Message>& message, std::true_type) {
+      outputChain.append(message, frameTypeTable);
+    }
+
     void setSubConnectionCallBackHandler(ConnectionHandler handler) {
       subConnectionCallBackHandler = handler;
     }
@@ -77,13 +171,15 @@ class Connection : public noncopyable, public std::enable_shared_from_this<Conne
                 ConnectionHandler _onReceiveDataHandler = nullptr, 
                 ConnectionHandler _onDisconnectingHandler = nullptr): fd(_fd), 
                                                               eventPoll(_eventPoll),
+                                                              loopIndex(_fd % EVENT_LOOP_COUNT),
+                                                              lastActiveTick(0),
                                                               status(ConnectionStatus::CONNECTING),
                                                               type(_type),
+                                                              wakeUpPending(false),
                                                               onConnectedHandler(_onConnectedHandler), 
                                                               onReceiveDataHandler(_onReceiveDataHandler), 
                                                               onDisconnectingHandler(_onDisconnectingHandler) {
       inputBuf = std::make_shared<Buffer>();
-      outputBuf = std::make_shared<Buffer>();
     }
 
     std::shared_ptr<Connection> thisConnection() {
@@ -101,6 +197,16 @@ class Connection : public noncopyable, public std::enable_shared_from_this<Conne
       return fd;
     }
 
+    int getLoopIndex() {
+      return loopIndex;
+    }
+
+    // pin to another EventLoop, e.g. a subconnection to the one of its master connection,
+    // only before added to EventPoll
+    void setLoopIndex(int _loopIndex) {
+      loopIndex = _loopIndex;
+    }
+
     void setServerInfo(std::string _serverIP, short _serverPort) {
       serverIP = _serverIP;
       serverPort = _serverPort;
@@ -122,16 +228,73 @@ class Connection : public noncopyable, public std::enable_shared_from_this<Conne
       return clientIP;
     }
 
-    std::shared_ptr<TimeoutEntry> setTimeoutEntry();
+    void setEndpoint(BackendEndpoint* const _endpoint) {
+      endpoint = _endpoint;
+    }
+
+    BackendEndpoint* getEndpoint() {
+      return endpoint;
+    }
 
-    std::shared_ptr<TimeoutEntry> getTimeoutEntry();
+    void setIdleTimeout(std::shared_ptr<TimeoutManager> timeoutManager, std::shared_ptr<TimeoutEntry> entry);
+
+    uint64_t getLastActiveTick() {
+      return lastActiveTick.load(std::memory_order_relaxed);
+    }
 
     std::shared_ptr<Buffer> getInputBuffer() {
       return inputBuf;
     }
 
+    // holds the copied part of pending output only, write through writeData()
     std::shared_ptr<Buffer> getOutputBuffer() {
-      return outputBuf;
+      return outputChain.getBuffer();
+    }
+
+    // bytes written but not sent yet
+    size_t getPendingOutputSize() {
+      return outputChain.size() + sendingChain.size();
+    }
+
+    // bytes and readv() calls of one turn, the rest read after every other connection ready on the EventLoop had its turn
+    void setReadBudget(size_t bytes, int calls) {
+      readBudgetBytes = bytes > 0 ? bytes : 1;
+      readBudgetCalls = calls > 0 ? calls : 1;
+    }
+
+    // highWatermark SIZE_MAX never to pause, lowWatermark below highWatermark
+    void setOutputWatermarks(size_t _highWatermark, size_t _lowWatermark) {
+      highWatermark = _highWatermark;
+      lowWatermark = _lowWatermark < _highWatermark ? _lowWatermark : _highWatermark - 1;
+    }
+
+    // called once reading pauses on pending output, e.g. to pause the subconnection feeding this one
+    void setOnHighWatermarkHandler(ConnectionHandler handler) {
+      onHighWatermarkHandler = handler;
+    }
+
+    // called once pending output drains to the low watermark and reading resumes
+    void setOnLowWatermarkHandler(ConnectionHandler handler) {
+      onLowWatermarkHandler = handler;
+    }
+
+    // only in the EventLoop of this connection, input stays in the socket until resumeReading()
+    void pauseReading();
+
+    void resumeReading();
+
+    bool isReadingPaused() {
+      return readingPaused || outputBackpressured;
+    }
+
+    // pending output of every connection, as of their last process()
+    static size_t getTotalPendingOutputSize() {
+      return totalPendingOutputSize.load(std::memory_order_relaxed);
+    }
+
+    // before any connection is made
+    static void setOutputMemoryBudget(size_t budget) {
+      outputMemoryBudget = budget;
     }
 
     void setOnConnectedHandler(ConnectionHandler handler) {
@@ -148,42 +311,179 @@ class Connection : public noncopyable, public std::enable_shared_from_this<Conne
 
     void await(std::vector<std::shared_ptr<RequestResult>> requestResultList, ConnectionHandler handler);
 
+    // handler called once the policy is met, e.g. AwaitPolicy::makeQuorum(2), the sub requests still pending are cancelled
+    void await(std::vector<std::shared_ptr<RequestResult>> requestResultList, AwaitPolicy policy, ConnectionHandler handler);
+
     // only for subconnection
     void resolve(std::shared_ptr<Connection> masterConnection);
 
+    // only for subconnection, handlers cleared without telling the master connection, before going back to the pool
+    void recycle();
+
     // only for subconnection
     void reject(std::shared_ptr<Connection> masterConnection);
 
     void requestResolved();
+
+    // handle several requests at once, every decoded message gets a RequestContext of its own,
+    // awaiting sub requests independently, responses written back in request order,
+    // at most maxInFlight requests decoded ahead of the oldest one not finished
+    void setPipelinedRequestHandler(RequestHandler handler, size_t _maxInFlight = PIPELINE_MAX_IN_FLIGHT) {
+      pipelinedRequestHandler = handler;
+      maxInFlight = _maxInFlight > 0 ? _maxInFlight : 1;
+    }
+
+    size_t getInFlightCount() {
+      return pipeline.size();
+    }
     
     // handle connection assigned to this connection, called by EventLoop in working threads
-    void handleEvent(std::shared_ptr<Event> event);
+    void handleEvent(const Event& event);
+
+    // handle readiness reported by epoll directly, called by EventLoop in ReactorMode::LOOP_PER_THREAD
+    void handleIOEvent(IOEventType ioType);
+
+    // turn on the ready list of its EventLoop, reading on where the read budget stopped
+    void handleReadyEvent();
     
-    void setTimeout(int seconds, std::function<void()> timeoutHandler);
+    std::shared_ptr<TimeoutEntry> setTimeout(int seconds, std::function<void()> timeoutHandler);
 
-    // info TimeoutManager this connection is still working 
+    // rounded up to TIMER_RESOLUTION_MS
+    std::shared_ptr<TimeoutEntry> setTimeout(std::chrono::milliseconds timeout, std::function<void()> timeoutHandler);
+
+    // timeout handler won't be called if cancelled before expiration
+    void cancelTimeout(const std::shared_ptr<TimeoutEntry>& entry);
+
+    // info TimeoutManager this connection is still working, a single store,
     // only works when constructed with idle timeout initiated
-    void clockIn();
+    void clockIn() {
+      if(idleTimeoutManager) {
+        lastActiveTick.store(idleTimeoutManager->now(), std::memory_order_relaxed);
+      }
+    }
 
     // issue events to other onnection or whatever
-    void issueEvent(std::shared_ptr<Event> event);
+    void issueEvent(Event event);
 
+    // copies any data supported by Buffer,
+    // std::shared_ptr<const std::string> ( e.g. ProtoBuf::encodeIntoString() ) is sent without copying
     template<typename TYPE>
-    void writeData(TYPE data) { // you can write any data supported by Buffer
+    void writeData(const TYPE& data) {
+      if(isConnected()) {
+        clockIn();
+        appendOutput(data, std::is_convertible<TYPE, std::shared_ptr<Message>>());
+      } else {
+        LOG(LogLevel::DEBUG, "[Connection][fd %d][status %d] connection not connected, unable to write data", fd, status);
+      }
+    }
+
+    // sent without copying, [data, data + length) must stay unchanged while owner is alive
+    void writeData(std::shared_ptr<const void> owner, const char* data, size_t length) {
+      if(isConnected()) {
+        clockIn();
+        outputChain.append(std::move(owner), data, length);
+      } else {
+        LOG(LogLevel::DEBUG, "[Connection][fd %d][status %d] connection not connected, unable to write data", fd, status);
+      }
+    }
+
+    // multiplexed frame tagged with requestId, plain one if requestId is 0,
+    // e.g. a response to the request id got by getRequestId()
+    void writeMessage(const std::shared_ptr<Message>& message, uint32_t requestId) {
+      if(isConnected()) {
+        clockIn();
+        outputChain.append(message, frameTypeTable, requestId);
+      } else {
+        LOG(LogLevel::DEBUG, "[Connection][fd %d][status %d] connection not connected, unable to write data", fd, status);
+      }
+    }
+
+    // many responses at once, encoded into one reservation of the output buffer,
+    // requestIdList as filled by decodeMessages() if the peer multiplexes
+    void writeMessages(const std::vector<std::shared_ptr<Message>>& messageList, const std::vector<uint32_t>* requestIdList = nullptr) {
       if(isConnected()) {
         clockIn();
-        outputBuf->append(data);
+        outputChain.append(messageList, frameTypeTable, requestIdList);
       } else {
         LOG(LogLevel::DEBUG, "[Connection][fd %d][status %d] connection not connected, unable to write data", fd, status);
       }
     }
 
-    // decode protobuf message from input buffer
+    // decode protobuf message from input buffer, in legacy or compact framing
     std::shared_ptr<Message> decodeMessage(ParseResult& parseResult);
 
+    // decoded on arena instead of the request arena of this connection, for sub request responses
+    std::shared_ptr<Message> decodeMessage(ParseResult& parseResult, MessageArena* arena);
+
+    // every complete message in input buffer at once, appended to messageList, for pipelining peers,
+    // nullptr in place of one that failed to decode ( unknown type, bad body ), MESSAGE_INCOMPLETED if all walked,
+    // PARSE_ERROR if the frame boundary is lost, nothing more decodable, shutdown() expected
+    ParseResult decodeMessages(std::vector<std::shared_ptr<Message>>& messageList, std::vector<uint32_t>* requestIdList = nullptr) {
+      return ProtoBuf::decodeAllFromBuffer(inputBuf, frameTypeTable, messageList, requestArena.get(), requestIdList);
+    }
+
+    // request id of the message last decoded by decodeMessage(), to be echoed by writeMessage(), 0 if not multiplexed
+    uint32_t getRequestId() {
+      return lastRequestId;
+    }
+
+    // allocate decoded messages, createMessage() ones and sub request responses on one protobuf Arena,
+    // freed all at once after process() when none of them is referenced any more, instead of one by one
+    void setRequestArena() {
+      if(!requestArena) {
+        requestArena = std::make_shared<MessageArena>();
+      }
+    }
+
+    // nullptr if setRequestArena() not called
+    std::shared_ptr<MessageArena> getRequestArena() {
+      return requestArena;
+    }
+
+    // on the request arena if there is one, on heap otherwise
+    template<typename MESSAGE>
+    std::shared_ptr<MESSAGE> createMessage() {
+      return requestArena ? requestArena->create<MESSAGE>() : std::make_shared<MESSAGE>();
+    }
+
+    // encode messages with compact framing, type name sent once and a fixed size header afterwards,
+    // only for peers able to decode it, switched on by itself once the peer sends a compact framed message
+    void setCompactFraming() {
+      frameTypeTable.setCompact();
+    }
+
     // can be used for simulating level triggered read events
     void issueIOEventToSelf(IOEventType event);
 
+    IOUring* getIOUring() {
+      return ioUring;
+    }
+
+    // IOBackend::IO_URING, by the EventLoop of this connection before requests are armed on its ring
+    void setIOUring(IOUring* _ioUring, uint64_t tag) {
+      ioUring = _ioUring;
+      ioUringTag = tag;
+    }
+
+    // IOBackend::IO_URING, result bytes of a receive completion at data, 0 if closed by peer, or -errno,
+    // more false once the multishot receive is over
+    void handleReceiveCompletion(const char* data, int result, bool more);
+
+    // IOBackend::IO_URING, result bytes of sendingChain sent, or -errno
+    void handleSendCompletion(int result);
+
+    void setOnWakeUpHandler(ConnectionHandler handler) {
+      onWakeUpHandler = handler;
+    }
+
+    // thread safe, onWakeUpHandler called once in the EventLoop of this connection, 
+    // e.g. to write data other threads have handed over
+    void wakeUp() {
+      if(!wakeUpPending.exchange(true)) {
+        issueIOEventToSelf(IOEventType::WRITE_EVENT);
+      }
+    }
+
     bool isConnected() {
       return status == ConnectionStatus::CONNECTED;
     }
@@ -198,7 +498,7 @@ class Connection : public noncopyable, public std::enable_shared_from_this<Conne
                 ConnectionHandler _onDisconnectingHandler = nullptr);
 
     // gracefully, just mark this connection ConnectionStatus::DISCONNECTING, 
-    // data remaining in outputBuf will still be sent
+    // data remaining in outputChain will still be sent
     void shutdown();
 
     // actually kill this connection, mustn't call in user code
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "Config.h"
+#include "Log.h"
+#include "Noncopyable.h"
+
+namespace wnet {
+
+class Connection;
+
+// dense table indexed by connection fd, replacing std::map<int, shared_ptr<Connection>>
+// slots are allocated chunk by chunk on demand and never moved or freed until destruction,
+// so lookups never take a lock and never race with growth
+//
+// every slot carries a generation, bumped whenever the slot is filled or emptied,
+// epoll_event.data.u64 keeps a tag of { generation, fd } so events for a closed and reused fd are detected as stale
+class ConnectionTable : public noncopyable {
+  private:
+    struct Slot {
+      std::atomic<uint32_t> generation;
+      // only accessed through std::atomic_load / atomic_store / atomic_exchange
+      std::shared_ptr<Connection> connection;
+
+      Slot(): generation(0) {}
+    };
+
+    std::atomic<Slot*> chunkList[CONNECTION_TABLE_CHUNK_COUNT];
+    std::atomic<int> connectionCount;
+
+    Slot* getSlot(int fd, bool create) {
+      if(fd < 0 || fd >= CONNECTION_TABLE_CHUNK_COUNT * CONNECTION_TABLE_CHUNK_SIZE) {
+        return nullptr;
+      }
+      auto &chunk = chunkList[fd / CONNECTION_TABLE_CHUNK_SIZE];
+      Slot* slots = chunk.load(std::memory_order_acquire);
+      if(!slots && create) {
+        Slot* newSlots = new Slot[CONNECTION_TABLE_CHUNK_SIZE];
+        if(chunk.compare_exchange_strong(slots, newSlots, std::memory_order_acq_rel)) {
+          slots = newSlots;
+        } else {
+          delete[] newSlots;    // another thread got there first, slots now holds its chunk
+        }
+      }
+      return slots ? &slots[fd % CONNECTION_TABLE_CHUNK_SIZE] : nullptr;
+    }
+
+    static uint64_t makeTag(uint32_t generation, int fd) {
+      return (static_cast<uint64_t>(generation) << 32) | static_cast<uint32_t>(fd);
+    }
+
+  public:
+    ConnectionTable(): connectionCount(0) {
+      for(auto &chunk : chunkList) {
+        chunk.store(nullptr, std::memory_order_relaxed);
+      }
+    }
+
+    ~ConnectionTable() {
+      for(auto &chunk : chunkList) {
+        delete[] chunk.load(std::memory_order_relaxed);
+      }
+    }
+
+    static int tagToFd(uint64_t tag) {
+      return static_cast<int>(static_cast<uint32_t>(tag));
+    }
+
+    // return false if fd is out of range
+    bool insert(int fd, std::shared_ptr<Connection> connection) {
+      Slot* slot = getSlot(fd, true);
+      if(!slot) {
+        LOG(LogLevel::ERROR, "[ConnectionTable][fd %d] fd out of range, max fd: %d", fd, CONNECTION_TABLE_CHUNK_COUNT * CONNECTION_TABLE_CHUNK_SIZE - 1);
+        return false;
+      }
+      slot->generation.fetch_add(1, std::memory_order_acq_rel);
+      if(!std::atomic_exchange(&slot->connection, std::move(connection))) {
+        connectionCount.fetch_add(1, std::memory_order_relaxed);
+      }
+      return true;
+    }
+
+    // tag to store in epoll_event.data.u64, fds not held in table (timer, listening socket) get generation 0
+    uint64_t getTag(int fd) {
+      Slot* slot = getSlot(fd, false);
+      return makeTag(slot ? slot->generation.load(std::memory_order_acquire) : 0, fd);
+    }
+
+    std::shared_ptr<Connection> get(int fd) {
+      Slot* slot = getSlot(fd, false);
+      return slot ? std::atomic_load(&slot->connection) : nullptr;
+    }
+
+    // nullptr if the slot was emptied or refilled after the tag was taken
+    std::shared_ptr<Connection> getByTag(uint64_t tag) {
+      int fd = tagToFd(tag);
+      Slot* slot = getSlot(fd, false);
+      if(!slot || makeTag(slot->generation.load(std::memory_order_acquire), fd) != tag) {
+        return nullptr;
+      }
+      auto connection = std::atomic_load(&slot->connection);
+      // check again, slot may be emptied and refilled between the two loads
+      if(makeTag(slot->generation.load(std::memory_order_acquire), fd) != tag) {
+        return nullptr;
+      }
+      return connection;
+    }
+
+    void remove(int fd) {
+      Slot* slot = getSlot(fd, false);
+      if(slot && std::atomic_load(&slot->connection)) {
+        slot->generation.fetch_add(1, std::memory_order_acq_rel);
+        if(std::atomic_exchange(&slot->connection, std::shared_ptr<Connection>())) {
+          connectionCount.fetch_sub(1, std::memory_order_relaxed);
+        }
+      }
+    }
+
+    int size() {
+      return connectionCount.load(std::memory_order_relaxed);
+    }
+
+    // empty every slot, remaining connections are moved into connectionList
+    void clear(std::vector<std::shared_ptr<Connection>>& connectionList) {
+      for(auto &chunk : chunkList) {
+        Slot* slots = chunk.load(std::memory_order_acquire);
+        if(!slots) {
+          continue;
+        }
+        for(int index = 0; index < CONNECTION_TABLE_CHUNK_SIZE; index++) {
+          if(auto connection = std::atomic_exchange(&slots[index].connection, std::shared_ptr<Connection>())) {
+            slots[index].generation.fetch_add(1, std::memory_order_acq_rel);
+            connectionCount.fetch_sub(1, std::memory_order_relaxed);
+            connectionList.push_back(std::move(connection));
+          }
+        }
+      }
+    }
+};
+
+}
@@ -3,47 +3,346 @@
 using namespace wnet;
 
 // for class RequestResult
-void RequestResult::resolve(std::shared_ptr<Message> _message) {
-  if(pending()) {
+void RequestResult::settle() {
+  if(auto group = std::atomic_load(&awaitGroup)) {
+    if(!counted.exchange(true)) {
+      group->settle(resolved());
+    }
+  }
+}
+
+void RequestResult::joinGroup(const std::shared_ptr<AwaitGroup>& group) {
+  counted.store(false);
+  std::atomic_store(&awaitGroup, group);
+  if(!pending() && !counted.exchange(true)) {
+    group->settle(resolved());
+  }
+}
+
+void RequestResult::count(SubRequestCounter counter) {
+  if(endpoint) {
+    endpoint->getMetrics().add(counter);
+  }
+  if(counter == SubRequestCounter::RESOLVED) {
+    Metrics::stopTiming(MetricsHistogram::SUB_REQUEST_RTT, issueTime);
+  }
+}
+
+void RequestResult::drain(Connection* const _subConnection, bool reusable) {
+  drained = true;
+  if(reusable) {
+    _subConnection->recycle();
+    Connector::insertIntoConnectionPool(_subConnection->thisConnection());
+    LOG(LogLevel::DEBUG, "[RequestResult][subConnection][fd %d] cancelled, subConnection recycled", _subConnection->get_fd());
+  } else {
+    _subConnection->terminate();
+  }
+}
+
+void RequestResult::resolve(Connection* const _subConnection, std::shared_ptr<Message> _message) {
+  if(claim()) {
     message = _message;
-    resultType = SubConnectionEventType::RESOLVED;
+    arena = nullptr;    // message holds it from now on
     resultDetail = ParseResult::PARSE_SUCCESS;
-    subConnection->resolve(masterConnection);
-    Connector::insertIntoConnectionPool(subConnection);
-    LOG(LogLevel::DEBUG, "[RequestResult][subConnection][fd %d] subConnection RESOLVED", subConnection->get_fd());
+    resultType = SubConnectionEventType::RESOLVED;
+    settle();
+    count(SubRequestCounter::RESOLVED);
+    _subConnection->resolve(masterConnection);
+    Connector::insertIntoConnectionPool(_subConnection->thisConnection());
+    LOG(LogLevel::DEBUG, "[RequestResult][subConnection][fd %d] subConnection RESOLVED", _subConnection->get_fd());
+  } else if(awaitingDrain()) {
+    drain(_subConnection, true);
   }
-  
 }
 
-void RequestResult::reject(ParseResult _resultDetail, std::shared_ptr<Message> _message) {
-  if(pending()) {
+void RequestResult::reject(Connection* const _subConnection, ParseResult _resultDetail, std::shared_ptr<Message> _message) {
+  if(claim()) {
     message = _message;
+    arena = nullptr;
+    resultDetail = _resultDetail;
     resultType = SubConnectionEventType::REJECTED;
+    settle();
+    count(_resultDetail == ParseResult::TIMEOUT ? SubRequestCounter::TIMED_OUT : SubRequestCounter::REJECTED);
+    _subConnection->reject(masterConnection);
+    LOG(LogLevel::DEBUG, "[RequestResult][subConnection][fd %d] subConnection REJECTED", _subConnection->get_fd());
+  } else if(awaitingDrain()) {
+    drain(_subConnection, false);
+  }
+}
+
+void RequestResult::resolveMultiplexed(std::shared_ptr<Connection> channelConnection, std::shared_ptr<Message> _message) {
+  if(claim()) {
+    message = _message;
+    arena = nullptr;
+    resultDetail = ParseResult::PARSE_SUCCESS;
+    resultType = SubConnectionEventType::RESOLVED;
+    settle();
+    count(SubRequestCounter::RESOLVED);
+    masterConnection->issueEvent(Event::makeSubConnectionEvent(masterConnection, 
+                                                               channelConnection ? channelConnection : masterConnection, 
+                                                               SubConnectionEventType::RESOLVED));
+  }
+}
+
+void RequestResult::rejectMultiplexed(std::shared_ptr<Connection> channelConnection, ParseResult _resultDetail) {
+  if(claim()) {
+    arena = nullptr;
     resultDetail = _resultDetail;
-    subConnection->reject(masterConnection);
-    LOG(LogLevel::DEBUG, "[RequestResult][subConnection][fd %d] subConnection REJECTED", subConnection->get_fd());
+    resultType = SubConnectionEventType::REJECTED;
+    settle();
+    count(_resultDetail == ParseResult::TIMEOUT ? SubRequestCounter::TIMED_OUT : SubRequestCounter::REJECTED);
+    masterConnection->issueEvent(Event::makeSubConnectionEvent(masterConnection, 
+                                                               channelConnection ? channelConnection : masterConnection, 
+                                                               SubConnectionEventType::REJECTED));
+  }
+}
+
+void RequestResult::cancel() {
+  if(claim()) {
+    arena = nullptr;
+    resultDetail = ParseResult::CANCELLED;
+    resultType = SubConnectionEventType::REJECTED;
+    settle();
+    count(SubRequestCounter::CANCELLED);
+    if(cancelHandler) {
+      cancelHandler();
+    }
+  }
+}
+
+
+// for class AwaitGroup
+std::shared_ptr<AwaitGroup> AwaitGroup::join(Connection* const masterConnection,
+                                             const std::vector<std::shared_ptr<RequestResult>>& requestResultList,
+                                             AwaitPolicy policy) {
+  auto group = std::make_shared<AwaitGroup>(policy, requestResultList.size());
+  for(auto &requestResult : requestResultList) {
+    requestResult->joinGroup(group);
+  }
+  if(policy.getType() == AwaitPolicyType::DEADLINE && !group->isMet()) {
+    std::weak_ptr<AwaitGroup> weakGroup = group;
+    group->deadlineEntry = masterConnection->setTimeout(policy.getDeadline(), [masterConnection, weakGroup]{
+      if(auto expiredGroup = weakGroup.lock()) {
+        expiredGroup->expired = true;
+        // checked like a settled sub request
+        auto connection = masterConnection->thisConnection();
+        masterConnection->issueEvent(Event::makeSubConnectionEvent(connection, connection, SubConnectionEventType::REJECTED));
+      }
+    });
+  }
+  return group;
+}
+
+bool AwaitGroup::isMet() {
+  size_t resolved = resolvedCount.load();
+  size_t rejected = rejectedCount.load();
+  if(resolved + rejected >= total) {
+    return true;
+  }
+  switch(policy.getType()) {
+    case AwaitPolicyType::QUORUM:
+      {
+        size_t quorum = policy.getQuorum() < total ? policy.getQuorum() : total;
+        return resolved >= quorum || rejected > total - quorum;
+      }
+
+    case AwaitPolicyType::DEADLINE:
+      return expired;
+
+    default:
+      return false;
+  }
+}
+
+bool AwaitGroup::tryComplete(Connection* const masterConnection, const std::vector<std::shared_ptr<RequestResult>>& requestResultList) {
+  if(completed || !isMet()) {
+    return false;
+  }
+  completed = true;
+  if(deadlineEntry) {
+    masterConnection->cancelTimeout(deadlineEntry);
+    deadlineEntry = nullptr;
+  }
+  for(auto &requestResult : requestResultList) {
+    if(requestResult->pending()) {
+      requestResult->cancel();
+    }
+  }
+  return true;
+}
+
+
+// for class MultiplexChannel
+std::atomic<uint32_t> MultiplexChannel::nextRequestId(1);
+
+void MultiplexChannel::connect() {
+  std::weak_ptr<MultiplexChannel> weakChannel = shared_from_this();
+  auto flushHandler = [weakChannel](Connection* const channelConnection) {
+    if(auto channel = weakChannel.lock()) {
+      channel->flushSendList(channelConnection);
+    }
+  };
+  connection = Connector::connectTo(
+    endpoint,
+    // onConnectedHandler, requests submitted while connecting sent at once
+    [flushHandler](Connection* const channelConnection) {
+      if(Connector::compactFraming.load()) {
+        channelConnection->setCompactFraming();
+      }
+      channelConnection->setOnWakeUpHandler(flushHandler);
+      flushHandler(channelConnection);
+    },
+    // onReceiveDataHandler
+    [weakChannel](Connection* const channelConnection) {
+      if(auto channel = weakChannel.lock()) {
+        channel->handleResponses(channelConnection);
+      }
+    },
+    // onDisconnectingHandler
+    [weakChannel](Connection* const channelConnection) {
+      if(auto channel = weakChannel.lock()) {
+        channel->handleClosed(channelConnection);
+      }
+    }
+  );
+}
+
+void MultiplexChannel::flushSendList(Connection* const channelConnection) {
+  std::vector<std::pair<uint32_t, std::shared_ptr<Message>>> readyList;
+  {
+    std::lock_guard<std::mutex> guard(mtx);
+    readyList.swap(sendList);
+  }
+  for(auto &request : readyList) {
+    channelConnection->writeMessage(request.second, request.first);
+  }
+}
+
+void MultiplexChannel::handleResponses(Connection* const channelConnection) {
+  while(channelConnection->isConnected()) {
+    ParseResult parseResult;
+    size_t sizeBefore = channelConnection->getInputBuffer()->size();
+    // on heap, the request a response belongs to is only known once decoded
+    auto message = channelConnection->decodeMessage(parseResult, nullptr);
+    if(parseResult == ParseResult::MESSAGE_INCOMPLETED) {
+      return;
+    }
+    if(parseResult != ParseResult::PARSE_SUCCESS && channelConnection->getInputBuffer()->size() == sizeBefore) {
+      // frame boundary lost, every pending request rejected by handleClosed()
+      LOG(LogLevel::ERROR, "[MultiplexChannel][fd %d] undecodable frame from %s:%d", channelConnection->get_fd(), endpoint->getIP().c_str(), endpoint->getPort());
+      channelConnection->shutdown();
+      return;
+    }
+    auto requestResult = takePending(channelConnection->getRequestId());
+    if(!requestResult) {
+      // timed out or cancelled already, or a backend not echoing request ids
+      LOG(LogLevel::DEBUG, "[MultiplexChannel][fd %d] response to unknown request id %u", channelConnection->get_fd(), channelConnection->getRequestId());
+      continue;
+    }
+    if(parseResult == ParseResult::PARSE_SUCCESS) {
+      requestResult->resolveMultiplexed(channelConnection->thisConnection(), message);
+    } else {
+      requestResult->rejectMultiplexed(channelConnection->thisConnection(), parseResult);
+    }
+  }
+}
+
+void MultiplexChannel::handleClosed(Connection* const channelConnection) {
+  std::unordered_map<uint32_t, PendingRequest> closedMap;
+  {
+    std::lock_guard<std::mutex> guard(mtx);
+    if(connection.get() == channelConnection) {
+      connection = nullptr;
+      sendList.clear();
+      closedMap.swap(pendingMap);
+    }
+  }
+  for(auto &pending : closedMap) {
+    pending.second.masterConnection->cancelTimeout(pending.second.timeoutEntry);
+    pending.second.requestResult->rejectMultiplexed(nullptr, ParseResult::CONNECTION_CLOSED_BY_PEER);
+  }
+}
+
+std::shared_ptr<RequestResult> MultiplexChannel::takePending(uint32_t requestId) {
+  PendingRequest pending;
+  {
+    std::lock_guard<std::mutex> guard(mtx);
+    auto iterator = pendingMap.find(requestId);
+    if(iterator == pendingMap.end()) {
+      return nullptr;
+    }
+    pending = std::move(iterator->second);
+    pendingMap.erase(iterator);
   }
+  // no entry left on the wheel until the timeout, a no-op if it is the one firing
+  pending.masterConnection->cancelTimeout(pending.timeoutEntry);
+  return pending.requestResult;
+}
+
+void MultiplexChannel::submit(std::shared_ptr<RequestResult> requestResult, 
+                              std::shared_ptr<Message> requestData, 
+                              std::shared_ptr<Connection> masterConnection, 
+                              std::chrono::milliseconds timeout) {
+  uint32_t requestId = nextRequestId.fetch_add(1);
+  if(requestId == 0) {
+    // wrapped around, 0 means not multiplexed
+    requestId = nextRequestId.fetch_add(1);
+  }
+
+  std::weak_ptr<MultiplexChannel> weakChannel = shared_from_this();
+  // the response, if any, is dropped as one to an unknown request id
+  requestResult->setCancelHandler([weakChannel, requestId]{
+    if(auto channel = weakChannel.lock()) {
+      channel->takePending(requestId);
+    }
+  });
+
+  // in the EventLoop of masterConnection, set before the request is pending,
+  // so the response, answered in the EventLoop of the channel, always finds it to cancel
+  auto timeoutEntry = masterConnection->setTimeout(timeout, [weakChannel, requestId]{
+    if(auto channel = weakChannel.lock()) {
+      if(auto timedOut = channel->takePending(requestId)) {
+        timedOut->rejectMultiplexed(nullptr, ParseResult::TIMEOUT);
+      }
+    }
+  });
+
+  std::shared_ptr<Connection> channelConnection;
+  {
+    std::lock_guard<std::mutex> guard(mtx);
+    if(!connection) {
+      connect();
+    }
+    channelConnection = connection;
+    if(channelConnection) {
+      pendingMap[requestId] = PendingRequest{requestResult, masterConnection, timeoutEntry};
+      sendList.emplace_back(requestId, requestData);
+    }
+  }
+  if(!channelConnection) {
+    masterConnection->cancelTimeout(timeoutEntry);
+    LOG(LogLevel::ERROR, "[MultiplexChannel] connect to %s:%d failed", endpoint->getIP().c_str(), endpoint->getPort());
+    requestResult->rejectMultiplexed(nullptr, ParseResult::CONNECTION_CLOSED_BY_PEER);
+    return;
+  }
+  requestResult->setSubConnection(channelConnection);
+  channelConnection->wakeUp();
 }
 
 
 // for class ActiveConnectionSet
 std::shared_ptr<Connection> ActiveConnectionSet::getConnection() {
-  if(connectionSet.empty()) {
-    return nullptr;
-  }
-  std::lock_guard<std::mutex> guard(mtx);
   while(!connectionSet.empty()) {
-    auto iterator = connectionSet.begin();
-    connectionSet.erase(iterator);
-    if((*iterator)->isConnected()) {
-      return *iterator;
+    auto connection = *connectionSet.begin();
+    connectionSet.erase(connectionSet.begin());
+    if(connection->isConnected()) {
+      return connection;
     }
   }
   return nullptr;
 }
 
 void ActiveConnectionSet::removeConnection(std::shared_ptr<Connection> connection) {
-  std::lock_guard<std::mutex> guard(mtx);
   auto iterator = connectionSet.find(connection);
   if(iterator != connectionSet.end()) {
     connectionSet.erase(iterator);
@@ -51,67 +350,90 @@ void ActiveConnectionSet::removeConnection(std::shared_ptr<Connection> connectio
 }
 
 void ActiveConnectionSet::insertConnection(std::shared_ptr<Connection> connection) {
-  std::lock_guard<std::mutex> guard(mtx);
   connectionSet.insert(connection);
 }
 
 
+// for class BackendEndpoint
+BackendEndpoint::BackendEndpoint(std::string _ip, short _port): ip(_ip), port(_port) {
+  ::memset(&address, 0, sizeof address);
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = ::inet_addr(ip.c_str()); 
+  address.sin_port = ::htons(port);
+  for(int index = 0; index < EVENT_LOOP_COUNT; index++) {
+    connectionPoolList.push_back(std::make_shared<ActiveConnectionSet>());
+  }
+}
+
+std::shared_ptr<MultiplexChannel> BackendEndpoint::getMultiplexChannel(size_t channelCount) {
+  std::lock_guard<std::mutex> guard(mtx);
+  if(multiplexChannelList.size() < channelCount) {
+    multiplexChannelList.push_back(std::make_shared<MultiplexChannel>(this));
+    return multiplexChannelList.back();
+  }
+  std::shared_ptr<MultiplexChannel> leastBusy;
+  size_t leastPendingCount = 0;
+  for(auto &channel : multiplexChannelList) {
+    size_t pendingCount = channel->getPendingCount();
+    if(!leastBusy || pendingCount < leastPendingCount) {
+      leastBusy = channel;
+      leastPendingCount = pendingCount;
+    }
+  }
+  return leastBusy;
+}
+
+
 // for class Connector
+std::atomic<bool> Connector::compactFraming(false);
+std::atomic<size_t> Connector::multiplexConnectionCount(0);
 std::mutex Connector::mtx;
-std::map< std::pair<std::string, short>, std::shared_ptr<ActiveConnectionSet> > Connector::activeConnectionPool; 
+std::map< std::pair<std::string, short>, std::shared_ptr<BackendEndpoint> > Connector::endpointMap;
 
-std::shared_ptr<Connection> Connector::getConnection( std::string ip, 
-                                                      short port, 
+std::shared_ptr<BackendEndpoint> Connector::getEndpoint(std::string ip, short port) {
+  std::lock_guard<std::mutex> guard(mtx);
+  auto &endpoint = endpointMap[std::pair<std::string,short>(ip, port)];
+  if(!endpoint) {
+    endpoint = std::shared_ptr<BackendEndpoint>(new BackendEndpoint(ip, port));
+  }
+  return endpoint;
+}
+
+std::vector<std::shared_ptr<BackendEndpoint>> Connector::getEndpointList() {
+  std::lock_guard<std::mutex> guard(mtx);
+  std::vector<std::shared_ptr<BackendEndpoint>> endpointList;
+  for(auto &entry : endpointMap) {
+    endpointList.push_back(entry.second);
+  }
+  return endpointList;
+}
+
+std::shared_ptr<Connection> Connector::getConnection( BackendEndpoint* const endpoint, 
+                                                      int loopIndex,
                                                       ConnectionHandler onConnectedHandler, 
                                                       ConnectionHandler onReceiveDataHandler, 
                                                       ConnectionHandler onDisconnectingHandler) {
 
-  if(auto connection = getConnectionPool(ip, port)->getConnection()) {
-    // found corresponding ActiveConnectionSet and fetch connection from pool
+  if(auto connection = endpoint->getConnectionPool(loopIndex)->getConnection()) {
+    // fetch connection from pool of this EventLoop
     connection->reInit(onConnectedHandler, onReceiveDataHandler, onDisconnectingHandler);
     return connection;
   } else {
-    return connectTo(ip, port, onConnectedHandler, onReceiveDataHandler, onDisconnectingHandler);
-  }
-}
-
-std::shared_ptr<ActiveConnectionSet> Connector::buildNewPool(std::string ip, short port) {
-    std::lock_guard<std::mutex> guard(mtx);
-    if(activeConnectionPool.find(std::pair<std::string,short>(ip, port)) != activeConnectionPool.end()) {
-      return getConnectionPool(ip, port);
-    } else {
-      auto connectionSet = std::make_shared<ActiveConnectionSet>();
-      activeConnectionPool[std::pair<std::string,short>(ip, port)] = connectionSet;
-      return connectionSet;
-    }
-}
-
-std::shared_ptr<ActiveConnectionSet> Connector::getConnectionPool(std::string ip, short port) {
-  auto iterator = activeConnectionPool.find(std::pair<std::string,short>(ip, port));
-  if(iterator != activeConnectionPool.end()) {
-    return (*iterator).second;
-  } else {
-    // have to build a new one 
-    return buildNewPool(ip, port);
+    return connectTo(endpoint, onConnectedHandler, onReceiveDataHandler, onDisconnectingHandler, loopIndex);
   }
 }
 
-std::shared_ptr<Connection> Connector::connectTo( std::string ip, 
-                                                  short port, 
+std::shared_ptr<Connection> Connector::connectTo( BackendEndpoint* const endpoint, 
                                                   ConnectionHandler onConnectedHandler, 
                                                   ConnectionHandler onReceiveDataHandler, 
-                                                  ConnectionHandler onDisconnectingHandler) {
+                                                  ConnectionHandler onDisconnectingHandler,
+                                                  int loopIndex) {
   int client_fd = ::socket(AF_INET, SOCK_STREAM, 0);
   FdCtrl::setNoneBlock(client_fd);
   FdCtrl::addFdFlag(client_fd, FD_CLOEXEC);
-  
-  struct sockaddr_in serverAddr;
-  ::memset(&serverAddr, 0, sizeof serverAddr);
-  serverAddr.sin_family = AF_INET;
-  serverAddr.sin_addr.s_addr = ::inet_addr(ip.c_str()); 
-  serverAddr.sin_port = ::htons(port);
 
-  int result = ::connect(client_fd, reinterpret_cast<struct sockaddr*>(&serverAddr), sizeof serverAddr);
+  const struct sockaddr_in& serverAddr = endpoint->getAddress();
+  int result = ::connect(client_fd, reinterpret_cast<const struct sockaddr*>(&serverAddr), sizeof serverAddr);
   
   LOG(LogLevel::DEBUG, "[Connector][fd %d][connect()] return: %d error: [%d]%s", client_fd, result, errno, ::strerror(errno));
   if(result == -1 && errno == EINPROGRESS) {
@@ -128,11 +450,15 @@ std::shared_ptr<Connection> Connector::connectTo( std::string ip,
                                                   onConnectedHandler,
                                                   onReceiveDataHandler,
                                                   onDisconnectingHandler );
-  connection->setServerInfo(ip, port);
+  connection->setServerInfo(endpoint->getIP(), endpoint->getPort());
   connection->setClientInfo("127.0.0.1");
+  connection->setEndpoint(endpoint);
+  if(loopIndex >= 0) {
+    connection->setLoopIndex(loopIndex);
+  }
 
   eventPoll->addConnection(connection);
-  eventPoll->addEventListener(client_fd, EventPoll::READ_EVENT | EventPoll::WRITE_EVENT); 
+  eventPoll->addEventListener(connection.get(), EventPoll::READ_EVENT | EventPoll::WRITE_EVENT); 
 
   return connection;
 }
@@ -142,21 +468,62 @@ std::shared_ptr<RequestResult> Connector::initSubRequest( std::string ip,
                                                           std::shared_ptr<Message> requestData, 
                                                           std::shared_ptr<Connection> masterConnection,
                                                           int timeoutSeconds) {
+  return initSubRequest(getEndpoint(ip, port), requestData, masterConnection, std::chrono::seconds(timeoutSeconds));
+}
+
+std::shared_ptr<RequestResult> Connector::initSubRequest( std::string ip, 
+                                                          short port, 
+                                                          std::shared_ptr<Message> requestData, 
+                                                          std::shared_ptr<Connection> masterConnection,
+                                                          std::chrono::milliseconds timeout) {
+  return initSubRequest(getEndpoint(ip, port), requestData, masterConnection, timeout);
+}
+
+std::shared_ptr<RequestResult> Connector::initSubRequest( const std::shared_ptr<BackendEndpoint>& endpoint, 
+                                                          std::shared_ptr<Message> requestData, 
+                                                          std::shared_ptr<Connection> masterConnection,
+                                                          int timeoutSeconds) {
+  return initSubRequest(endpoint, requestData, masterConnection, std::chrono::seconds(timeoutSeconds));
+}
+
+std::shared_ptr<RequestResult> Connector::initSubRequest( const std::shared_ptr<BackendEndpoint>& endpoint, 
+                                                          std::shared_ptr<Message> requestData, 
+                                                          std::shared_ptr<Connection> masterConnection,
+                                                          std::chrono::milliseconds timeout) {
   auto requestResult = std::make_shared<RequestResult>(masterConnection);
+  requestResult->endpoint = endpoint.get();
+  requestResult->issueTime = Metrics::startTiming();
+  endpoint->getMetrics().add(SubRequestCounter::ISSUED);
+  size_t channelCount = multiplexConnectionCount.load();
+  if(channelCount > 0) {
+    endpoint->getMultiplexChannel(channelCount)->submit(requestResult, requestData, masterConnection, timeout);
+    return requestResult;
+  }
   auto _subConnection = getConnection(
-    // connect to ip:port
-    ip, port, 
+    // connect to endpoint, in the EventLoop of masterConnection, 
+    // so the pool is only used by this thread and the result comes back without a cross-thread hop
+    endpoint.get(), masterConnection->getLoopIndex(),
     ////////////////////////
     // onConnectedHandler	//
     ////////////////////////
     [=](Connection* const subConnection) {		
+      if(requestResult->awaitingDrain()) {
+        // cancelled before connected, nothing sent
+        requestResult->drain(subConnection, true);
+        return;
+      }
       // send request data on connection established
+      if(compactFraming.load()) {
+        subConnection->setCompactFraming();
+      }
       subConnection->writeData(requestData);
-      // reject this request and shut down subconnection on timeout
-      subConnection->setTimeout(timeoutSeconds, [=]{
+      // reject this request and shut down subconnection on timeout, or give up draining a cancelled one
+      subConnection->setTimeout(timeout, [=]{
         if(requestResult->pending()) {
-          requestResult->reject(ParseResult::TIMEOUT);
+          requestResult->reject(subConnection, ParseResult::TIMEOUT);
           subConnection->terminate();
+        } else if(requestResult->awaitingDrain()) {
+          requestResult->drain(subConnection, false);
         }
       });
     }, 
@@ -165,13 +532,14 @@ std::shared_ptr<RequestResult> Connector::initSubRequest( std::string ip,
     //////////////////////////
     [=](Connection* const subConnection) {
       ParseResult parseResult;
-      std::shared_ptr<Message> responseData = subConnection->decodeMessage(parseResult);
+      // on the request arena of the master connection, freed along with its request
+      std::shared_ptr<Message> responseData = subConnection->decodeMessage(parseResult, requestResult->getArena());
       if(parseResult == ParseResult::PARSE_SUCCESS) {
         // store the reponse data and generate SubConnectionEvent to notify master connection
-        requestResult->resolve(responseData);
+        requestResult->resolve(subConnection, responseData);
       } else {
         if(parseResult != ParseResult::MESSAGE_INCOMPLETED) {
-          requestResult->reject(parseResult);
+          requestResult->reject(subConnection, parseResult);
         }
       }
     }, 
@@ -179,7 +547,7 @@ std::shared_ptr<RequestResult> Connector::initSubRequest( std::string ip,
     // onDisconnectingHandler	//
     ////////////////////////////
     [=](Connection* const subConnection) {
-      requestResult->reject(ParseResult::CONNECTION_CLOSED_BY_PEER);
+      requestResult->reject(subConnection, ParseResult::CONNECTION_CLOSED_BY_PEER);
     }
   );
   requestResult->setSubConnection(_subConnection);
@@ -188,9 +556,13 @@ std::shared_ptr<RequestResult> Connector::initSubRequest( std::string ip,
 }
 
 void Connector::removeFromConnectionPool(std::shared_ptr<Connection> connection) {
-  getConnectionPool(connection->getServerIP(), connection->getServerPort())->removeConnection(connection);
+  if(auto endpoint = connection->getEndpoint()) {
+    endpoint->getConnectionPool(connection->getLoopIndex())->removeConnection(connection);
+  }
 }
 
 void Connector::insertIntoConnectionPool(std::shared_ptr<Connection> connection) {
-  getConnectionPool(connection->getServerIP(), connection->getServerPort())->insertConnection(connection);
+  if(auto endpoint = connection->getEndpoint()) {
+    endpoint->getConnectionPool(connection->getLoopIndex())->insertConnection(connection);
+  }
 }
\ No newline at end of file
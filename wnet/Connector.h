@@ -1,40 +1,93 @@
 #pragma once
 
+#include <atomic>
 #include <cerrno>
+#include <chrono>
+#include <functional>
 #include <map>
 #include <memory>
 #include <mutex>
 #include <set>
 #include <string>
+#include <unordered_map>
 #include <utility>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
 #include <sys/socket.h>
 
+#include "AwaitPolicy.h"
 #include "Config.h"
 #include "Connection.h"
 #include "Event.h"
 #include "EventPoll.h"
 #include "FdCtrl.h"
 #include "Log.h"
+#include "Metrics.h"
 #include "Noncopyable.h"
 #include "ProtoBuf.h"
 #include "TimeoutManager.h"
 
 namespace wnet {
 
+class AwaitGroup;
+class BackendEndpoint;
+
 class RequestResult : public noncopyable {
+  friend class Connector;
+
   private:
     std::shared_ptr<Connection> masterConnection;
     std::shared_ptr<Connection> subConnection;
     std::shared_ptr<Message> message;
-    SubConnectionEventType resultType;
+    // set once, by whichever of response, rejection and cancellation claims it first, 
+    // resultType stored last so the other fields are complete once it is seen
+    std::atomic<bool> claimed;
+    std::atomic<SubConnectionEventType> resultType;
     ParseResult resultDetail;
+    // request arena of masterConnection, response decoded on it, held until resolved / rejected
+    std::shared_ptr<MessageArena> arena;
+
+    // await() in progress, counted into once settled
+    std::shared_ptr<AwaitGroup> awaitGroup;
+    std::atomic<bool> counted;
+
+    // multiplexed sub request, withdrawn from its channel on cancel()
+    std::function<void()> cancelHandler;
+    // cancelled, and its subconnection since recycled or terminated
+    bool drained;
+
+    // counted into, set by Connector when issued, issueTime 0 unless latency metrics enabled
+    BackendEndpoint* endpoint;
+    uint64_t issueTime;
+
+    bool claim() {
+      bool expected = false;
+      return claimed.compare_exchange_strong(expected, true);
+    }
+
+    // count into awaitGroup, once, by whichever of settling and joinGroup() sees the other
+    void settle();
+
+    // outcome counted into the metrics of endpoint, round trip recorded if resolved
+    void count(SubRequestCounter counter);
+
+    // response of a cancelled sub request dealt with, subconnection back to the pool if reusable, terminated otherwise
+    void drain(Connection* const _subConnection, bool reusable);
 
   public:
     RequestResult(std::shared_ptr<Connection> _masterConnection): masterConnection(_masterConnection),
                                                                   subConnection(nullptr),
                                                                   message(nullptr),
+                                                                  claimed(false),
                                                                   resultType(SubConnectionEventType::PENDING),
-                                                                  resultDetail(ParseResult::PARSING) {}
+                                                                  resultDetail(ParseResult::PARSING),
+                                                                  arena(_masterConnection->getRequestArena()),
+                                                                  awaitGroup(nullptr),
+                                                                  counted(false),
+                                                                  drained(false),
+                                                                  endpoint(nullptr),
+                                                                  issueTime(0) {}
 
     void setSubConnection(std::shared_ptr<Connection> _subConnection) {
       subConnection = _subConnection;
@@ -44,6 +97,10 @@ class RequestResult : public noncopyable {
       return subConnection;
     }
 
+    void setCancelHandler(std::function<void()> handler) {
+      cancelHandler = handler;
+    }
+
     bool pending() {
       return resultType == SubConnectionEventType::PENDING;
     }
@@ -56,6 +113,16 @@ class RequestResult : public noncopyable {
       return resultType == SubConnectionEventType::REJECTED;
     }
 
+    // rejected with ParseResult::CANCELLED, left out by the await() policy
+    bool cancelled() {
+      return rejected() && resultDetail == ParseResult::CANCELLED;
+    }
+
+    // cancelled, its subconnection still expecting the response
+    bool awaitingDrain() {
+      return cancelled() && !drained;
+    }
+
     ParseResult getResultDetail() {
       return resultDetail;
     }
@@ -64,14 +131,124 @@ class RequestResult : public noncopyable {
       return message;
     }
 
-    void resolve(std::shared_ptr<Message> _message);
+    // nullptr if masterConnection has no request arena
+    MessageArena* getArena() {
+      return arena.get();
+    }
+
+    void joinGroup(const std::shared_ptr<AwaitGroup>& group);
 
-    void reject(ParseResult _resultDetail, std::shared_ptr<Message> _message = nullptr);
+    // called in the EventLoop of the subconnection, which may run before setSubConnection(),
+    // so the subconnection is passed in rather than read from the member
+    void resolve(Connection* const _subConnection, std::shared_ptr<Message> _message);
+
+    void reject(Connection* const _subConnection, ParseResult _resultDetail, std::shared_ptr<Message> _message = nullptr);
+
+    // multiplexed sub request, channel connection kept open for the other requests on it,
+    // channelConnection nullptr if there is none ( e.g. timed out before connected )
+    void resolveMultiplexed(std::shared_ptr<Connection> channelConnection, std::shared_ptr<Message> _message);
+
+    void rejectMultiplexed(std::shared_ptr<Connection> channelConnection, ParseResult _resultDetail);
+
+    // in the EventLoop of masterConnection, rejected with ParseResult::CANCELLED if still pending,
+    // its subconnection returned to the pool once the response is drained, or its request withdrawn if multiplexed
+    void cancel();
 };
 
-class ActiveConnectionSet : public noncopyable {
+// sub requests of one await(), counted as they settle, so the policy is checked in O(1) instead of rescanning the list
+class AwaitGroup : public noncopyable {
   private:
+    const AwaitPolicy policy;
+    const size_t total;
+    // settled from the EventLoop of any subconnection
+    std::atomic<size_t> resolvedCount;
+    std::atomic<size_t> rejectedCount;
+
+    // in the EventLoop of the master connection only
+    bool expired;
+    bool completed;
+    std::shared_ptr<TimeoutEntry> deadlineEntry;
+
+  public:
+    AwaitGroup(AwaitPolicy _policy, size_t _total): policy(_policy),
+                                                    total(_total),
+                                                    resolvedCount(0),
+                                                    rejectedCount(0),
+                                                    expired(false),
+                                                    completed(false),
+                                                    deadlineEntry(nullptr) {}
+
+    // every sub request of requestResultList joined, deadline started if the policy has one
+    static std::shared_ptr<AwaitGroup> join(Connection* const masterConnection,
+                                            const std::vector<std::shared_ptr<RequestResult>>& requestResultList,
+                                            AwaitPolicy policy);
+
+    void settle(bool resolved) {
+      if(resolved) {
+        resolvedCount++;
+      } else {
+        rejectedCount++;
+      }
+    }
+
+    bool isMet();
+
+    // true once, the first time the policy is met, the sub requests still pending are cancelled then
+    bool tryComplete(Connection* const masterConnection, const std::vector<std::shared_ptr<RequestResult>>& requestResultList);
+};
+
+// one connection to a backend carrying many sub requests at once, every frame tagged with a request id
+// ( FrameTypeTable::MULTIPLEX_FRAME_TAG ), responses matched back to their RequestResult in any order,
+// the backend has to echo the request id ( Connection::getRequestId() / Connection::writeMessage() )
+class MultiplexChannel : public noncopyable, public std::enable_shared_from_this<MultiplexChannel> {
+  private:
+    BackendEndpoint* const endpoint;      // owns this channel
+
     std::mutex mtx;
+    std::shared_ptr<Connection> connection;     // nullptr until connecting, and again once closed
+    // handed over by master connections, written in the EventLoop of connection
+    std::vector<std::pair<uint32_t, std::shared_ptr<Message>>> sendList;
+    // sent or to be sent, not answered yet, timeoutEntry on the wheel of masterConnection until taken
+    struct PendingRequest {
+      std::shared_ptr<RequestResult> requestResult;
+      std::shared_ptr<Connection> masterConnection;
+      std::shared_ptr<TimeoutEntry> timeoutEntry;
+    };
+    std::unordered_map<uint32_t, PendingRequest> pendingMap;
+
+    static std::atomic<uint32_t> nextRequestId;
+
+    // with mtx locked
+    void connect();
+
+    // handlers of connection, called in its EventLoop
+    void flushSendList(Connection* const channelConnection);
+
+    void handleResponses(Connection* const channelConnection);
+
+    void handleClosed(Connection* const channelConnection);
+
+    // nullptr if answered, timed out or closed already, its timeout cancelled
+    std::shared_ptr<RequestResult> takePending(uint32_t requestId);
+
+  public:
+    MultiplexChannel(BackendEndpoint* const _endpoint): endpoint(_endpoint), connection(nullptr) {}
+
+    // called in the EventLoop of masterConnection, rejected on timeout by it as well
+    void submit(std::shared_ptr<RequestResult> requestResult, 
+                std::shared_ptr<Message> requestData, 
+                std::shared_ptr<Connection> masterConnection, 
+                std::chrono::milliseconds timeout);
+
+    size_t getPendingCount() {
+      std::lock_guard<std::mutex> guard(mtx);
+      return pendingMap.size();
+    }
+};
+
+// idle connections to one ip:port of one EventLoop, only touched in the thread of that EventLoop, so no lock
+class ActiveConnectionSet : public noncopyable {
+  private:
     std::set<std::shared_ptr<Connection>> connectionSet;
 
   public:
@@ -86,38 +263,129 @@ class ActiveConnectionSet : public noncopyable {
     void insertConnection(std::shared_ptr<Connection> connection);
 };
 
+// a backend server, interned by Connector::getEndpoint() and kept for the life of the process,
+// address resolved once and pools reached directly, so a sub request to it builds, hashes or compares no string
+class BackendEndpoint : public noncopyable {
+  friend class Connector;
+
+  private:
+    const std::string ip;
+    const short port;
+    struct sockaddr_in address;
+
+    // idle connections, one set per EventLoop
+    std::vector<std::shared_ptr<ActiveConnectionSet>> connectionPoolList;
+
+    SubRequestMetrics metrics;
+
+    // shared by every EventLoop
+    std::mutex mtx;
+    std::vector<std::shared_ptr<MultiplexChannel>> multiplexChannelList;
+
+    BackendEndpoint(std::string _ip, short _port);
+
+    // the least busy channel, opened up to channelCount
+    std::shared_ptr<MultiplexChannel> getMultiplexChannel(size_t channelCount);
+
+  public:
+    const std::string& getIP() {
+      return ip;
+    }
+
+    short getPort() {
+      return port;
+    }
+
+    const struct sockaddr_in& getAddress() {
+      return address;
+    }
+
+    SubRequestMetrics& getMetrics() {
+      return metrics;
+    }
+
+    // only used in the thread of EventLoop loopIndex
+    ActiveConnectionSet* getConnectionPool(int loopIndex) {
+      return connectionPoolList[loopIndex].get();
+    }
+};
+
 class Connector {
+  friend class MultiplexChannel;
+
   private:
+    static std::atomic<bool> compactFraming;
+
+    // channels per backend, 0 if sub requests hold a connection each
+    static std::atomic<size_t> multiplexConnectionCount;
+
+    // guards endpointMap
     static std::mutex mtx;
-    // [ [{ip, port} => [ connection,... ] ],... ]
+    // [ {ip, port} => endpoint,... ], never shrinks
     static std::map< 
-      std::pair<std::string, short>, std::shared_ptr<ActiveConnectionSet> 
-    > activeConnectionPool;     
+      std::pair<std::string, short>, std::shared_ptr<BackendEndpoint> 
+    > endpointMap;
 
-    static std::shared_ptr<Connection> getConnection( std::string ip, 
-                                                      short port, 
+    // pooled one of EventLoop loopIndex, or a new one pinned to it
+    static std::shared_ptr<Connection> getConnection( BackendEndpoint* const endpoint, 
+                                                      int loopIndex,
                                                       ConnectionHandler onConnectedHandler = nullptr, 
                                                       ConnectionHandler onReceiveDataHandler = nullptr, 
                                                       ConnectionHandler onDisconnectingHandler = nullptr);
 
-    static std::shared_ptr<ActiveConnectionSet> buildNewPool(std::string ip, short port);
-
-    static std::shared_ptr<ActiveConnectionSet> getConnectionPool(std::string ip, short port);
-
-    static std::shared_ptr<Connection> connectTo( std::string ip, 
-                                                  short port, 
+    // loopIndex -1 to leave it to the fd
+    static std::shared_ptr<Connection> connectTo( BackendEndpoint* const endpoint, 
                                                   ConnectionHandler onConnectedHandler = nullptr, 
                                                   ConnectionHandler onReceiveDataHandler = nullptr, 
-                                                  ConnectionHandler onDisconnectingHandler = nullptr);
+                                                  ConnectionHandler onDisconnectingHandler = nullptr,
+                                                  int loopIndex = -1);
 
   public:
+    // send sub requests in compact framing ( Connection::setCompactFraming() ), 
+    // only if every server requested understands it
+    static void setCompactFraming(bool enable = true) {
+      compactFraming.store(enable);
+    }
+
+    // carry sub requests over connectionCount shared connections per backend ( MultiplexChannel ) 
+    // instead of one connection each, only if every server requested echoes request ids, 0 to turn off
+    static void setMultiplexing(size_t connectionCount = MULTIPLEX_CONNECTION_COUNT) {
+      multiplexConnectionCount.store(connectionCount);
+    }
 
+    // the same endpoint every time for one ip:port, resolve once and keep it, 
+    // e.g. captured by the handlers sending sub requests to it
+    static std::shared_ptr<BackendEndpoint> getEndpoint(std::string ip, short port);
+
+    // every endpoint interned so far, e.g. for their metrics
+    static std::vector<std::shared_ptr<BackendEndpoint>> getEndpointList();
+
+    // looks up the endpoint of ip:port every call, prefer the overloads taking an endpoint on hot paths
     static std::shared_ptr<RequestResult> initSubRequest( std::string ip, 
                                                           short port, 
                                                           std::shared_ptr<Message> requestData, 
                                                           std::shared_ptr<Connection> masterConnection,
                                                           int timeoutSeconds = SUB_REQUEST_TIMEOUT_SECONDS);
 
+    // timeout rounded up to TIMER_RESOLUTION_MS
+    static std::shared_ptr<RequestResult> initSubRequest( std::string ip, 
+                                                          short port, 
+                                                          std::shared_ptr<Message> requestData, 
+                                                          std::shared_ptr<Connection> masterConnection,
+                                                          std::chrono::milliseconds timeout);
+
+    static std::shared_ptr<RequestResult> initSubRequest( const std::shared_ptr<BackendEndpoint>& endpoint, 
+                                                          std::shared_ptr<Message> requestData, 
+                                                          std::shared_ptr<Connection> masterConnection,
+                                                          int timeoutSeconds = SUB_REQUEST_TIMEOUT_SECONDS);
+
+    // timeout rounded up to TIMER_RESOLUTION_MS
+    static std::shared_ptr<RequestResult> initSubRequest( const std::shared_ptr<BackendEndpoint>& endpoint, 
+                                                          std::shared_ptr<Message> requestData, 
+                                                          std::shared_ptr<Connection> masterConnection,
+                                                          std::chrono::milliseconds timeout);
+
+    // both in the EventLoop of connection ( or once every EventLoop has stopped )
     static void removeFromConnectionPool(std::shared_ptr<Connection> connection);
 
     static void insertIntoConnectionPool(std::shared_ptr<Connection> connection);
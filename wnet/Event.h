@@ -1,6 +1,8 @@
 #pragma once
 
+#include <cstdint>
 #include <memory>
+#include <utility>
 
 #include "Log.h"
 
@@ -8,157 +10,137 @@ namespace wnet {
 
 class Connection;
 
-enum class IOEventType { 
-  READ_EVENT = 1, 
-  WRITE_EVENT, 
-  READ_AND_WRITE_EVENT 
+enum class IOEventType {
+  READ_EVENT = 1,
+  WRITE_EVENT,
+  READ_AND_WRITE_EVENT
 };
 
-class IOEvent {
-  private:
-    const int event_fd = -1;
-    IOEventType ioType;
-    std::shared_ptr<Connection> connection;
-
-  public:
-    IOEvent(int _event_fd, 
-            IOEventType _ioType, 
-            std::shared_ptr<Connection> _connection = nullptr): event_fd(_event_fd), 
-                                                                ioType(_ioType),
-                                                                connection(_connection) {}
-
-    ~IOEvent() {}
+enum class SubConnectionEventType {
+  PENDING = 1,
+  RESOLVED,
+  REJECTED
+};
 
-    int get_fd() {
-      return event_fd;
-    }
-    
-    IOEventType getEvent() {
-      return ioType;
-    }
+enum class ControlEventType {
+  SHUT_DOWN = 1
+};
 
-    std::shared_ptr<Connection> getConnection() {
-      return connection;
-    }
+enum class EventType {
+  IO_EVENT = 1,
+  TIMEOUT_EVENT,
+  SUBCONNECTION_EVENT,
+  CONTROL_EVENT
 };
 
-class TimeoutEvent {
+// value type, stored inline in EventQueue slots and moved around, never heap allocated
+// fields not used by an event type are left empty
+class Event {
   private:
-    const uint64_t expireTimes = 0;
+    EventType type;
 
-  public:
-    TimeoutEvent(uint64_t _expireTimes):expireTimes(_expireTimes) {}
+    // IOEventType / SubConnectionEventType / ControlEventType, according to type
+    int eventDetail;
 
-    ~TimeoutEvent() {}
+    // TIMEOUT_EVENT
+    uint64_t expireTimes;
 
-    uint64_t getExpireTimes() {
-      return expireTimes;
-    }
-};
-
-enum class SubConnectionEventType { 
-  PENDING = 1, 
-  RESOLVED, 
-  REJECTED 
-};
+    // IO_EVENT:            connection the event belongs to
+    // SUBCONNECTION_EVENT: master connection
+    std::shared_ptr<Connection> connection;
 
-class SubConnectionEvent {
-  private:
-    std::shared_ptr<Connection> masterConnection;
+    // SUBCONNECTION_EVENT: sub connection
     std::shared_ptr<Connection> subConnection;
-    SubConnectionEventType eventType;
 
-  public:
-    SubConnectionEvent( std::shared_ptr<Connection> _masterConnection,
-                        std::shared_ptr<Connection> _subConnection,
-                        SubConnectionEventType _eventType): masterConnection(_masterConnection),
-                                                            subConnection(_subConnection),
-                                                            eventType(_eventType) {}
+    // Metrics::now() when queued, 0 unless latency metrics enabled
+    uint64_t enqueueTime;
 
-    ~SubConnectionEvent() {}
+    Event(EventType _type,
+          int _eventDetail,
+          uint64_t _expireTimes = 0,
+          std::shared_ptr<Connection> _connection = nullptr,
+          std::shared_ptr<Connection> _subConnection = nullptr): type(_type),
+                                                                eventDetail(_eventDetail),
+                                                                expireTimes(_expireTimes),
+                                                                connection(std::move(_connection)),
+                                                                subConnection(std::move(_subConnection)),
+                                                                enqueueTime(0) {}
 
-    std::shared_ptr<Connection> getMasterConnection() {
-      return masterConnection;
+  public:
+    // empty event, only as a slot placeholder
+    Event(): type(EventType::CONTROL_EVENT),
+             eventDetail(0),
+             expireTimes(0),
+             enqueueTime(0) {}
+
+    static Event makeIOEvent(std::shared_ptr<Connection> _connection, IOEventType _ioType) {
+      return Event(EventType::IO_EVENT, static_cast<int>(_ioType), 0, std::move(_connection));
     }
 
-    std::shared_ptr<Connection> getSubConnection() {
-      return subConnection;
+    static Event makeTimeoutEvent(uint64_t _expireTimes) {
+      return Event(EventType::TIMEOUT_EVENT, 0, _expireTimes);
     }
 
-    SubConnectionEventType getEvent() {
-      return eventType;
+    static Event makeSubConnectionEvent(std::shared_ptr<Connection> _masterConnection,
+                                        std::shared_ptr<Connection> _subConnection,
+                                        SubConnectionEventType _eventType) {
+      return Event( EventType::SUBCONNECTION_EVENT,
+                    static_cast<int>(_eventType),
+                    0,
+                    std::move(_masterConnection),
+                    std::move(_subConnection));
     }
-};
 
-enum class ControlEventType { 
-  SHUT_DOWN = 1
-};
+    static Event makeControlEvent(ControlEventType _eventType) {
+      return Event(EventType::CONTROL_EVENT, static_cast<int>(_eventType));
+    }
 
-class ControlEvent {
-  private:
-    ControlEventType eventType;
+    EventType getType() const {
+      return type;
+    }
 
-  public:
-    ControlEvent(ControlEventType _eventType): eventType(_eventType) {}
+    // IO_EVENT
+    IOEventType getIOEvent() const {
+      return static_cast<IOEventType>(eventDetail);
+    }
 
-    ~ControlEvent() {}
+    // IO_EVENT
+    const std::shared_ptr<Connection>& getConnection() const {
+      return connection;
+    }
 
-    ControlEventType getEvent() {
-      return eventType;
+    // TIMEOUT_EVENT
+    uint64_t getExpireTimes() const {
+      return expireTimes;
     }
-};
 
-union EventDetail {
-  IOEvent*            ioEvent;
-  TimeoutEvent*       timeoutEvent;
-  SubConnectionEvent* subConnectionEvent;
-  ControlEvent*       controlEvent;
-};
+    // SUBCONNECTION_EVENT
+    SubConnectionEventType getSubConnectionEvent() const {
+      return static_cast<SubConnectionEventType>(eventDetail);
+    }
 
-enum class EventType { 
-  IO_EVENT = 1, 
-  TIMEOUT_EVENT, 
-  SUBCONNECTION_EVENT,
-  CONTROL_EVENT
-};
+    // SUBCONNECTION_EVENT
+    const std::shared_ptr<Connection>& getMasterConnection() const {
+      return connection;
+    }
 
-class Event {
-  private:
-    const EventType type;
-    EventDetail eventDetail;
+    // SUBCONNECTION_EVENT
+    const std::shared_ptr<Connection>& getSubConnection() const {
+      return subConnection;
+    }
 
-  public:
-    Event(EventType _type, EventDetail _eventDetail): type(_type), 
-                                                      eventDetail(_eventDetail) {} 
-
-    ~Event() {
-      switch(type) {
-        case EventType::IO_EVENT:
-          delete eventDetail.ioEvent;
-          break;
-          
-        case EventType::TIMEOUT_EVENT:
-          delete eventDetail.timeoutEvent;
-          break;
-
-        case EventType::SUBCONNECTION_EVENT:
-          delete eventDetail.subConnectionEvent;
-          break;
-
-        case EventType::CONTROL_EVENT:
-          delete eventDetail.controlEvent;
-          break;
-      }
-       
-    }  
-
-    EventType getType() {
-      return type;
+    void setEnqueueTime(uint64_t time) {
+      enqueueTime = time;
+    }
+
+    uint64_t getEnqueueTime() const {
+      return enqueueTime;
     }
 
-    EventDetail getEventDetail() {
-      return eventDetail;
+    // CONTROL_EVENT
+    ControlEventType getControlEvent() const {
+      return static_cast<ControlEventType>(eventDetail);
     }
 };
 
-}
\ No newline at end of file
+}
@@ -1,67 +1,298 @@
-
 #include "Connection.h"
 #include "Event.h"
 #include "EventLoop.h"
+#include "EventPoll.h"
 #include "EventQueue.h"
+#include "IOUring.h"
+#include "Metrics.h"
 #include "TimeoutManager.h"
+#include "Timer.h"
 
 using namespace wnet;
 
+thread_local int EventLoop::currentID = -1;
+
+EventLoop::EventLoop( int _id,
+                      std::shared_ptr<EventQueue> _queue,
+                      EventPoll* _eventPoll,
+                      ReactorMode _mode,
+                      IOBackend _backend): id(_id),
+                                           mode(_mode),
+                                           backend(_backend),
+                                           eventPoll(_eventPoll),
+                                           eventQueue(_queue) {
+  timeoutManager = std::make_shared<TimeoutManager>();
+
+  if(mode == ReactorMode::LOOP_PER_THREAD && backend == IOBackend::IO_URING) {
+    // eventfd and timerfd polled on the ring as well, submitted with the first wait in the thread of this EventLoop
+    ioUring = std::make_shared<IOUring>();
+    ioUring->pollReadable(eventQueue->get_fd(), CompletionType::WAKEUP);
+    timer = std::make_shared<Timer>();
+    timer_fd = timer->get_fd();
+    ioUring->pollReadable(timer_fd, CompletionType::TIMER);
+    timer->startTickTock();
+
+  } else if(mode == ReactorMode::LOOP_PER_THREAD) {
+    epoll_fd = ::epoll_create1(EPOLL_CLOEXEC);
+    if(epoll_fd == -1) {
+      LOG(LogLevel::FATAL, "[EventLoop][id %d][epoll_create1()] EventLoop initialize failed, error: [%d]%s", id, errno, ::strerror(errno));
+      ::exit(EXIT_FAILURE);
+    }
+
+    struct epoll_event epollEvent;
+    // wake up by events issued from other threads
+    epollEvent.data.u64 = static_cast<uint64_t>(eventQueue->get_fd());
+    epollEvent.events = EventPoll::READ_EVENT;
+    if(::epoll_ctl(epoll_fd, EPOLL_CTL_ADD, eventQueue->get_fd(), &epollEvent) == -1) {
+      LOG(LogLevel::FATAL, "[EventLoop][id %d][epoll_ctl()] register event queue failed, error: [%d]%s", id, errno, ::strerror(errno));
+      ::exit(EXIT_FAILURE);
+    }
+
+    // own timer, no TIMEOUT_EVENT broadcast from master thread
+    timer = std::make_shared<Timer>();
+    timer_fd = timer->get_fd();
+    epollEvent.data.u64 = static_cast<uint64_t>(timer_fd);
+    epollEvent.events = EventPoll::READ_EVENT;
+    if(::epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &epollEvent) == -1) {
+      LOG(LogLevel::FATAL, "[EventLoop][id %d][epoll_ctl()] register timer failed, error: [%d]%s", id, errno, ::strerror(errno));
+      ::exit(EXIT_FAILURE);
+    }
+    timer->startTickTock();
+  }
+}
+
+EventLoop::~EventLoop() {
+  LOG(LogLevel::DEBUG, "[EventLoop] destructing");
+  if(epoll_fd >= 0) {
+    ::close(epoll_fd);
+  }
+}
+
 void EventLoop::loop() {
+  currentID = id;
+  Metrics::bindThread(id);
+  if(ioUring) {
+    completionLoop();
+  } else if(mode == ReactorMode::LOOP_PER_THREAD) {
+    pollingLoop();
+  } else {
+    dispatchedLoop();
+  }
+}
+
+bool EventLoop::handleQueuedEvents() {
+  bool running = true;
+  Metrics::add(MetricsCounter::EVENTS_HANDLED, eventBatch.size());
+  for(auto &event : eventBatch) {
+    if(running) {
+      running = handleEvent(event);
+    }
+  }
+  eventBatch.clear();
+  return running;
+}
+
+void EventLoop::handleReadyConnections() {
+  readyBatch.swap(readyList);
+  for(auto &connection : readyBatch) {
+    connection->handleReadyEvent();
+  }
+  readyBatch.clear();
+}
+
+void EventLoop::dispatchedLoop() {
   while(true) {
-      // thread would be block when no events available to handle
-    auto event = eventQueue->fetchEvent();
-
-    switch(event->getType()) {
-      case EventType::IO_EVENT:
-        {
-          // LOG(LogLevel::DEBUG, "[EventLoop][id %d] handling IO_EVENT", id);
-          IOEvent* activeIoEvent = event->getEventDetail().ioEvent;
-          auto connection = activeIoEvent->getConnection();
-          LOG(LogLevel::DEBUG, "[EventLoop] loop id: %d, event_fd: %d, event: %d, start handling", id, connection->get_fd(), activeIoEvent->getEvent());
-          connection->handleEvent(event);
-          LOG(LogLevel::DEBUG, "[EventLoop] loop id: %d, event_fd: %d, event: %d, end handling", id, connection->get_fd(), activeIoEvent->getEvent());
-        }
-        break;
+    // thread would be block when no events available to handle, and no connection ready
+    if(readyList.empty()) {
+      eventQueue->fetchEvents(eventBatch);
+    } else {
+      eventQueue->tryFetchEvents(eventBatch);
+    }
+    if(!handleQueuedEvents()) {
+      return;
+    }
+    handleReadyConnections();
+  }
+}
+
+void EventLoop::pollingLoop() {
+  int queue_fd = eventQueue->get_fd();
+  while(true) {
+    // only sleep in epoll_wait() when nothing queued or ready, or events issued to self would wait for a timeout
+    int timeout = readyList.empty() && eventQueue->prepareWait() ? EPOLL_WAIT_TIMEOUT : 0;
+    int activeEventCount = ::epoll_wait(epoll_fd, readyEvents, MAX_READY_EVENT_PER_POLL, timeout);
+    eventQueue->finishWait();
+    if(activeEventCount > 0) {
+      Metrics::add(MetricsCounter::EVENTS_HANDLED, static_cast<uint64_t>(activeEventCount));
+    }
+
+    for(int i = 0; i < activeEventCount; ++i) {
+      uint64_t activeEventTag = readyEvents[i].data.u64;
+      int activeEvent_fd = ConnectionTable::tagToFd(activeEventTag);
+      int activeEvent = static_cast<int>(readyEvents[i].events);
+
+      if(activeEvent_fd == queue_fd) {
+        eventQueue->clearWakeup();
 
-      case EventType::TIMEOUT_EVENT:
-        {
-          // LOG(LogLevel::DEBUG, "[EventLoop][id %d] handling TIMEOUT_EVENT", id);
-          TimeoutEvent* activeTimeoutEvent = event->getEventDetail().timeoutEvent;
-          timeoutManager->tickTock(activeTimeoutEvent->getExpireTimes());
+      } else if(activeEvent_fd == timer_fd) {
+        timeoutManager->tickTock(timer->handle());
+
+      } else if(activeEvent_fd == acceptor_fd.load(std::memory_order_acquire)) {
+        // accepted connections stay on this EventLoop
+        eventPoll->handleNewConnection(id);
+
+      } else if(auto connection = eventPoll->getConnectionByTag(activeEventTag)) {
+        // handled inline, no Event constructed, no cross-thread hop
+        connection->handleIOEvent(EventPoll::toIOEventType(activeEvent));
+
+      } else {
+        LOG(LogLevel::ERROR, "[EventLoop][id %d] unable to get connection, probably disconnecting, fd: %d, event: %d", id, activeEvent_fd, activeEvent);
+      }
+    }
+
+    eventQueue->tryFetchEvents(eventBatch);
+    if(!handleQueuedEvents()) {
+      return;
+    }
+    handleReadyConnections();
+  }
+}
+
+void EventLoop::completionLoop() {
+  IOUring::Completion completion;
+  while(true) {
+    int listen_fd = acceptor_fd.load(std::memory_order_acquire);
+    if(listen_fd != accepting_fd) {
+      ioUring->accept(listen_fd);
+      accepting_fd = listen_fd;
+    }
+
+    // sends queued by the last pass go out in the same io_uring_enter() as the wait
+    int timeout = readyList.empty() && eventQueue->prepareWait() ? EPOLL_WAIT_TIMEOUT : 0;
+    ioUring->submitAndWait(timeout);
+    eventQueue->finishWait();
+
+    while(ioUring->nextCompletion(completion)) {
+      handleCompletion(completion);
+    }
+    completion.connection.reset();
+
+    eventQueue->tryFetchEvents(eventBatch);
+    if(!handleQueuedEvents()) {
+      return;
+    }
+    handleReadyConnections();
+  }
+}
+
+void EventLoop::handleCompletion(const IOUring::Completion& completion) {
+  Metrics::add(MetricsCounter::EVENTS_HANDLED);
+  switch(completion.type) {
+    case CompletionType::WAKEUP:
+      eventQueue->clearWakeup();
+      if(!completion.more) {
+        ioUring->pollReadable(eventQueue->get_fd(), CompletionType::WAKEUP);
+      }
+      break;
+
+    case CompletionType::TIMER:
+      timeoutManager->tickTock(timer->handle());
+      if(!completion.more) {
+        ioUring->pollReadable(timer_fd, CompletionType::TIMER);
+      }
+      break;
+
+    case CompletionType::ACCEPT:
+      if(completion.result >= 0) {
+        // accepted connections stay on this EventLoop
+        eventPoll->handleAcceptedConnection(id, completion.result);
+      } else {
+        // out of fds and the like, left to the accept4() path
+        eventPoll->handleNewConnection(id);
+      }
+      if(!completion.more) {
+        ioUring->accept(accepting_fd);
+      }
+      break;
+
+    case CompletionType::RECEIVE:
+      {
+        // multishot receive stops when provided buffers run out, armed again by the connection
+        if(auto connection = eventPoll->getConnectionByTag(completion.tag)) {
+          connection->handleReceiveCompletion(completion.data, completion.result, completion.more);
         }
-        break;
-
-      case EventType::SUBCONNECTION_EVENT:
-        {
-          SubConnectionEvent* activeSubConnectionEvent = event->getEventDetail().subConnectionEvent;
-          auto masterConnection = activeSubConnectionEvent->getMasterConnection();
-          timeoutManager->clockIn(masterConnection->getTimeoutEntry());
-          masterConnection->handleEvent(event);
+        ioUring->recycleBuffer(completion);
+      }
+      break;
+
+    case CompletionType::WRITABLE:
+      if(auto connection = eventPoll->getConnectionByTag(completion.tag)) {
+        connection->handleIOEvent(IOEventType::WRITE_EVENT);
+      }
+      break;
+
+    case CompletionType::SEND:
+      completion.connection->handleSendCompletion(completion.result);
+      break;
+
+    case CompletionType::CANCEL:
+      break;
+  }
+}
+
+bool EventLoop::handleEvent(const Event& event) {
+  Metrics::stopTiming(MetricsHistogram::QUEUE_WAIT, event.getEnqueueTime());
+  switch(event.getType()) {
+    case EventType::IO_EVENT:
+      {
+        // LOG(LogLevel::DEBUG, "[EventLoop][id %d] handling IO_EVENT", id);
+        auto &connection = event.getConnection();
+        if(ioUring && !connection->getIOUring()) {
+          // added from another thread, requests armed here, the ring is only touched by this thread
+          eventPoll->armIOUring(connection.get());
+          break;
         }
-        break;
-      
-      case EventType::CONTROL_EVENT:
-        {
-          ControlEvent* activeControlEvent = event->getEventDetail().controlEvent;
-          switch(activeControlEvent->getEvent()) {
-            case ControlEventType::SHUT_DOWN:
-              LOG(LogLevel::DEBUG, "[EventLoop][id %d] shutting down", id);
-              return;
-              break;
-
-            default:
-              LOG(LogLevel::FATAL, "[EventLoop][id %d] handling unsupported control event", id);
-              ::exit(EXIT_FAILURE);
-              break;
-          }
+        LOG(LogLevel::DEBUG, "[EventLoop] loop id: %d, event_fd: %d, event: %d, start handling", id, connection->get_fd(), event.getIOEvent());
+        connection->handleEvent(event);
+        LOG(LogLevel::DEBUG, "[EventLoop] loop id: %d, event_fd: %d, event: %d, end handling", id, connection->get_fd(), event.getIOEvent());
+      }
+      break;
+
+    case EventType::TIMEOUT_EVENT:
+      {
+        // LOG(LogLevel::DEBUG, "[EventLoop][id %d] handling TIMEOUT_EVENT", id);
+        timeoutManager->tickTock(event.getExpireTimes());
+      }
+      break;
+
+    case EventType::SUBCONNECTION_EVENT:
+      {
+        auto &masterConnection = event.getMasterConnection();
+        masterConnection->clockIn();
+        masterConnection->handleEvent(event);
+      }
+      break;
+    
+    case EventType::CONTROL_EVENT:
+      {
+        switch(event.getControlEvent()) {
+          case ControlEventType::SHUT_DOWN:
+            LOG(LogLevel::DEBUG, "[EventLoop][id %d] shutting down", id);
+            return false;
+            break;
+
+          default:
+            LOG(LogLevel::FATAL, "[EventLoop][id %d] handling unsupported control event", id);
+            ::exit(EXIT_FAILURE);
+            break;
         }
-        break;
+      }
+      break;
 
-      default:
-        LOG(LogLevel::FATAL, "[EventLoop][id %d] handling unsupported event", id);
-        ::exit(EXIT_FAILURE);
-        break;
-    }
+    default:
+      LOG(LogLevel::FATAL, "[EventLoop][id %d] handling unsupported event", id);
+      ::exit(EXIT_FAILURE);
+      break;
   }
+  return true;
 }
\ No newline at end of file
@@ -1,46 +1,135 @@
 #pragma once
 
+#include <atomic>
 #include <chrono>
 #include <memory>
 #include <thread>
+#include <vector>
+#include <sys/epoll.h>
 
 #include "Config.h"
+#include "Event.h"
+#include "IOUring.h"
 #include "Log.h"
 #include "Noncopyable.h"
 
 namespace wnet {
 
+class Connection;
+class EventPoll;
 class EventQueue;
+class IOUring;
 class TimeoutManager;
+class Timer;
+
+enum class ReactorMode {
+  MASTER_DISPATCH = 1,    // master thread polls every fd and dispatches events to EventLoops
+  LOOP_PER_THREAD         // every EventLoop polls its own fds and handles IO inline, master thread only accepts
+};
+
+enum class IOBackend {
+  EPOLL = 1,    // readiness from epoll_wait(), then read() / write() by the connection
+  IO_URING      // ReactorMode::LOOP_PER_THREAD only, every EventLoop accepts, receives and sends through its own io_uring,
+                // falls back to EPOLL if the kernel lacks support
+};
 
 class EventLoop : public noncopyable {
-  private: 
-    int id;  
+  private:
+    int id;
+    ReactorMode mode;
+    IOBackend backend;
+
+    // outlives every EventLoop, threads are joined before EventPoll is destructed
+    EventPoll* const eventPoll;
 
     std::shared_ptr<EventQueue> eventQueue;
     std::shared_ptr<TimeoutManager> timeoutManager;
 
+    // events drained from eventQueue in one pass, capacity reused between passes
+    std::vector<Event> eventBatch;
+
+    // connections still readable when their read budget ran out, a turn each after every pass, round robin,
+    // no waiting for new events while any is listed
+    std::vector<std::shared_ptr<Connection>> readyList;
+    std::vector<std::shared_ptr<Connection>> readyBatch;
+
+    // only for ReactorMode::LOOP_PER_THREAD
+    int epoll_fd = -1;
+    struct epoll_event readyEvents[MAX_READY_EVENT_PER_POLL];
+    int timer_fd = -1;
+    std::shared_ptr<Timer> timer;
+    std::atomic<int> acceptor_fd{-1};    // SO_REUSEPORT listen fd of this EventLoop, set by master thread
+
+    // only for IOBackend::IO_URING, in place of epoll_fd
+    std::shared_ptr<IOUring> ioUring;
+    int accepting_fd = -1;    // acceptor_fd multishot accept armed on
+
+    static thread_local int currentID;
+
+    // return false when shutting down
+    bool handleEvent(const Event& event);
+
+    // return false when shutting down
+    bool handleQueuedEvents();
+
+    // turns of the connections listed by the last pass, the ones still readable listed again for the next
+    void handleReadyConnections();
+
+    // ReactorMode::MASTER_DISPATCH, events come from EventQueue only
+    void dispatchedLoop();
+
+    // ReactorMode::LOOP_PER_THREAD, wait on own epoll fd, EventQueue wakes it up through eventfd
+    void pollingLoop();
+
+    // IOBackend::IO_URING, wait for completions of own io_uring, requests queued by the last pass submitted along
+    void completionLoop();
+
+    void handleCompletion(const IOUring::Completion& completion);
+
   public:
-    EventLoop(int _id, std::shared_ptr<EventQueue> _queue): id(_id), 
-                                                            eventQueue(_queue) {
-      timeoutManager = std::make_shared<TimeoutManager>();
-    }
+    EventLoop(int _id,
+              std::shared_ptr<EventQueue> _queue,
+              EventPoll* _eventPoll,
+              ReactorMode _mode = ReactorMode::MASTER_DISPATCH,
+              IOBackend _backend = IOBackend::EPOLL);
 
-    ~EventLoop() {
-      LOG(LogLevel::DEBUG, "[EventLoop] destructing");
-    }
+    ~EventLoop();
 
     int getID() {
       return id;
     }
-    
+
+    int getEpollFd() {
+      return epoll_fd;
+    }
+
+    // nullptr unless IOBackend::IO_URING, only used in the thread of this EventLoop
+    IOUring* getIOUring() {
+      return ioUring.get();
+    }
+
+    // id of the EventLoop running in the calling thread, -1 if none
+    static int getCurrentID() {
+      return currentID;
+    }
+
+    // only in the thread of this EventLoop ( EventPoll::addReadyConnection() )
+    void addReadyConnection(std::shared_ptr<Connection> connection) {
+      readyList.push_back(std::move(connection));
+    }
+
+    // set before the fd is registered to epoll_fd
+    void setAcceptorFd(int listen_fd) {
+      acceptor_fd.store(listen_fd, std::memory_order_release);
+    }
+
     std::shared_ptr<TimeoutManager> getTimeoutManager() {
       return timeoutManager;
     }
-    
+
     // work in separated thread, loop untill shut down
     void loop();
-    
+
 };
 
-}
\ No newline at end of file
+}
@@ -3,6 +3,8 @@
 #include "EventLoop.h"
 #include "EventPoll.h"
 #include "EventQueue.h"
+#include "IOUring.h"
+#include "Metrics.h"
 #include "TCPServer.h"
 #include "TimeoutManager.h"
 #include "Timer.h"
@@ -10,6 +12,14 @@
 using namespace wnet;
 
 EventPoll::EventPoll(): running(true) {
+  if(ioBackend == IOBackend::IO_URING && reactorMode != ReactorMode::LOOP_PER_THREAD) {
+    LOG(LogLevel::ERROR, "[EventPoll] io_uring backend requires ReactorMode::LOOP_PER_THREAD, using epoll");
+    ioBackend = IOBackend::EPOLL;
+  } else if(ioBackend == IOBackend::IO_URING && !IOUring::isSupported()) {
+    LOG(LogLevel::INFO, "[EventPoll] io_uring unsupported by the kernel, falling back to epoll");
+    ioBackend = IOBackend::EPOLL;
+  }
+
   // init EventPoll
   epoll_fd = ::epoll_create1(EPOLL_CLOEXEC);
   if(epoll_fd == -1) {
@@ -17,11 +27,13 @@ EventPoll::EventPoll(): running(true) {
     ::exit(EXIT_FAILURE);
   }
 
-  // init Timer
-  timer = std::make_shared<Timer>();
-  timer_fd = timer->get_fd();
-  addEventListener(timer_fd, EventPoll::READ_EVENT);
-  timer->startTickTock();
+  // init Timer, every EventLoop owns a timer in ReactorMode::LOOP_PER_THREAD
+  if(reactorMode == ReactorMode::MASTER_DISPATCH) {
+    timer = std::make_shared<Timer>();
+    timer_fd = timer->get_fd();
+    addEventListener(timer_fd, EventPoll::READ_EVENT);
+    timer->startTickTock();
+  }
 
   for(int index = 0; index < EVENT_LOOP_COUNT; index++) {
     // init EventQueue
@@ -29,9 +41,11 @@ EventPoll::EventPoll(): running(true) {
     eventQueueList.push_back(eventQueue);
 
     // init EventLoop
-    auto eventLoop = std::make_shared<EventLoop>(index, eventQueue);
+    auto eventLoop = std::make_shared<EventLoop>(index, eventQueue, this, reactorMode, ioBackend);
     eventLoopList.push_back(eventLoop);
+  }
 
+  for(auto eventLoop : eventLoopList) {
     // init EventLoop thread
     eventLoopThreadList.push_back(
       std::thread([=] {
@@ -42,21 +56,23 @@ EventPoll::EventPoll(): running(true) {
 }
 
 std::shared_ptr<EventLoop> EventPoll::getEventLoop(std::shared_ptr<Connection> connection) {
-  return eventLoopList[connection->get_fd() % EVENT_LOOP_COUNT];
+  return eventLoopList[connection->getLoopIndex()];
 }
 
-std::shared_ptr<EventQueue> EventPoll::getEventQueue(std::shared_ptr<Connection> connection) {
-  return eventQueueList[connection->get_fd() % EVENT_LOOP_COUNT];
+std::shared_ptr<EventQueue>& EventPoll::getEventQueue(const std::shared_ptr<Connection>& connection) {
+  return eventQueueList[connection->getLoopIndex()];
 }
 
-void EventPoll::broadcastEvent(std::shared_ptr<Event> event) {
-  for(auto eventQueue : eventQueueList) {   // broadcast this event to all EventLoop
+void EventPoll::broadcastEvent(const Event& event) {
+  for(auto &eventQueue : eventQueueList) {   // broadcast this event to all EventLoop
     eventQueue->addEvent(event);
   }
 }
 
 std::shared_ptr<EventPoll> EventPoll::thisPtr = nullptr;
 std::mutex EventPoll::mutx;
+ReactorMode EventPoll::reactorMode = ReactorMode::MASTER_DISPATCH;
+IOBackend EventPoll::ioBackend = IOBackend::EPOLL;
 // different threads share one file descriptor set
 // so only one EvevtPoll instance every process
 std::shared_ptr<EventPoll> EventPoll::getInstance() { 
@@ -69,8 +85,26 @@ std::shared_ptr<EventPoll> EventPoll::getInstance() {
   return thisPtr;
 }
 
+void EventPoll::setReactorMode(ReactorMode mode) {
+  std::lock_guard<std::mutex> guard(mutx);
+  if(thisPtr != nullptr && mode != reactorMode) {
+    LOG(LogLevel::ERROR, "[EventPoll] EventPoll already running, unable to switch reactor mode");
+    return;
+  }
+  reactorMode = mode;
+}
+
+void EventPoll::setIOBackend(IOBackend backend) {
+  std::lock_guard<std::mutex> guard(mutx);
+  if(thisPtr != nullptr && backend != ioBackend) {
+    LOG(LogLevel::ERROR, "[EventPoll] EventPoll already running, unable to switch io backend");
+    return;
+  }
+  ioBackend = backend;
+}
+
 void EventPoll::setServer(int _server_fd, std::shared_ptr<TCPServer> _server) {
-  if(server_fd >= 0) {
+  if(!server.expired()) {
     LOG(LogLevel::FATAL, "[EventPoll] set server failed, cannot set multiple servers");
     ::exit(EXIT_FAILURE);
   }
@@ -78,88 +112,170 @@ void EventPoll::setServer(int _server_fd, std::shared_ptr<TCPServer> _server) {
   server = _server;
 }
 
+void EventPoll::setMetricsFd(int _metrics_fd) {
+  metrics_fd = _metrics_fd;
+  addEventListener(metrics_fd, EventPoll::READ_EVENT, EventPoll::LEVEL_TRIGGER);
+}
+
+void EventPoll::addAcceptor(int loopIndex, int listen_fd) {
+  // EventLoop knows the fd before any event of it
+  eventLoopList[loopIndex]->setAcceptorFd(listen_fd);
+  if(ioBackend == IOBackend::EPOLL) {
+    epollCtrl(EPOLL_CTL_ADD, listen_fd, EventPoll::READ_EVENT | EventPoll::LEVEL_TRIGGER, loopIndex);
+  }
+  // with io_uring, the EventLoop arms multishot accept on it by itself
+}
+
+void EventPoll::handleNewConnection(int loopIndex) {
+  //////////////////////////////////
+  ///  new connection call back  ///
+  //////////////////////////////////
+  auto serverPtr = server.lock();
+  if (!serverPtr) {
+    LOG(LogLevel::FATAL, "[EventPoll] server ptr lost, unable to handle new connection, terminated");
+    ::exit(EXIT_FAILURE);
+  }
+  serverPtr->handleNewConnection(loopIndex);
+}
+
+void EventPoll::handleMetricsRequest() {
+  if(auto serverPtr = server.lock()) {
+    serverPtr->handleMetricsRequest();
+  }
+}
+
+void EventPoll::handleAcceptedConnection(int loopIndex, int connection_fd) {
+  auto serverPtr = server.lock();
+  if (!serverPtr) {
+    LOG(LogLevel::FATAL, "[EventPoll] server ptr lost, unable to handle new connection, terminated");
+    ::exit(EXIT_FAILURE);
+  }
+  serverPtr->handleAcceptedConnection(connection_fd, loopIndex);
+}
+
 void EventPoll::addConnection(std::shared_ptr<Connection> connection) {
-  connectionSet[connection->get_fd()] = connection;
-  LOG(LogLevel::INFO, "[EventPoll] holding %d connections", static_cast<int>(connectionSet.size()));
+  connectionTable.insert(connection->get_fd(), connection);
+  Metrics::add(MetricsCounter::CONNECTIONS_OPENED);
+  LOG(LogLevel::DEBUG, "[EventPoll] holding %d connections", connectionTable.size());
+}
+
+void EventPoll::addEventListener(Connection* const connection, int event, int triggerMode) {
+  if(ioBackend == IOBackend::IO_URING) {
+    if(EventLoop::getCurrentID() == connection->getLoopIndex()) {
+      armIOUring(connection);
+    } else {
+      // armed once the event gets to its EventLoop
+      connection->issueIOEventToSelf(IOEventType::WRITE_EVENT);
+    }
+    return;
+  }
+  epollCtrl(EPOLL_CTL_ADD, connection->get_fd(), event | triggerMode, connection->getLoopIndex());
+}
+
+bool EventPoll::addReadyConnection(std::shared_ptr<Connection> connection) {
+  int loopIndex = connection->getLoopIndex();
+  if(EventLoop::getCurrentID() != loopIndex) {
+    return false;
+  }
+  eventLoopList[loopIndex]->addReadyConnection(std::move(connection));
+  return true;
+}
+
+void EventPoll::armIOUring(Connection* const connection) {
+  int connection_fd = connection->get_fd();
+  if(getConnection(connection_fd).get() != connection) {
+    return;   // terminated before armed, the fd may belong to another connection by now
+  }
+  IOUring* ioUring = eventLoopList[connection->getLoopIndex()]->getIOUring();
+  uint64_t tag = connectionTable.getTag(connection_fd);
+  connection->setIOUring(ioUring, tag);
+  // once connected, for an active connection, receive armed by the first process() then
+  ioUring->pollWritable(tag, connection_fd);
+}
+
+void EventPoll::removeEventListener(Connection* const connection) {
+  if(ioBackend == IOBackend::IO_URING) {
+    if(IOUring* ioUring = connection->getIOUring()) {
+      ioUring->cancel(connection->get_fd());
+    }
+    return;
+  }
+  epollCtrl(EPOLL_CTL_DEL, connection->get_fd(), 0, connection->getLoopIndex());
+}
+
+void EventPoll::updateEventListener(Connection* const connection, int event, int triggerMode) {
+  if(ioBackend == IOBackend::IO_URING) {
+    return;   // receiving all along, sends complete by themselves
+  }
+  epollCtrl(EPOLL_CTL_MOD, connection->get_fd(), event | triggerMode, connection->getLoopIndex());
 }
 
 std::shared_ptr<Connection> EventPoll::getConnection(int connection_fd) {
-  if(running && connectionSet.find(connection_fd) != connectionSet.end()) {
-    return connectionSet[connection_fd];
+  if(running) {
+    return connectionTable.get(connection_fd);
+  } else {
+    return nullptr;
+  }
+}
+
+std::shared_ptr<Connection> EventPoll::getConnectionByTag(uint64_t tag) {
+  if(running) {
+    return connectionTable.getByTag(tag);
   } else {
     return nullptr;
   }
 }
 
 void EventPoll::removeConnection(int connection_fd) {
-  // must only call after closing connection fd or reomved from epoll
-  auto iterator = connectionSet.find(connection_fd);
-  if(iterator != connectionSet.end()) {
-    connectionSet.erase(iterator);
-  } 
+  // must only call after reomved from epoll and before closing connection fd, 
+  // or the fd may be reused by a new connection whose slot is emptied by mistake
+  connectionTable.remove(connection_fd);
+  Metrics::add(MetricsCounter::CONNECTIONS_CLOSED);
 }
 
 void EventPoll::connectionIniIdleTimeout(std::shared_ptr<Connection> connection) {
   if(running) {
     // connection will automaticly shutdown after certain length of idle time
-    getEventLoop(connection)->getTimeoutManager()->clockIn(connection->setTimeoutEntry());
+    auto timeoutManager = getEventLoop(connection)->getTimeoutManager();
+    connection->setIdleTimeout(
+      timeoutManager, 
+      timeoutManager->setIdleTimeout(std::chrono::milliseconds(CONNECTION_IDLE_TIMEOUT_MS), connection)
+    );
   }
 }
 
-void EventPoll::connectionClockIn(std::shared_ptr<Connection> connection) {
-  if(running) {
-    // works only when connection constructed with idle timeout initiated ( connectionIniIdleTimeout() )
-    getEventLoop(connection)->getTimeoutManager()->clockIn(connection->getTimeoutEntry());
-  }
+std::shared_ptr<TimeoutEntry> EventPoll::setTimeout( std::chrono::milliseconds timeout, 
+                                                      std::shared_ptr<Connection> connection, 
+                                                      std::function<void()> timeoutHandler) {
+  return getEventLoop(connection)->getTimeoutManager()->setTimeout(timeout, connection, timeoutHandler);
 }
 
-void EventPoll::setTimeout( int seconds, 
-                            std::shared_ptr<Connection> connection, 
-                            std::function<void()> timeoutHandler) {
-  getEventLoop(connection)->getTimeoutManager()->setTimeout(seconds, connection, timeoutHandler);
+void EventPoll::cancelTimeout(std::shared_ptr<Connection> connection, const std::shared_ptr<TimeoutEntry>& entry) {
+  getEventLoop(connection)->getTimeoutManager()->cancel(entry);
 }
 
 void EventPoll::poll() {
   int activeEventCount = ::epoll_wait(epoll_fd, readyEvents, MAX_READY_EVENT_PER_POLL, EPOLL_WAIT_TIMEOUT);
-  EventDetail detail;
-
   for(int i = 0; i < activeEventCount && running; ++i) {
-    int activeEvent_fd = readyEvents[i].data.fd;
-    int activeEvent = readyEvents[i].events;
+    uint64_t activeEventTag = readyEvents[i].data.u64;
+    int activeEvent_fd = ConnectionTable::tagToFd(activeEventTag);
+    int activeEvent = static_cast<int>(readyEvents[i].events);
 
     if(activeEvent_fd == timer_fd) {
       // timeout event triggered, dispatch to every eventloop
-      detail.timeoutEvent = new TimeoutEvent(timer->handle());
-      eventDispatcher(std::make_shared<Event>(EventType::TIMEOUT_EVENT, detail));
+      eventDispatcher(Event::makeTimeoutEvent(timer->handle()));
       
     } else if(server_fd >= 0 && activeEvent_fd == server_fd) {
-      //////////////////////////////////
-      ///  new connection call back  ///
-      //////////////////////////////////
-      auto serverPtr = server.lock();
-      if (!serverPtr) {
-        LOG(LogLevel::FATAL, "[EventPoll] server ptr lost, unable to handle new connection, terminated");
-        ::exit(EXIT_FAILURE);
-      }
-      serverPtr->handleNewConnection();
+      handleNewConnection(-1);
       
+    } else if(metrics_fd >= 0 && activeEvent_fd == metrics_fd) {
+      handleMetricsRequest();
+
     } else if((activeEvent & EventPoll::READ_EVENT) || (activeEvent & EventPoll::WRITE_EVENT)) {
       LOG(LogLevel::DEBUG, "[EventPoll] IO_EVENT actived, passing to eventloop");
-      if(auto connection = getConnection(activeEvent_fd)) {
-        IOEventType type;
-        if(activeEvent & EventPoll::READ_EVENT) {
-          type = IOEventType::READ_EVENT;
-        }
-        if(activeEvent & EventPoll::WRITE_EVENT) {
-          type = IOEventType::WRITE_EVENT;
-        }
-        if((activeEvent & EventPoll::READ_EVENT) && (activeEvent & EventPoll::WRITE_EVENT)) {
-          type = IOEventType::READ_AND_WRITE_EVENT;
-        }
-        
-        detail.ioEvent = new IOEvent(activeEvent_fd, type, connection);
-        eventDispatcher(std::make_shared<Event>(EventType::IO_EVENT, detail));
-        
+      if(auto connection = getConnectionByTag(activeEventTag)) {
+        eventDispatcher(Event::makeIOEvent(std::move(connection), toIOEventType(activeEvent)));
+
       } else {
         LOG(LogLevel::ERROR, "[EventPoll] unable to get connection, probably disconnecting, fd: %d, event: %d", activeEvent_fd, activeEvent);
       }
@@ -170,13 +286,14 @@ void EventPoll::poll() {
   }
 }
 
-void EventPoll::eventDispatcher(std::shared_ptr<Event> event) {
+void EventPoll::eventDispatcher(Event event) {
   if(running) {
-    switch(event->getType()) {
+    switch(event.getType()) {
       case EventType::IO_EVENT:
         {
-          IOEvent* activeIoEvent = event->getEventDetail().ioEvent;
-          getEventQueue(activeIoEvent->getConnection())->addEvent(event);
+          // look up the queue before event is moved from
+          auto &eventQueue = getEventQueue(event.getConnection());
+          eventQueue->addEvent(std::move(event));
         }
         break;
 
@@ -186,15 +303,13 @@ void EventPoll::eventDispatcher(std::shared_ptr<Event> event) {
 
       case EventType::SUBCONNECTION_EVENT:
         {
-          SubConnectionEvent* activeSubConnectionEvent = event->getEventDetail().subConnectionEvent;
-          getEventQueue(activeSubConnectionEvent->getMasterConnection())->addEvent(event);
+          auto &eventQueue = getEventQueue(event.getMasterConnection());
+          eventQueue->addEvent(std::move(event));
         }
         break;
 
       case EventType::CONTROL_EVENT:
-        {
-          broadcastEvent(event);
-        }
+        broadcastEvent(event);
         break;
 
       default:
@@ -206,19 +321,25 @@ void EventPoll::eventDispatcher(std::shared_ptr<Event> event) {
 }
 
 void EventPoll::shutdown() {
-  EventDetail detail;
-  detail.controlEvent = new ControlEvent(ControlEventType::SHUT_DOWN);
-  eventDispatcher(std::make_shared<Event>(EventType::CONTROL_EVENT, detail));
+  eventDispatcher(Event::makeControlEvent(ControlEventType::SHUT_DOWN));
 
   running = false;
-  eventLoopList.clear();
-  eventQueueList.clear();
 
   for(auto &thread : eventLoopThreadList) {
     thread.join();
   }
-  
-  connectionSet.clear();
+
+  // terminate remaining connections while EventLoops (and their epoll fds) still exist,
+  // instead of leaving it to ~Connection() where shared_from_this() is no longer available
+  std::vector<std::shared_ptr<Connection>> remainingConnections;
+  connectionTable.clear(remainingConnections);
+  for(auto &remainingConnection : remainingConnections) {
+    remainingConnection->terminate();
+  }
+  remainingConnections.clear();
+
+  eventLoopList.clear();
+  eventQueueList.clear();
   thisPtr = nullptr;
   LOG(LogLevel::DEBUG, "[EventPoll] shut down");
 }
\ No newline at end of file
@@ -1,8 +1,10 @@
 #pragma once
 
+#include <atomic>
 #include <cerrno>
+#include <chrono>
 #include <cstdlib>
-#include <map>
+#include <functional>
 #include <memory>
 #include <mutex>
 #include <thread>
@@ -11,45 +13,62 @@
 #include <unistd.h>
 
 #include "Config.h"
+#include "ConnectionTable.h"
+#include "Event.h"
+#include "EventLoop.h"
 #include "Log.h"
 #include "Noncopyable.h"
 
 namespace wnet {
 
 class Connection;
-class Event;
-class EventLoop;
 class EventQueue;
 class TCPServer;
+class TimeoutEntry;
 class Timer;
 
 class EventPoll : public noncopyable, public std::enable_shared_from_this<EventPoll> {
 	private:
 		int epoll_fd;
 		struct epoll_event readyEvents[MAX_READY_EVENT_PER_POLL];
-		bool running = false;
+		// cleared by shutdown() from the master thread, read by every EventLoop thread
+		std::atomic<bool> running{false};
 
 		// different threads share one file descriptor set
 		// so only one EvevtPoll instance every process
 		static std::shared_ptr<EventPoll> thisPtr;
 		static std::mutex mutx;
+		static ReactorMode reactorMode;
+		static IOBackend ioBackend;
 
 		int server_fd = -1;
 		std::weak_ptr<TCPServer> server;
 
+		// admin port of the server, polled by the master thread
+		int metrics_fd = -1;
+
 		int timer_fd = -1;
 		std::shared_ptr<Timer> timer;
 
-		std::map<int, std::shared_ptr<Connection>> connectionSet;   // connection fd => Connection ptr
+		ConnectionTable connectionTable;   // connection fd => Connection ptr
 		std::vector<std::shared_ptr<EventQueue>> eventQueueList; 
 		std::vector<std::shared_ptr<EventLoop>> eventLoopList; 
 		std::vector<std::thread> eventLoopThreadList;   
 
-		void epollCtrl(int operation, int event_fd, int event) {
+		// ReactorMode::LOOP_PER_THREAD, connection fds are registered to epoll fd of their own EventLoop,
+		// loopIndex -1 for fds of the master thread ( server fd, timer fd )
+		int getEpollFd(int loopIndex) {
+			if(reactorMode == ReactorMode::LOOP_PER_THREAD && loopIndex >= 0) {
+				return eventLoopList[loopIndex]->getEpollFd();
+			}
+			return epoll_fd;
+		}
+
+		void epollCtrl(int operation, int event_fd, int event, int loopIndex = -1) {
 			struct epoll_event epollEvent;
-			epollEvent.data.fd = event_fd;
+			epollEvent.data.u64 = connectionTable.getTag(event_fd);		// { generation, fd }, see ConnectionTable
 			epollEvent.events = event;
-			if(::epoll_ctl(epoll_fd, operation, event_fd, &epollEvent) == -1) {
+			if(::epoll_ctl(getEpollFd(loopIndex), operation, event_fd, &epollEvent) == -1) {
 				LOG(LogLevel::FATAL, "[EventPoll][fd %d][epoll_ctl()] edit fd event register failed, event: %d, error: [%d]%s", event_fd, event, errno, ::strerror(errno));
 				::exit(EXIT_FAILURE);
 			}
@@ -59,9 +78,9 @@ class EventPoll : public noncopyable, public std::enable_shared_from_this<EventP
 		
 		std::shared_ptr<EventLoop> getEventLoop(std::shared_ptr<Connection> connection);
 
-		std::shared_ptr<EventQueue> getEventQueue(std::shared_ptr<Connection> connection);
+		std::shared_ptr<EventQueue>& getEventQueue(const std::shared_ptr<Connection>& connection);
 
-		void broadcastEvent(std::shared_ptr<Event> event);
+		void broadcastEvent(const Event& event);
 
 	public: 
 		static const int READ_EVENT    = EPOLLIN ;
@@ -73,13 +92,59 @@ class EventPoll : public noncopyable, public std::enable_shared_from_this<EventP
 		// so only one EvevtPoll instance every process
 		static std::shared_ptr<EventPoll> getInstance();
 
+		// must be called before the first getInstance()
+		static void setReactorMode(ReactorMode mode);
+
+		static ReactorMode getReactorMode() {
+			return reactorMode;
+		}
+
+		// must be called before the first getInstance(), IOBackend::IO_URING with ReactorMode::LOOP_PER_THREAD only
+		static void setIOBackend(IOBackend backend);
+
+		// the one in use, IOBackend::EPOLL if io_uring was asked for but is unsupported
+		static IOBackend getIOBackend() {
+			return ioBackend;
+		}
+
+		static IOEventType toIOEventType(int activeEvent) {
+			if((activeEvent & EventPoll::READ_EVENT) && !(activeEvent & EventPoll::WRITE_EVENT)) {
+				return IOEventType::READ_EVENT;
+			}
+			if(!(activeEvent & EventPoll::READ_EVENT) && (activeEvent & EventPoll::WRITE_EVENT)) {
+				return IOEventType::WRITE_EVENT;
+			}
+			// both, or EPOLLERR / EPOLLHUP only, let read() and write() find out
+			return IOEventType::READ_AND_WRITE_EVENT;
+		}
+
 		~EventPoll() {
   		LOG(LogLevel::DEBUG, "[EventPoll] destructing");
 			::close(epoll_fd);
 		}
 
+		// _server_fd -1 if the server accepts in EventLoops only ( addAcceptor() )
 		void setServer(int _server_fd, std::shared_ptr<TCPServer> _server);
 
+		// listen fd of the metrics admin port ( TCPServer::setMetricsPort() ), LT triggered
+		void setMetricsFd(int _metrics_fd);
+
+		// metrics fd readable
+		void handleMetricsRequest();
+
+		// ReactorMode::LOOP_PER_THREAD, listen fd polled by the EventLoop, which accepts on it itself
+		void addAcceptor(int loopIndex, int listen_fd);
+
+		// listen fd readable, loopIndex -1 for the one of the master thread
+		void handleNewConnection(int loopIndex);
+
+		// IOBackend::IO_URING, connection_fd accepted by the multishot accept of EventLoop loopIndex
+		void handleAcceptedConnection(int loopIndex, int connection_fd);
+
+		// onto the ready list of its EventLoop, only from that EventLoop, return false otherwise
+		bool addReadyConnection(std::shared_ptr<Connection> connection);
+
+		// fds of the master thread
     void addEventListener(int event_fd, int event, int triggerMode = EDGE_TRIGGER) {
       epollCtrl(EPOLL_CTL_ADD, event_fd, event | triggerMode);
     };
@@ -92,25 +157,41 @@ class EventPoll : public noncopyable, public std::enable_shared_from_this<EventP
       epollCtrl(EPOLL_CTL_MOD, event_fd, event | triggerMode);
     };
 
+		// connection fds, registered according to Connection::getLoopIndex(),
+		// with IOBackend::IO_URING receiving and the first writable completion are armed instead, event ignored
+		void addEventListener(Connection* const connection, int event, int triggerMode = EDGE_TRIGGER);
+
+		// IOBackend::IO_URING, in the thread of the EventLoop of connection
+		void armIOUring(Connection* const connection);
+
+		void removeEventListener(Connection* const connection);
+
+		void updateEventListener(Connection* const connection, int event, int triggerMode = EDGE_TRIGGER);
+
 		void addConnection(std::shared_ptr<Connection> connection);	
 
 		std::shared_ptr<Connection> getConnection(int connection_fd);
 
+		// tag from epoll_event.data.u64, nullptr if the connection is gone or the fd has been reused since registered
+		std::shared_ptr<Connection> getConnectionByTag(uint64_t tag);
+
 		void removeConnection(int connection_fd);
 
 		int getConnectionCount() {
-			return static_cast<int>(connectionSet.size());
+			return connectionTable.size();
 		}
 
 		void connectionIniIdleTimeout(std::shared_ptr<Connection> connection);
 
-		void connectionClockIn(std::shared_ptr<Connection> connection);
+		std::shared_ptr<TimeoutEntry> setTimeout(	std::chrono::milliseconds timeout, 
+																							std::shared_ptr<Connection> connection, 
+																							std::function<void()> timeoutHandler);
 
-		void setTimeout( int seconds, std::shared_ptr<Connection> connection, std::function<void()> timeoutHandler);
+		void cancelTimeout(std::shared_ptr<Connection> connection, const std::shared_ptr<TimeoutEntry>& entry);
 
 		void poll();
 
-		void eventDispatcher(std::shared_ptr<Event> event);
+		void eventDispatcher(Event event);
 
 		void shutdown();
 
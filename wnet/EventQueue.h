@@ -1,39 +1,193 @@
 #pragma once
 
+#include <atomic>
+#include <cerrno>
 #include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
 #include <memory>
 #include <mutex>
 #include <queue>
+#include <thread>
+#include <vector>
+#include <sys/eventfd.h>
+#include <unistd.h>
 
+#include "Config.h"
+#include "Event.h"
 #include "Log.h"
+#include "MPSCQueue.h"
+#include "Metrics.h"
 #include "Noncopyable.h"
 
 namespace wnet {
 
-class Event;
-
+// lock-free multi-producer / single-consumer event queue
+// master thread and worker threads add events, only the owner EventLoop fetches them,
+// the consumer drains every pending event in one pass and parks on an eventfd only when the queue is really empty
 class EventQueue : public noncopyable {
-  private: 
+  private:
     int id; // for debug
-    std::queue<std::shared_ptr<Event>> queue;   
-    std::mutex mutex;
-    std::condition_variable condVar;
+    MPSCQueue<Event> queue;
+
+    // ring is full (consumer far behind or producing to itself), fall back to a locked list
+    // instead of spinning, so an EventLoop adding events to its own queue never deadlocks
+    std::atomic<size_t> overflowCount;
+    std::mutex overflowMutex;
+    std::deque<Event> overflowQueue;
+
+    int wakeup_fd = -1;
+    std::atomic<bool> waiting;
+
+    void wakeup() {
+      uint64_t one = 1;
+      if(::write(wakeup_fd, &one, sizeof one) != sizeof one && errno != EAGAIN) {
+        LOG(LogLevel::ERROR, "[EventQueue][id %d][write()] wake up consumer failed, error: [%d]%s", id, errno, ::strerror(errno));
+      }
+    }
+
+    bool drain(std::vector<Event>& batch) {
+      size_t fetched = batch.size();
+      Event event;
+      while(queue.pop(event)) {
+        batch.push_back(std::move(event));
+      }
+      if(overflowCount.load(std::memory_order_acquire) > 0) {
+        std::lock_guard<std::mutex> lock(overflowMutex);
+        for(auto &overflowEvent : overflowQueue) {
+          batch.push_back(std::move(overflowEvent));
+        }
+        overflowQueue.clear();
+        overflowCount.store(0, std::memory_order_release);
+      }
+      return batch.size() > fetched;
+    }
 
   public:
-    EventQueue(int _id):id(_id) {}
+    EventQueue(int _id): id(_id),
+                         queue(EVENT_QUEUE_CAPACITY),
+                         overflowCount(0),
+                         waiting(false) {
+      wakeup_fd = ::eventfd(0, EFD_CLOEXEC);
+      if(wakeup_fd == -1) {
+        LOG(LogLevel::FATAL, "[EventQueue][id %d][eventfd()] wake up fd initialize failed, error: [%d]%s", id, errno, ::strerror(errno));
+        ::exit(EXIT_FAILURE);
+      }
+    }
 
     ~EventQueue() {
   		LOG(LogLevel::DEBUG, "[EventQueue] destructing");
+      ::close(wakeup_fd);
+    }
+
+    void addEvent(Event event) {
+      if(Metrics::isLatencyEnabled()) {
+        event.setEnqueueTime(Metrics::now());
+      }
+      if(overflowCount.load(std::memory_order_acquire) > 0 || !queue.push(std::move(event))) {
+        std::lock_guard<std::mutex> lock(overflowMutex);
+        overflowQueue.push_back(std::move(event));
+        overflowCount.fetch_add(1, std::memory_order_release);
+      }
+      // pairs with the fence in fetchEvents(), either the consumer sees this event
+      // before parking or we see it parking and wake it up
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if(waiting.load(std::memory_order_relaxed)) {
+        wakeup();
+      }
+    }
+
+    // move every pending event into batch (appended)
+    // block the thread when no events available to handle, would be woke up after addEvent() is called
+    void fetchEvents(std::vector<Event>& batch) {
+      // give producers a few chances before paying for a park and a wake up
+      for(int spin = 0; spin < EVENT_QUEUE_YIELD_BEFORE_PARK; spin++) {
+        if(drain(batch)) {
+          return;
+        }
+        std::this_thread::yield();
+      }
+      while(!drain(batch)) {
+        waiting.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(drain(batch)) {
+          waiting.store(false, std::memory_order_relaxed);
+          return;
+        }
+        uint64_t counter;
+        ssize_t readLen = ::read(wakeup_fd, &counter, sizeof counter);
+        waiting.store(false, std::memory_order_relaxed);
+        if(readLen == -1 && errno != EINTR) {
+          LOG(LogLevel::FATAL, "[EventQueue][id %d][read()] wait for events failed, error: [%d]%s", id, errno, ::strerror(errno));
+          ::exit(EXIT_FAILURE);
+        }
+      }
+    }
+
+    // move every pending event into batch (appended) without blocking, return false if none
+    bool tryFetchEvents(std::vector<Event>& batch) {
+      return drain(batch);
+    }
+
+    // for consumers waiting somewhere else (epoll_wait() with get_fd() registered) instead of in fetchEvents()
+    // return false if events are pending and the consumer shouldn't wait
+    bool prepareWait() {
+      waiting.store(true, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if(getQueueLen() > 0) {
+        waiting.store(false, std::memory_order_relaxed);
+        return false;
+      }
+      return true;
+    }
+
+    void finishWait() {
+      waiting.store(false, std::memory_order_relaxed);
+    }
+
+    // reset eventfd counter after get_fd() is reported readable
+    void clearWakeup() {
+      uint64_t counter;
+      if(::read(wakeup_fd, &counter, sizeof counter) == -1 && errno != EINTR) {
+        LOG(LogLevel::ERROR, "[EventQueue][id %d][read()] clear wake up fd failed, error: [%d]%s", id, errno, ::strerror(errno));
+      }
+    }
+
+    int get_fd() {
+      return wakeup_fd;
+    }
+
+    size_t getQueueLen() {
+      return queue.size() + overflowCount.load(std::memory_order_relaxed);
+    }
+
+};
+
+// the former event queue, one lock and one notify per event
+// not used by EventLoop any more, kept for benchmark comparison
+class MutexEventQueue : public noncopyable {
+  private:
+    int id; // for debug
+    std::queue<Event> queue;
+    std::mutex mutex;
+    std::condition_variable condVar;
+
+  public:
+    MutexEventQueue(int _id):id(_id) {}
+
+    ~MutexEventQueue() {
+  		LOG(LogLevel::DEBUG, "[MutexEventQueue] destructing");
     }
 
-    void addEvent(std::shared_ptr<Event> event) {
+    void addEvent(Event event) {
       std::lock_guard<std::mutex> lock(mutex);
-      queue.push(event);
+      queue.push(std::move(event));
       // only one thread would try to fetch events from queue
       condVar.notify_one();
     }
 
-    std::shared_ptr<Event> fetchEvent() {
+    Event fetchEvent() {
       // block the thread when no events available to handle
       // would be woke up after addEvent() is called
       std::unique_lock<std::mutex> lock(mutex);
@@ -41,7 +195,7 @@ class EventQueue : public noncopyable {
         return !queue.empty();
       });
 
-      auto event = queue.front();
+      Event event = std::move(queue.front());
       queue.pop();
       return event;
     }
@@ -52,4 +206,4 @@ class EventQueue : public noncopyable {
 
 };
 
-}
\ No newline at end of file
+}
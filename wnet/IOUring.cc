@@ -0,0 +1,344 @@
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <linux/time_types.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "Connection.h"
+#include "IOUring.h"
+#include "OutputChain.h"
+
+using namespace wnet;
+
+namespace {
+
+int ioUringSetup(unsigned entries, struct io_uring_params* params) {
+  return static_cast<int>(::syscall(__NR_io_uring_setup, entries, params));
+}
+
+int ioUringRegister(int ring_fd, unsigned opcode, void* arg, unsigned argCount) {
+  return static_cast<int>(::syscall(__NR_io_uring_register, ring_fd, opcode, arg, argCount));
+}
+
+void* mapRing(int ring_fd, size_t size, off_t offset) {
+  void* ring = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, offset);
+  if(ring == MAP_FAILED) {
+    LOG(LogLevel::FATAL, "[IOUring][fd %d][mmap()] map ring failed, error: [%d]%s", ring_fd, errno, ::strerror(errno));
+    ::exit(EXIT_FAILURE);
+  }
+  return ring;
+}
+
+bool probeKernel() {
+  struct io_uring_params params;
+  ::memset(&params, 0, sizeof params);
+  int ring_fd = ioUringSetup(4, &params);
+  if(ring_fd == -1) {
+    LOG(LogLevel::INFO, "[IOUring][io_uring_setup()] io_uring unavailable, error: [%d]%s", errno, ::strerror(errno));
+    return false;
+  }
+  bool supported = (params.features & IORING_FEAT_EXT_ARG) && (params.features & IORING_FEAT_NODROP);
+
+  std::vector<char> probeBuf(sizeof(struct io_uring_probe) + IORING_OP_LAST * sizeof(struct io_uring_probe_op), 0);
+  auto probe = reinterpret_cast<struct io_uring_probe*>(probeBuf.data());
+  if(ioUringRegister(ring_fd, IORING_REGISTER_PROBE, probe, IORING_OP_LAST) == -1) {
+    supported = false;
+  } else {
+    // multishot receive and provided buffer rings came along with IORING_OP_SEND_ZC ( 6.0 )
+    for(int opcode : {IORING_OP_POLL_ADD, IORING_OP_SENDMSG, IORING_OP_ACCEPT, IORING_OP_ASYNC_CANCEL, IORING_OP_RECV, IORING_OP_SEND_ZC}) {
+      supported = supported && opcode <= probe->last_op && (probe->ops[opcode].flags & IO_URING_OP_SUPPORTED);
+    }
+  }
+  ::close(ring_fd);
+  if(!supported) {
+    LOG(LogLevel::INFO, "[IOUring] kernel lacks multishot receive / provided buffer rings");
+  }
+  return supported;
+}
+
+}
+
+bool IOUring::isSupported() {
+  static const bool supported = probeKernel();
+  return supported;
+}
+
+IOUring::IOUring() {
+  struct io_uring_params params;
+  ::memset(&params, 0, sizeof params);
+  ring_fd = ioUringSetup(IO_URING_ENTRIES, &params);
+  if(ring_fd == -1) {
+    LOG(LogLevel::FATAL, "[IOUring][io_uring_setup()] IOUring initialize failed, error: [%d]%s", errno, ::strerror(errno));
+    ::exit(EXIT_FAILURE);
+  }
+
+  sqEntries = params.sq_entries;
+  sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  bool singleMmap = params.features & IORING_FEAT_SINGLE_MMAP;
+  if(singleMmap) {
+    sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+  }
+  sqRing = mapRing(ring_fd, sqRingSize, IORING_OFF_SQ_RING);
+  cqRing = singleMmap ? sqRing : mapRing(ring_fd, cqRingSize, IORING_OFF_CQ_RING);
+  sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+  sqes = static_cast<struct io_uring_sqe*>(mapRing(ring_fd, sqesSize, IORING_OFF_SQES));
+
+  char* sq = static_cast<char*>(sqRing);
+  sqHead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+  sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+  sqMask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+  // slots handed out in ring order, index array fixed once
+  unsigned* sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+  for(unsigned index = 0; index < sqEntries; index++) {
+    sqArray[index] = index;
+  }
+  localTail = *sqTail;
+
+  char* cq = static_cast<char*>(cqRing);
+  cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+  cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+  cqMask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+  cqes = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+
+  // provided buffers, the kernel picks one whenever data arrives instead of a buffer fixed per receive
+  bufferRingSize = IO_URING_BUFFER_COUNT * sizeof(struct io_uring_buf);
+  void* ring = ::mmap(nullptr, bufferRingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(ring == MAP_FAILED) {
+    LOG(LogLevel::FATAL, "[IOUring][mmap()] allocate buffer ring failed, error: [%d]%s", errno, ::strerror(errno));
+    ::exit(EXIT_FAILURE);
+  }
+  bufferRing = static_cast<struct io_uring_buf*>(ring);
+  bufferPool = new char[IO_URING_BUFFER_COUNT * IO_URING_BUFFER_SIZE];
+
+  struct io_uring_buf_reg bufferReg;
+  ::memset(&bufferReg, 0, sizeof bufferReg);
+  bufferReg.ring_addr = reinterpret_cast<uint64_t>(bufferRing);
+  bufferReg.ring_entries = IO_URING_BUFFER_COUNT;
+  bufferReg.bgid = 0;
+  if(ioUringRegister(ring_fd, IORING_REGISTER_PBUF_RING, &bufferReg, 1) == -1) {
+    LOG(LogLevel::FATAL, "[IOUring][fd %d][io_uring_register()] register buffer ring failed, error: [%d]%s", ring_fd, errno, ::strerror(errno));
+    ::exit(EXIT_FAILURE);
+  }
+  for(int bufferId = 0; bufferId < IO_URING_BUFFER_COUNT; bufferId++) {
+    addBuffer(bufferId);
+  }
+}
+
+IOUring::~IOUring() {
+  LOG(LogLevel::DEBUG, "[IOUring] destructing");
+  // connection output must not be freed while the kernel may still read it
+  struct io_uring_sqe* sqe = getSqe();
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->cancel_flags = IORING_ASYNC_CANCEL_ANY;
+  sqe->user_data = static_cast<uint64_t>(CompletionType::CANCEL);
+
+  Completion completion;
+  for(int round = 0; round < 10 && operationCount > static_cast<int>(freeOperationList.size()); round++) {
+    submitAndWait(EPOLL_WAIT_TIMEOUT);
+    while(nextCompletion(completion)) {
+      completion.connection.reset();
+    }
+  }
+  if(operationCount > static_cast<int>(freeOperationList.size())) {
+    LOG(LogLevel::ERROR, "[IOUring][fd %d] %d requests not cancelled, left to the kernel", ring_fd, operationCount - static_cast<int>(freeOperationList.size()));
+  }
+
+  ::munmap(sqes, sqesSize);
+  if(cqRing != sqRing) {
+    ::munmap(cqRing, cqRingSize);
+  }
+  ::munmap(sqRing, sqRingSize);
+  ::close(ring_fd);
+
+  for(auto operation : freeOperationList) {
+    delete operation;
+  }
+  ::munmap(bufferRing, bufferRingSize);
+  delete[] bufferPool;
+}
+
+int IOUring::enter(unsigned toSubmit, unsigned minComplete, unsigned flags, const void* arg, size_t argSize) {
+  return static_cast<int>(::syscall(__NR_io_uring_enter, ring_fd, toSubmit, minComplete, flags, arg, argSize));
+}
+
+struct io_uring_sqe* IOUring::getSqe() {
+  while(localTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= sqEntries) {
+    // full, hand what's queued to the kernel first
+    submitAndWait(0);
+  }
+  struct io_uring_sqe* sqe = &sqes[localTail & sqMask];
+  ::memset(sqe, 0, sizeof *sqe);
+  localTail++;
+  pendingCount++;
+  return sqe;
+}
+
+IOUring::Operation* IOUring::allocOperation(CompletionType type, uint64_t tag) {
+  Operation* operation;
+  if(freeOperationList.empty()) {
+    operation = new Operation;
+    operationCount++;
+  } else {
+    operation = freeOperationList.back();
+    freeOperationList.pop_back();
+  }
+  operation->type = type;
+  operation->tag = tag;
+  return operation;
+}
+
+void IOUring::freeOperation(Operation* operation) {
+  operation->connection.reset();
+  freeOperationList.push_back(operation);
+}
+
+void IOUring::addBuffer(int bufferId) {
+  // entries indexed by hand, io_uring_buf_ring::bufs sits behind an empty struct taking a byte in C++
+  struct io_uring_buf &buf = bufferRing[bufferTail & (IO_URING_BUFFER_COUNT - 1)];
+  buf.addr = reinterpret_cast<uint64_t>(bufferPool + static_cast<size_t>(bufferId) * IO_URING_BUFFER_SIZE);
+  buf.len = IO_URING_BUFFER_SIZE;
+  buf.bid = static_cast<uint16_t>(bufferId);
+  bufferTail++;
+  // overlays the resv field of the first entry
+  __atomic_store_n(&reinterpret_cast<struct io_uring_buf_ring*>(bufferRing)->tail, bufferTail, __ATOMIC_RELEASE);
+}
+
+void IOUring::pollReadable(int fd, CompletionType type) {
+  struct io_uring_sqe* sqe = getSqe();
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = fd;
+  sqe->poll32_events = POLLIN;
+  sqe->len = IORING_POLL_ADD_MULTI;
+  sqe->user_data = static_cast<uint64_t>(type);
+}
+
+void IOUring::accept(int listen_fd) {
+  struct io_uring_sqe* sqe = getSqe();
+  sqe->opcode = IORING_OP_ACCEPT;
+  sqe->fd = listen_fd;
+  sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+  sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+  sqe->user_data = static_cast<uint64_t>(CompletionType::ACCEPT);
+}
+
+uint64_t IOUring::receive(uint64_t tag, int fd) {
+  struct io_uring_sqe* sqe = getSqe();
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = fd;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = 0;
+  sqe->user_data = reinterpret_cast<uint64_t>(allocOperation(CompletionType::RECEIVE, tag));
+  return sqe->user_data;
+}
+
+void IOUring::pollWritable(uint64_t tag, int fd) {
+  struct io_uring_sqe* sqe = getSqe();
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = fd;
+  sqe->poll32_events = POLLOUT;
+  sqe->user_data = reinterpret_cast<uint64_t>(allocOperation(CompletionType::WRITABLE, tag));
+}
+
+void IOUring::send(std::shared_ptr<Connection> connection, int fd, const OutputChain& chain) {
+  Operation* operation = allocOperation(CompletionType::SEND, 0);
+  operation->connection = std::move(connection);
+  ::memset(&operation->message, 0, sizeof operation->message);
+  operation->message.msg_iov = operation->iov;
+  operation->message.msg_iovlen = static_cast<size_t>(chain.prepare(operation->iov, IO_URING_SEND_IOV_COUNT));
+
+  struct io_uring_sqe* sqe = getSqe();
+  sqe->opcode = IORING_OP_SENDMSG;
+  sqe->fd = fd;
+  sqe->addr = reinterpret_cast<uint64_t>(&operation->message);
+  sqe->len = 1;
+  sqe->msg_flags = MSG_NOSIGNAL;
+  sqe->user_data = reinterpret_cast<uint64_t>(operation);
+}
+
+void IOUring::cancel(int fd) {
+  struct io_uring_sqe* sqe = getSqe();
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->fd = fd;
+  sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+  sqe->user_data = static_cast<uint64_t>(CompletionType::CANCEL);
+  // matched by fd number, so before it is closed and reused
+  submitAndWait(0);
+}
+
+void IOUring::cancelRequest(uint64_t request) {
+  struct io_uring_sqe* sqe = getSqe();
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->addr = request;
+  sqe->user_data = static_cast<uint64_t>(CompletionType::CANCEL);
+}
+
+void IOUring::submitAndWait(int timeoutMs) {
+  __atomic_store_n(sqTail, localTail, __ATOMIC_RELEASE);
+  int submitted;
+  if(timeoutMs > 0) {
+    struct __kernel_timespec timeout;
+    timeout.tv_sec = timeoutMs / 1000;
+    timeout.tv_nsec = (timeoutMs % 1000) * 1000000LL;
+    struct io_uring_getevents_arg arg;
+    ::memset(&arg, 0, sizeof arg);
+    arg.sigmask_sz = _NSIG / 8;
+    arg.ts = reinterpret_cast<uint64_t>(&timeout);
+    submitted = enter(pendingCount, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof arg);
+  } else if(pendingCount > 0) {
+    submitted = enter(pendingCount, 0, 0);
+  } else {
+    return;
+  }
+
+  if(submitted >= 0) {
+    pendingCount -= static_cast<unsigned>(submitted);
+  } else if(errno != ETIME && errno != EINTR && errno != EBUSY) {
+    LOG(LogLevel::ERROR, "[IOUring][fd %d][io_uring_enter()] submit failed, error: [%d]%s", ring_fd, errno, ::strerror(errno));
+  }
+}
+
+bool IOUring::nextCompletion(Completion& completion) {
+  unsigned head = *cqHead;
+  if(head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) {
+    return false;
+  }
+  const struct io_uring_cqe &cqe = cqes[head & cqMask];
+  uint64_t userData = cqe.user_data;
+  completion.result = cqe.res;
+  completion.more = cqe.flags & IORING_CQE_F_MORE;
+  if(cqe.flags & IORING_CQE_F_BUFFER) {
+    completion.bufferId = static_cast<int>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+    completion.data = bufferPool + static_cast<size_t>(completion.bufferId) * IO_URING_BUFFER_SIZE;
+  } else {
+    completion.bufferId = -1;
+    completion.data = nullptr;
+  }
+  __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+
+  if(userData <= static_cast<uint64_t>(CompletionType::CANCEL)) {
+    // requests not of a connection carry their type only
+    completion.type = static_cast<CompletionType>(userData);
+    completion.tag = 0;
+    completion.connection.reset();
+  } else {
+    Operation* operation = reinterpret_cast<Operation*>(userData);
+    completion.type = operation->type;
+    completion.tag = operation->tag;
+    completion.connection = std::move(operation->connection);
+    if(!completion.more) {
+      freeOperation(operation);
+    }
+  }
+  return true;
+}
+
+void IOUring::recycleBuffer(const Completion& completion) {
+  if(completion.bufferId >= 0) {
+    addBuffer(completion.bufferId);
+  }
+}
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <linux/io_uring.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "Config.h"
+#include "Log.h"
+#include "Noncopyable.h"
+
+namespace wnet {
+
+class Connection;
+class OutputChain;
+
+enum class CompletionType {
+  WAKEUP = 1,   // EventQueue eventfd readable
+  TIMER,        // timerfd readable
+  ACCEPT,       // multishot accept, result is the new fd or -errno
+  RECEIVE,      // multishot receive, result bytes in a provided buffer, 0 if closed by peer, or -errno
+  WRITABLE,     // socket writable, once per connection after armed
+  SEND,         // sendmsg() of a connection's output, result bytes sent or -errno
+  CANCEL
+};
+
+// io_uring of one EventLoop ( IOBackend::IO_URING ), driven by raw syscalls,
+// only touched by the thread of that EventLoop
+//
+// requests are queued and go out with the next submitAndWait(), so the sends of every connection
+// handled in one pass and the wait for the next completions cost a single io_uring_enter()
+class IOUring : public noncopyable {
+  public:
+    struct Completion {
+      CompletionType type;
+      int result;
+      bool more;                                // multishot request still armed
+      uint64_t tag;                             // RECEIVE / WRITABLE, ConnectionTable tag of the connection
+      std::shared_ptr<Connection> connection;   // SEND, kept alive while the kernel reads its output
+      const char* data;                         // RECEIVE, provided buffer holding result bytes
+      int bufferId;                             // -1 if no provided buffer taken
+    };
+
+  private:
+    // request of a connection, user_data points to it until its last completion
+    struct Operation {
+      CompletionType type;
+      uint64_t tag;
+      std::shared_ptr<Connection> connection;
+      struct msghdr message;
+      struct iovec iov[IO_URING_SEND_IOV_COUNT];
+    };
+
+    int ring_fd = -1;
+
+    // submission queue
+    void* sqRing = nullptr;
+    size_t sqRingSize = 0;
+    unsigned* sqHead;
+    unsigned* sqTail;
+    unsigned sqMask;
+    unsigned sqEntries;
+    struct io_uring_sqe* sqes = nullptr;
+    size_t sqesSize = 0;
+    unsigned localTail;     // queued, published to sqTail on submit
+    unsigned pendingCount = 0;
+
+    // completion queue, shares the mapping with submission queue if IORING_FEAT_SINGLE_MMAP
+    void* cqRing = nullptr;
+    size_t cqRingSize = 0;
+    unsigned* cqHead;
+    unsigned* cqTail;
+    unsigned cqMask;
+    struct io_uring_cqe* cqes;
+
+    // provided buffers for multishot receive, group 0
+    struct io_uring_buf* bufferRing = nullptr;
+    size_t bufferRingSize = 0;
+    char* bufferPool = nullptr;
+    uint16_t bufferTail = 0;
+
+    std::vector<Operation*> freeOperationList;
+    int operationCount = 0;     // allocated, in flight ones are the ones not in freeOperationList
+
+    // a free slot of the submission queue, zeroed, queued submissions flushed first if full
+    struct io_uring_sqe* getSqe();
+
+    Operation* allocOperation(CompletionType type, uint64_t tag);
+
+    void freeOperation(Operation* operation);
+
+    int enter(unsigned toSubmit, unsigned minComplete, unsigned flags, const void* arg = nullptr, size_t argSize = 0);
+
+    void addBuffer(int bufferId);
+
+  public:
+    // kernel with multishot receive and provided buffer rings ( 6.0 ), and io_uring not disabled
+    static bool isSupported();
+
+    IOUring();
+
+    // cancels every request, waits until the kernel lets go of connection output
+    ~IOUring();
+
+    // multishot, one completion every time fd turns readable, WAKEUP / TIMER
+    void pollReadable(int fd, CompletionType type);
+
+    void accept(int listen_fd);
+
+    // request id returned, to cancel it by
+    uint64_t receive(uint64_t tag, int fd);
+
+    void pollWritable(uint64_t tag, int fd);
+
+    // [ iov of chain ] sent in one sendmsg(), connection kept alive until its completion
+    void send(std::shared_ptr<Connection> connection, int fd, const OutputChain& chain);
+
+    // every request on fd, submitted at once, must be called before fd is closed
+    void cancel(int fd);
+
+    // one request, by the id receive() returned, its last completion comes with -ECANCELED unless finished already
+    void cancelRequest(uint64_t request);
+
+    // queued requests submitted, then wait up to timeoutMs for a completion, 0 not to wait
+    void submitAndWait(int timeoutMs);
+
+    // false if none left
+    bool nextCompletion(Completion& completion);
+
+    // provided buffer of a RECEIVE completion back to the kernel, once its data is copied
+    void recycleBuffer(const Completion& completion);
+};
+
+}
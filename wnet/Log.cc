@@ -9,7 +9,7 @@ bool Log::isWithLocation = false;
 
 thread_local char Log::contentBuf[LOG_BUF_SIZE];
 thread_local char Log::timeBuf[LOG_TIME_BUF_SIZE];
+thread_local time_t Log::timeBufSecond = 0;
 thread_local char Log::fileNameBuf[LOG_FILE_NAME_BUF_SIZE];
-thread_local char Log::locationBuf[LOG_FILE_LOCATION_BUF_SIZE];
 
 thread_local FILE* Log::logFile = nullptr;
\ No newline at end of file
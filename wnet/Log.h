@@ -1,5 +1,7 @@
 #pragma once
 
+#include <algorithm>
+#include <cstdint>
 #include <cstdio>
 #include <cstring> 
 #include <ctime>
@@ -10,9 +12,17 @@
 #include <sys/stat.h> 
 #include <unistd.h>
 
+#include "AsyncLog.h"
 #include "Config.h"
 
-#define LOG(...) Log::addLog(__FILE__, __FUNCTION__, __LINE__, __VA_ARGS__)
+// levels below LOG_MIN_LEVEL are dropped at compile time, arguments never evaluated,
+// the rest are checked against Log::setLogLevel() inline before any call or formatting
+#define LOG(_level, ...)                                                                \
+  do {                                                                                  \
+    if(static_cast<int>(_level) >= LOG_MIN_LEVEL && Log::isEnabled(_level)) {           \
+      Log::addLog(__FILE__, __FUNCTION__, __LINE__, _level, __VA_ARGS__);               \
+    }                                                                                   \
+  } while(0)
 
 namespace wnet{
 
@@ -32,8 +42,8 @@ class Log {
 
     static thread_local char contentBuf[LOG_BUF_SIZE];
     static thread_local char timeBuf[LOG_TIME_BUF_SIZE];
+    static thread_local time_t timeBufSecond;     // timeBuf is only formatted again when the second changes
     static thread_local char fileNameBuf[LOG_FILE_NAME_BUF_SIZE];
-    static thread_local char locationBuf[LOG_FILE_LOCATION_BUF_SIZE];
     
     static thread_local FILE* logFile;
 
@@ -51,20 +61,42 @@ class Log {
       return nullptr;
     }
     
-    static void getTime(const char* timeFormat) {
+    static void getTime(const char* timeFormat, char* buf) {
       time_t now = ::time(NULL);
       struct tm tm;
       ::localtime_r(&now, &tm);
-      ::strftime(timeBuf, LOG_TIME_BUF_SIZE, timeFormat, &tm);
+      ::strftime(buf, LOG_TIME_BUF_SIZE, timeFormat, &tm);
     }
 
-    static void getLocation(const char* fileName, const char* funcName, int lineNo) {
-      ::snprintf(locationBuf, LOG_FILE_LOCATION_BUF_SIZE, "[file:%s,func:%s,line:%d]", fileName, funcName, lineNo);
+    static const char* getCachedTime() {
+      time_t now = ::time(NULL);
+      if(now != timeBufSecond) {
+        struct tm tm;
+        ::localtime_r(&now, &tm);
+        ::strftime(timeBuf, LOG_TIME_BUF_SIZE, "[%m-%d %T]", &tm);
+        timeBufSecond = now;
+      }
+      return timeBuf;
+    }
+
+    // format one line into buf, truncated to size, return length
+    template <typename... Args>
+    static uint32_t format(char* buf, size_t size, const char* fileName, const char* funcName, int lineNo, LogLevel _level, const char* context, Args... args) {
+      const char* levelStr = getLevelStr(_level);
+      int length = isWithLocation ? ::snprintf(buf, size, "%s%s[file:%s,func:%s,line:%d] ", levelStr, getCachedTime(), fileName, funcName, lineNo)
+                                  : ::snprintf(buf, size, "%s%s ", levelStr, getCachedTime());
+      size_t used = length < 0 ? 0 : std::min(static_cast<size_t>(length), size - 2);
+      length = ::snprintf(buf + used, size - used - 1, context, args...);
+      used = length < 0 ? used : std::min(used + static_cast<size_t>(length), size - 2);
+      buf[used++] = '\n';
+      buf[used] = '\0';
+      return static_cast<uint32_t>(used);
     }
 
     static void openLogFile() {
-      getTime("%m_%d_%H");
-      ::snprintf(fileNameBuf, LOG_FILE_NAME_BUF_SIZE, "%s%s%s%s", logDirectory.c_str(), "/", timeBuf, ".log");
+      char fileTimeBuf[LOG_TIME_BUF_SIZE];
+      getTime("%m_%d_%H", fileTimeBuf);
+      ::snprintf(fileNameBuf, LOG_FILE_NAME_BUF_SIZE, "%s%s%s%s", logDirectory.c_str(), "/", fileTimeBuf, ".log");
       logFile = ::fopen(fileNameBuf, "a");
       if(!logFile) {
         isAddLogToFile = false;
@@ -78,6 +110,10 @@ class Log {
       level = _level;
     }
 
+    static bool isEnabled(LogLevel _level) {
+      return _level >= level;
+    }
+
     static void setLogWithLocation() {
       isWithLocation = true;
     }
@@ -107,31 +143,31 @@ class Log {
       isAddLogToFile = true;
     }
 
+    // hand formatted lines to a background writer thread instead of writing on the calling thread,
+    // call after setLogFile() and after Daemon::setDaemonMode()
+    static void setAsync(LogFullPolicy policy = LogFullPolicy::DROP) {
+      AsyncLog::start(isAddLogToFile ? logDirectory : "", policy);
+    }
+
     template <typename... Args>
     static void addLog(const char* fileName, const char* funcName, int lineNo, LogLevel _level, const char* context, Args... args) {
-      if(isAddLogToFile) {
-        openLogFile();
+      if(_level < level) {
+        return;
       }
-      if(_level >= level) {
-        getTime("[%m-%d %T]");
-        getLocation(fileName, funcName, lineNo);
-        const char* levelStr = getLevelStr(_level);
-
-        if(::strlen(levelStr) + ::strlen(timeBuf) + ::strlen(context) + (isWithLocation ? ::strlen(locationBuf) : 0) + 3 > LOG_BUF_SIZE) {
-          ::printf("[log error] log context too long @ %s\n", locationBuf);
-          return;
-        } else {
-          isWithLocation ?  ::snprintf(contentBuf, LOG_BUF_SIZE, "%s%s%s %s%s", levelStr, timeBuf, locationBuf, context, "\n")
-                          : ::snprintf(contentBuf, LOG_BUF_SIZE, "%s%s %s%s", levelStr, timeBuf, context, "\n");
-          if(sizeof...(args) == 0) {
-            isAddLogToFile ? ::fprintf(logFile, contentBuf) : ::printf(contentBuf);
-          } else {
-            isAddLogToFile ? ::fprintf(logFile, contentBuf, args...) : ::printf(contentBuf, args...);
-          }
+      if(AsyncLog::isRunning()) {
+        if(AsyncLog::Record* record = AsyncLog::claim()) {
+          record->length = format(record->data, LOG_BUF_SIZE, fileName, funcName, lineNo, _level, context, args...);
+          AsyncLog::commit();
         }
+        return;
       }
-      if(isAddLogToFile && logFile) {
+      format(contentBuf, LOG_BUF_SIZE, fileName, funcName, lineNo, _level, context, args...);
+      if(isAddLogToFile) {
+        openLogFile();
+        ::fputs(contentBuf, logFile);
         ::fclose(logFile);
+      } else {
+        ::fputs(contentBuf, stdout);
       }
     }
 
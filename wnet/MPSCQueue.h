@@ -0,0 +1,113 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "Noncopyable.h"
+
+namespace wnet {
+
+// bounded lock-free multi-producer / single-consumer ring
+// based on Dmitry Vyukov's bounded MPMC queue, dequeue side simplified for a single consumer
+// every cell carries a sequence number, producers claim a cell with one CAS on enqueuePos,
+// the consumer never touches enqueuePos so producers and consumer don't share a contended line
+template<typename TYPE>
+class MPSCQueue : public noncopyable {
+  private:
+    static constexpr size_t CACHE_LINE_SIZE = 64;
+
+    struct Cell {
+      std::atomic<size_t> sequence;
+      typename std::aligned_storage<sizeof(TYPE), alignof(TYPE)>::type storage;
+
+      TYPE* value() {
+        return reinterpret_cast<TYPE*>(&storage);
+      }
+    };
+
+    Cell* cells;
+    const size_t mask;
+
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> enqueuePos;
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> dequeuePos;    // only written by the consumer
+
+    static size_t roundUpToPowerOfTwo(size_t num) {
+      size_t result = 2;
+      while(result < num) {
+        result <<= 1;
+      }
+      return result;
+    }
+
+  public:
+    MPSCQueue(size_t capacity): mask(roundUpToPowerOfTwo(capacity) - 1),
+                                enqueuePos(0),
+                                dequeuePos(0) {
+      cells = new Cell[mask + 1];
+      for(size_t index = 0; index <= mask; index++) {
+        cells[index].sequence.store(index, std::memory_order_relaxed);
+      }
+    }
+
+    ~MPSCQueue() {
+      TYPE discard;
+      while(pop(discard)) {}
+      delete[] cells;
+    }
+
+    size_t capacity() const {
+      return mask + 1;
+    }
+
+    // safe to call from any thread, return false when ring is full
+    bool push(TYPE&& data) {
+      Cell* cell;
+      size_t pos = enqueuePos.load(std::memory_order_relaxed);
+      while(true) {
+        cell = &cells[pos & mask];
+        size_t sequence = cell->sequence.load(std::memory_order_acquire);
+        intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+        if(diff == 0) {
+          if(enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+            break;
+          }
+        } else if(diff < 0) {
+          return false;     // the consumer hasn't released this cell yet, full
+        } else {
+          pos = enqueuePos.load(std::memory_order_relaxed);
+        }
+      }
+      new (cell->value()) TYPE(std::move(data));
+      cell->sequence.store(pos + 1, std::memory_order_release);
+      return true;
+    }
+
+    // only the consumer thread may call, return false when ring is empty
+    bool pop(TYPE& data) {
+      size_t pos = dequeuePos.load(std::memory_order_relaxed);
+      Cell* cell = &cells[pos & mask];
+      size_t sequence = cell->sequence.load(std::memory_order_acquire);
+      if(static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos + 1) < 0) {
+        return false;
+      }
+      data = std::move(*(cell->value()));
+      cell->value()->~TYPE();
+      cell->sequence.store(pos + mask + 1, std::memory_order_release);
+      dequeuePos.store(pos + 1, std::memory_order_relaxed);
+      return true;
+    }
+
+    // approximate, for statistic only
+    size_t size() const {
+      size_t tail = enqueuePos.load(std::memory_order_relaxed);
+      size_t head = dequeuePos.load(std::memory_order_relaxed);
+      return tail > head ? tail - head : 0;
+    }
+
+};
+
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+
+#include <google/protobuf/arena.h>
+
+#include "Config.h"
+#include "Noncopyable.h"
+#include "ProtoBuf.h"
+
+namespace wnet {
+
+// protobuf Arena for the messages of the requests on one connection, responses of its sub requests included,
+// every message handed out shares ownership of the MessageArena,
+// so the connection only frees them in bulk ( reset() ) once none of them is referenced any more
+class MessageArena : public noncopyable, public std::enable_shared_from_this<MessageArena> {
+  private:
+    std::unique_ptr<char[]> initialBlock;   // kept across reset(), small requests never reach malloc
+    google::protobuf::Arena arena;
+    std::atomic<bool> used;
+
+    static google::protobuf::ArenaOptions makeOptions(char* block) {
+      google::protobuf::ArenaOptions options;
+      options.initial_block = block;
+      options.initial_block_size = MESSAGE_ARENA_INITIAL_BLOCK_SIZE;
+      return options;
+    }
+
+  public:
+    MessageArena(): initialBlock(new char[MESSAGE_ARENA_INITIAL_BLOCK_SIZE]),
+                    arena(makeOptions(initialBlock.get())),
+                    used(false) {}
+
+    // in the EventLoop of the connection only, subconnections decoding its sub request responses are pinned to it
+    template<typename MESSAGE>
+    std::shared_ptr<MESSAGE> create() {
+      used.store(true, std::memory_order_relaxed);
+      return std::shared_ptr<MESSAGE>(shared_from_this(), google::protobuf::Arena::CreateMessage<MESSAGE>(&arena));
+    }
+
+    std::shared_ptr<Message> create(const Message* prototype) {
+      used.store(true, std::memory_order_relaxed);
+      return std::shared_ptr<Message>(shared_from_this(), prototype->New(&arena));
+    }
+
+    // free every message at once, only when nothing else shares this MessageArena
+    void reset() {
+      if(used.exchange(false, std::memory_order_relaxed)) {
+        arena.Reset();
+      }
+    }
+};
+
+}
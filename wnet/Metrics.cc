@@ -0,0 +1,184 @@
+#include <cstdio>
+
+#include "Connection.h"
+#include "Connector.h"
+#include "Metrics.h"
+
+using namespace wnet;
+
+namespace {
+
+const char* const counterNames[] = {
+  "bytes_in",
+  "bytes_out",
+  "events_handled",
+  "accepts",
+  "connections_opened",
+  "connections_closed"
+};
+
+const char* const histogramNames[] = {
+  "queue_wait_ns",
+  "handler_time_ns",
+  "sub_request_rtt_ns"
+};
+
+const char* const subRequestCounterNames[] = {
+  "sub_requests_issued",
+  "sub_requests_resolved",
+  "sub_requests_rejected",
+  "sub_requests_timed_out",
+  "sub_requests_cancelled"
+};
+
+const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+
+void appendLine(std::string& text, const char* name, const char* label, uint64_t value) {
+  char line[256];
+  ::snprintf(line, sizeof line, "%s%s %llu\n", name, label, static_cast<unsigned long long>(value));
+  text += line;
+}
+
+}
+
+// for struct HistogramSnapshot
+uint64_t HistogramSnapshot::percentile(double quantile) const {
+  if(count == 0) {
+    return 0;
+  }
+  // rank of the value wanted, 1 based
+  uint64_t rank = static_cast<uint64_t>(quantile * static_cast<double>(count) + 0.5);
+  rank = rank == 0 ? 1 : rank;
+  uint64_t seen = 0;
+  for(size_t index = 0; index < buckets.size(); index++) {
+    seen += buckets[index];
+    if(seen >= rank) {
+      // never above the largest value recorded
+      uint64_t upperBound = HistogramBuckets::upperBoundOf(static_cast<int>(index));
+      return upperBound < max ? upperBound : max;
+    }
+  }
+  return max;
+}
+
+
+// for struct MetricsSnapshot
+uint64_t MetricsSnapshot::get(MetricsCounter counter) const {
+  uint64_t total = 0;
+  for(auto &counters : shardCounters) {
+    total += counters[static_cast<size_t>(counter)];
+  }
+  return total;
+}
+
+uint64_t MetricsSnapshot::get(SubRequestCounter counter) const {
+  uint64_t total = 0;
+  for(auto &endpoint : endpointList) {
+    total += endpoint.counters[static_cast<size_t>(counter)];
+  }
+  return total;
+}
+
+std::string MetricsSnapshot::toText() const {
+  std::string text;
+  char label[128];
+
+  uint64_t opened = get(MetricsCounter::CONNECTIONS_OPENED);
+  uint64_t closed = get(MetricsCounter::CONNECTIONS_CLOSED);
+  appendLine(text, "connections", "", opened > closed ? opened - closed : 0);
+  appendLine(text, "pending_output_bytes", "", pendingOutputSize);
+
+  for(int counter = 0; counter < static_cast<int>(MetricsCounter::COUNT); counter++) {
+    appendLine(text, counterNames[counter], "", get(static_cast<MetricsCounter>(counter)));
+    for(size_t shard = 0; shard < shardCounters.size(); shard++) {
+      if(shard < EVENT_LOOP_COUNT) {
+        ::snprintf(label, sizeof label, "{loop=\"%zu\"}", shard);
+      } else {
+        ::snprintf(label, sizeof label, "{loop=\"master\"}");
+      }
+      appendLine(text, counterNames[counter], label, shardCounters[shard][static_cast<size_t>(counter)]);
+    }
+  }
+
+  for(int counter = 0; counter < static_cast<int>(SubRequestCounter::COUNT); counter++) {
+    appendLine(text, subRequestCounterNames[counter], "", get(static_cast<SubRequestCounter>(counter)));
+    for(auto &endpoint : endpointList) {
+      ::snprintf(label, sizeof label, "{endpoint=\"%s:%d\"}", endpoint.ip.c_str(), endpoint.port);
+      appendLine(text, subRequestCounterNames[counter], label, endpoint.counters[static_cast<size_t>(counter)]);
+    }
+  }
+
+  char name[128];
+  for(int histogram = 0; histogram < static_cast<int>(MetricsHistogram::COUNT); histogram++) {
+    const HistogramSnapshot& snapshot = histograms[static_cast<size_t>(histogram)];
+    for(double quantile : quantiles) {
+      ::snprintf(label, sizeof label, "{quantile=\"%g\"}", quantile);
+      appendLine(text, histogramNames[histogram], label, snapshot.percentile(quantile));
+    }
+    ::snprintf(name, sizeof name, "%s_max", histogramNames[histogram]);
+    appendLine(text, name, "", snapshot.max);
+    ::snprintf(name, sizeof name, "%s_sum", histogramNames[histogram]);
+    appendLine(text, name, "", snapshot.sum);
+    ::snprintf(name, sizeof name, "%s_count", histogramNames[histogram]);
+    appendLine(text, name, "", snapshot.count);
+  }
+  return text;
+}
+
+
+// for class Metrics
+Metrics::Shard Metrics::shards[EVENT_LOOP_COUNT + 1];
+thread_local int Metrics::shardIndex = EVENT_LOOP_COUNT;
+std::atomic<bool> Metrics::latencyEnabled(false);
+
+void Metrics::record(MetricsHistogram histogram, uint64_t nanoseconds) {
+  HistogramShard &shard = shards[shardIndex].histograms[static_cast<int>(histogram)];
+  bump(shard.buckets[HistogramBuckets::indexOf(nanoseconds)], 1);
+  bump(shard.count, 1);
+  bump(shard.sum, nanoseconds);
+  uint64_t max = shard.max.load(std::memory_order_relaxed);
+  if(nanoseconds <= max) {
+    return;
+  }
+  if(shardIndex < EVENT_LOOP_COUNT) {
+    shard.max.store(nanoseconds, std::memory_order_relaxed);
+    return;
+  }
+  while(nanoseconds > max && !shard.max.compare_exchange_weak(max, nanoseconds, std::memory_order_relaxed)) {}
+}
+
+MetricsSnapshot Metrics::collect() {
+  MetricsSnapshot snapshot;
+  snapshot.histograms.resize(static_cast<size_t>(MetricsHistogram::COUNT));
+  // read while being written, every value is of some moment, a count may run a little ahead of its buckets
+  for(auto &shard : shards) {
+    std::vector<uint64_t> counters;
+    for(auto &counter : shard.counters) {
+      counters.push_back(counter.load(std::memory_order_relaxed));
+    }
+    snapshot.shardCounters.push_back(std::move(counters));
+
+    for(size_t histogram = 0; histogram < snapshot.histograms.size(); histogram++) {
+      HistogramShard &histogramShard = shard.histograms[histogram];
+      HistogramSnapshot &merged = snapshot.histograms[histogram];
+      for(size_t index = 0; index < merged.buckets.size(); index++) {
+        merged.buckets[index] += histogramShard.buckets[index].load(std::memory_order_relaxed);
+      }
+      merged.count += histogramShard.count.load(std::memory_order_relaxed);
+      merged.sum += histogramShard.sum.load(std::memory_order_relaxed);
+      uint64_t max = histogramShard.max.load(std::memory_order_relaxed);
+      merged.max = max > merged.max ? max : merged.max;
+    }
+  }
+
+  for(auto &endpoint : Connector::getEndpointList()) {
+    MetricsSnapshot::EndpointCounters endpointCounters{endpoint->getIP(), endpoint->getPort(), {}};
+    for(int counter = 0; counter < static_cast<int>(SubRequestCounter::COUNT); counter++) {
+      endpointCounters.counters.push_back(endpoint->getMetrics().get(static_cast<SubRequestCounter>(counter)));
+    }
+    snapshot.endpointList.push_back(std::move(endpointCounters));
+  }
+
+  snapshot.pendingOutputSize = Connection::getTotalPendingOutputSize();
+  return snapshot;
+}
@@ -0,0 +1,229 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Config.h"
+#include "Noncopyable.h"
+
+namespace wnet {
+
+enum class MetricsCounter {
+  BYTES_IN = 0,
+  BYTES_OUT,
+  EVENTS_HANDLED,       // queued events, readiness handled inline and io_uring completions
+  ACCEPTS,
+  CONNECTIONS_OPENED,   // passive and active
+  CONNECTIONS_CLOSED,
+  COUNT
+};
+
+enum class MetricsHistogram {
+  QUEUE_WAIT = 0,       // Event added to an EventQueue until its EventLoop handles it
+  HANDLER_TIME,         // one call of onReceiveDataHandler / pipelinedRequestHandler
+  SUB_REQUEST_RTT,      // sub request issued until resolved
+  COUNT
+};
+
+// per BackendEndpoint
+enum class SubRequestCounter {
+  ISSUED = 0,
+  RESOLVED,
+  REJECTED,     // error response, connection closed by peer, ... neither timed out nor cancelled
+  TIMED_OUT,
+  CANCELLED,
+  COUNT
+};
+
+// log-linear buckets the way of HdrHistogram, values below 2 ^ (METRICS_HISTOGRAM_SUB_BUCKET_BITS + 1) exact,
+// every power of 2 above split in 2 ^ METRICS_HISTOGRAM_SUB_BUCKET_BITS buckets
+class HistogramBuckets {
+  private:
+    static constexpr int SUB_BUCKET_BITS = METRICS_HISTOGRAM_SUB_BUCKET_BITS;
+    static constexpr uint64_t SUB_BUCKET_COUNT = 1ULL << SUB_BUCKET_BITS;
+    static constexpr uint64_t MAX_VALUE = (1ULL << METRICS_HISTOGRAM_MAX_BITS) - 1;
+
+  public:
+    static int indexOf(uint64_t value) {
+      if(value > MAX_VALUE) {
+        value = MAX_VALUE;
+      }
+      if(value < SUB_BUCKET_COUNT) {
+        return static_cast<int>(value);
+      }
+      int exponent = 63 - __builtin_clzll(value);
+      return (exponent - SUB_BUCKET_BITS + 1) * static_cast<int>(SUB_BUCKET_COUNT)
+             + static_cast<int>((value >> (exponent - SUB_BUCKET_BITS)) - SUB_BUCKET_COUNT);
+    }
+
+    // highest value counted in bucket index
+    static uint64_t upperBoundOf(int index) {
+      if(index < static_cast<int>(2 * SUB_BUCKET_COUNT)) {
+        return static_cast<uint64_t>(index);
+      }
+      int shift = index / static_cast<int>(SUB_BUCKET_COUNT) - 1;
+      uint64_t lowest = (SUB_BUCKET_COUNT + static_cast<uint64_t>(index) % SUB_BUCKET_COUNT) << shift;
+      return lowest + (1ULL << shift) - 1;
+    }
+};
+
+struct HistogramSnapshot {
+  std::vector<uint64_t> buckets;
+  uint64_t count = 0;
+  uint64_t sum = 0;
+  uint64_t max = 0;
+
+  HistogramSnapshot(): buckets(METRICS_HISTOGRAM_BUCKET_COUNT, 0) {}
+
+  // upper bound of the bucket holding it, 0 if nothing recorded
+  uint64_t percentile(double quantile) const;
+};
+
+// shards of every thread merged, taken by Metrics::collect()
+struct MetricsSnapshot {
+  struct EndpointCounters {
+    std::string ip;
+    short port;
+    std::vector<uint64_t> counters;   // by SubRequestCounter
+  };
+
+  // [ shard => [ counter => value ] ], EventLoops by id, then the one shared by other threads
+  std::vector<std::vector<uint64_t>> shardCounters;
+  std::vector<HistogramSnapshot> histograms;    // by MetricsHistogram
+  std::vector<EndpointCounters> endpointList;
+  size_t pendingOutputSize = 0;
+
+  // of every thread
+  uint64_t get(MetricsCounter counter) const;
+
+  // to every endpoint
+  uint64_t get(SubRequestCounter counter) const;
+
+  const HistogramSnapshot& get(MetricsHistogram histogram) const {
+    return histograms[static_cast<size_t>(histogram)];
+  }
+
+  // a "name{label} value" line each, totals first
+  std::string toText() const;
+};
+
+// counters and histograms sharded by thread, one shard per EventLoop written by that thread alone with plain
+// loads and stores, the master thread and any other thread share one more, merged only when collected
+//
+// counters always on, histograms only with setLatencyEnabled() ( a clock read on both ends of what is timed )
+class Metrics {
+  private:
+    struct HistogramShard {
+      std::atomic<uint64_t> buckets[METRICS_HISTOGRAM_BUCKET_COUNT];
+      std::atomic<uint64_t> count;
+      std::atomic<uint64_t> sum;
+      std::atomic<uint64_t> max;
+    };
+
+    struct alignas(64) Shard {
+      std::atomic<uint64_t> counters[static_cast<int>(MetricsCounter::COUNT)];
+      HistogramShard histograms[static_cast<int>(MetricsHistogram::COUNT)];
+    };
+
+    // zeroed as static storage
+    static Shard shards[EVENT_LOOP_COUNT + 1];
+
+    static thread_local int shardIndex;
+
+    static std::atomic<bool> latencyEnabled;
+
+  public:
+    static int getShardIndex() {
+      return shardIndex;
+    }
+
+    // only the EventLoop thread writes its own shard, no read-modify-write needed
+    static void bump(std::atomic<uint64_t>& slot, uint64_t value) {
+      if(shardIndex < EVENT_LOOP_COUNT) {
+        slot.store(slot.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+      } else {
+        slot.fetch_add(value, std::memory_order_relaxed);
+      }
+    }
+
+    // by EventLoop::loop(), shard of the calling thread
+    static void bindThread(int loopIndex) {
+      shardIndex = loopIndex;
+    }
+
+    static void add(MetricsCounter counter, uint64_t value = 1) {
+      bump(shards[shardIndex].counters[static_cast<int>(counter)], value);
+    }
+
+    static void setLatencyEnabled(bool enable = true) {
+      latencyEnabled.store(enable, std::memory_order_relaxed);
+    }
+
+    static bool isLatencyEnabled() {
+      return latencyEnabled.load(std::memory_order_relaxed);
+    }
+
+    static uint64_t now() {
+      return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+    // 0 unless latency enabled, passed to stopTiming()
+    static uint64_t startTiming() {
+      return isLatencyEnabled() ? now() : 0;
+    }
+
+    static void stopTiming(MetricsHistogram histogram, uint64_t start) {
+      if(start > 0) {
+        uint64_t end = now();
+        record(histogram, end > start ? end - start : 0);
+      }
+    }
+
+    static void record(MetricsHistogram histogram, uint64_t nanoseconds);
+
+    // every shard merged, sub request counters of every endpoint along
+    static MetricsSnapshot collect();
+
+    // collect() as plain text
+    static std::string snapshot() {
+      return collect().toText();
+    }
+};
+
+// sub request counters of one BackendEndpoint, sharded like Metrics
+class SubRequestMetrics : public noncopyable {
+  private:
+    struct Shard {
+      std::atomic<uint64_t> counters[static_cast<int>(SubRequestCounter::COUNT)];
+      char padding[64];   // endpoints are heap allocated, no alignas, kept off each other's cache line instead
+    };
+
+    Shard shards[EVENT_LOOP_COUNT + 1];
+
+  public:
+    SubRequestMetrics() {
+      for(auto &shard : shards) {
+        for(auto &counter : shard.counters) {
+          counter.store(0, std::memory_order_relaxed);
+        }
+      }
+    }
+
+    void add(SubRequestCounter counter) {
+      Metrics::bump(shards[Metrics::getShardIndex()].counters[static_cast<int>(counter)], 1);
+    }
+
+    uint64_t get(SubRequestCounter counter) const {
+      uint64_t total = 0;
+      for(auto &shard : shards) {
+        total += shard.counters[static_cast<int>(counter)].load(std::memory_order_relaxed);
+      }
+      return total;
+    }
+};
+
+}
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include <sys/uio.h>
+
+#include "Buffer.h"
+#include "Config.h"
+#include "Noncopyable.h"
+#include "ProtoBuf.h"
+
+namespace wnet {
+
+// pending output of a connection, sent in order by writev()
+// small writes are copied into one Buffer, shared immutable payloads are only referenced
+class OutputChain : public noncopyable {
+  private:
+    struct Segment {
+      std::shared_ptr<const void> owner;    // keeps a referenced payload alive, nullptr if copied into buffer
+      const char* data;                     // referenced payload only, copied ones are found in buffer
+      size_t length;                        // bytes not sent yet
+    };
+
+    std::shared_ptr<Buffer> buffer;       // data of copied segments, back to back in order
+    std::vector<Segment> segmentList;     // reused, cleared once all sent
+    size_t headIndex;                     // first segment not sent yet
+    size_t totalSize;
+
+    // length bytes just appended to buffer
+    void addCopied(size_t length) {
+      if(length == 0) {
+        return;
+      }
+      // consecutive copies share one segment
+      if(segmentList.empty() || segmentList.back().owner) {
+        segmentList.push_back(Segment{nullptr, nullptr, 0});
+      }
+      segmentList.back().length += length;
+      totalSize += length;
+    }
+
+  public:
+    OutputChain(): buffer(std::make_shared<Buffer>()), headIndex(0), totalSize(0) {}
+
+    std::shared_ptr<Buffer> getBuffer() {
+      return buffer;
+    }
+
+    size_t size() const {
+      return totalSize;
+    }
+
+    bool empty() const {
+      return totalSize == 0;
+    }
+
+    // copied, anything Buffer::append() takes
+    template<typename DATA>
+    void append(const DATA& data) {
+      size_t sizeBefore = buffer->size();
+      buffer->append(data);
+      addCopied(buffer->size() - sizeBefore);
+    }
+
+    // encoded into buffer, framing chosen by typeTable, multiplexed if requestId is not 0
+    void append(const std::shared_ptr<Message>& message, FrameTypeTable& typeTable, uint32_t requestId = 0) {
+      size_t sizeBefore = buffer->size();
+      ProtoBuf::encodeIntoBuffer(message, buffer, typeTable, requestId);
+      addCopied(buffer->size() - sizeBefore);
+    }
+
+    void append(const std::vector<std::shared_ptr<Message>>& messageList, FrameTypeTable& typeTable, const std::vector<uint32_t>* requestIdList = nullptr) {
+      size_t sizeBefore = buffer->size();
+      ProtoBuf::encodeIntoBuffer(messageList, buffer, typeTable, requestIdList);
+      addCopied(buffer->size() - sizeBefore);
+    }
+
+    // referenced, not copied, payload mustn't be modified until sent
+    void append(std::shared_ptr<const std::string> payload) {
+      const char* data = payload->data();
+      size_t length = payload->size();
+      append(std::move(payload), data, length);
+    }
+
+    void append(std::shared_ptr<std::string> payload) {
+      append(std::shared_ptr<const std::string>(std::move(payload)));
+    }
+
+    // referenced, [data, data + length) must stay unchanged while owner is alive
+    void append(std::shared_ptr<const void> owner, const char* data, size_t length) {
+      if(length < static_cast<size_t>(OUTPUT_CHAIN_COPY_THRESHOLD)) {
+        // not worth an iovec of its own
+        buffer->append(data, length);
+        addCopied(length);
+        return;
+      }
+      segmentList.push_back(Segment{std::move(owner), data, length});
+      totalSize += length;
+    }
+
+    // exchange contents, e.g. to keep output handed to the kernel untouched while more is written
+    void swap(OutputChain& other) {
+      std::swap(buffer, other.buffer);
+      std::swap(segmentList, other.segmentList);
+      std::swap(headIndex, other.headIndex);
+      std::swap(totalSize, other.totalSize);
+    }
+
+    // fill iov with segments not sent yet, return count filled
+    int prepare(struct iovec* iov, int maxCount) const {
+      int count = 0;
+      const char* copied = buffer->begin();
+      for(size_t index = headIndex; index < segmentList.size() && count < maxCount; index++, count++) {
+        const Segment &segment = segmentList[index];
+        if(segment.owner) {
+          iov[count].iov_base = const_cast<char*>(segment.data);
+        } else {
+          iov[count].iov_base = const_cast<char*>(copied);
+          copied += segment.length;
+        }
+        iov[count].iov_len = segment.length;
+      }
+      return count;
+    }
+
+    // drop len bytes already sent from the front
+    void consume(size_t len) {
+      totalSize -= len;
+      while(len > 0) {
+        Segment &segment = segmentList[headIndex];
+        size_t consumed = std::min(len, segment.length);
+        if(segment.owner) {
+          segment.data += consumed;
+        } else {
+          buffer->consume(consumed);
+        }
+        segment.length -= consumed;
+        len -= consumed;
+        if(segment.length == 0) {
+          segment.owner.reset();    // payload released as soon as it's sent
+          headIndex++;
+        }
+      }
+      if(headIndex == segmentList.size()) {
+        segmentList.clear();
+        headIndex = 0;
+      } else if(headIndex >= 64 && headIndex * 2 >= segmentList.size()) {
+        // never drained while the peer reads slowly, don't let sent segments pile up
+        segmentList.erase(segmentList.begin(), segmentList.begin() + static_cast<std::ptrdiff_t>(headIndex));
+        headIndex = 0;
+      }
+    }
+};
+
+}
@@ -1,77 +1,343 @@
 #include "Buffer.h"
+#include "MessageArena.h"
 #include "ProtoBuf.h"
 
+#include <algorithm>
+#include <cstring>
+#include <arpa/inet.h>
+
 #include <google/protobuf/descriptor.h>
 
 using namespace wnet;
 
 thread_local ParseResult ProtoBuf::parseResult = ParseResult::PARSING;
+thread_local uint32_t ProtoBuf::requestId = 0;
+
+std::mutex ProtoBuf::registryMutex;
+std::vector<const Message*> ProtoBuf::registry;
 
-using Descriptor = ::google::protobuf::Descriptor;
 using DescriptorPool = ::google::protobuf::DescriptorPool;
 using MessageFactory = ::google::protobuf::MessageFactory;
 
-std::shared_ptr<Message> ProtoBuf::getMessageViaName(const std::string& typeName) {
-  std::shared_ptr<Message> message = nullptr;
-  const google::protobuf::Descriptor* descriptor = google::protobuf::DescriptorPool::generated_pool()->FindMessageTypeByName(typeName);
+namespace {
+
+// type name -> prototype of one thread, open addressing, looked up by bytes so nothing is allocated
+class PrototypeCache {
+  private:
+    struct Slot {
+      std::string typeName;
+      size_t hash;
+      const Message* prototype;     // nullptr if empty
+    };
+
+    std::vector<Slot> slotList;     // size power of 2, kept at most half full
+    size_t count;
+
+    static size_t hashOf(const char* typeName, size_t length) {
+      // FNV-1a
+      size_t hash = 14695981039346656037ULL;
+      for(size_t i = 0; i < length; i++) {
+        hash ^= static_cast<unsigned char>(typeName[i]);
+        hash *= 1099511628211ULL;
+      }
+      return hash;
+    }
+
+    void place(Slot&& slot) {
+      size_t mask = slotList.size() - 1;
+      size_t index = slot.hash & mask;
+      while(slotList[index].prototype) {
+        index = (index + 1) & mask;
+      }
+      slotList[index] = std::move(slot);
+    }
+
+  public:
+    PrototypeCache(): slotList(PROTOTYPE_CACHE_INITIAL_SIZE), count(0) {}
+
+    const Message* find(const char* typeName, size_t length) const {
+      size_t hash = hashOf(typeName, length);
+      size_t mask = slotList.size() - 1;
+      for(size_t index = hash & mask; slotList[index].prototype; index = (index + 1) & mask) {
+        const Slot &slot = slotList[index];
+        if(slot.hash == hash && slot.typeName.size() == length && ::memcmp(slot.typeName.data(), typeName, length) == 0) {
+          return slot.prototype;
+        }
+      }
+      return nullptr;
+    }
+
+    void insert(const Message* prototype) {
+      const std::string& typeName = prototype->GetDescriptor()->full_name();
+      if(find(typeName.data(), typeName.size())) {
+        return;
+      }
+      if(2 * (count + 1) > slotList.size()) {
+        std::vector<Slot> oldSlotList(slotList.size() * 2);
+        oldSlotList.swap(slotList);
+        for(auto &slot : oldSlotList) {
+          if(slot.prototype) {
+            place(std::move(slot));
+          }
+        }
+      }
+      place(Slot{typeName, hashOf(typeName.data(), typeName.size()), prototype});
+      count++;
+    }
+};
+
+}
+
+void ProtoBuf::registerMessageType(const Message& prototype) {
+  std::lock_guard<std::mutex> guard(registryMutex);
+  registry.push_back(&prototype);
+}
+
+const Message* ProtoBuf::getPrototype(const char* typeName, size_t length) {
+  static thread_local PrototypeCache prototypeCache;
+  static thread_local bool warmedUp = false;
+  if(!warmedUp) {
+    std::lock_guard<std::mutex> guard(registryMutex);
+    for(auto prototype : registry) {
+      prototypeCache.insert(prototype);
+    }
+    warmedUp = true;
+  }
+
+  const Message* prototype = prototypeCache.find(typeName, length);
+  if(prototype) {
+    return prototype;
+  }
+
+  // not registered, slow path once per thread and type,
+  // unknown names are not cached, or peers sending random names would fill the cache up
+  const Descriptor* descriptor = DescriptorPool::generated_pool()->FindMessageTypeByName(std::string(typeName, length));
   if(descriptor) {
-    const Message* prototype = google::protobuf::MessageFactory::generated_factory()->GetPrototype(descriptor);
+    prototype = MessageFactory::generated_factory()->GetPrototype(descriptor);
     if(prototype) {
-      message = std::shared_ptr<Message>(prototype->New());
+      prototypeCache.insert(prototype);
     }
   }
-  return message;
+  return prototype;
+}
+
+std::shared_ptr<Message> ProtoBuf::getMessageViaName(const std::string& typeName) {
+  const Message* prototype = getPrototype(typeName.data(), typeName.size());
+  return prototype ? std::shared_ptr<Message>(prototype->New()) : nullptr;
+}
+
+std::shared_ptr<Message> ProtoBuf::newMessage(const Message* prototype, MessageArena* arena) {
+  return arena ? arena->create(prototype) : std::shared_ptr<Message>(prototype->New());
+}
+
+size_t ProtoBuf::FrameLayout::size() const {
+  size_t frameSize = sizeof(uint32_t) + messageSize;
+  if(requestId) {
+    frameSize += sizeof(uint32_t) * 2;
+  }
+  if(tag) {
+    frameSize += sizeof(uint32_t);
+  }
+  if(typeName) {
+    frameSize += sizeof(uint32_t) + typeName->size();
+  }
+  return frameSize;
+}
+
+ProtoBuf::FrameLayout ProtoBuf::layoutFrame(const Message& message, FrameTypeTable* typeTable, uint32_t _requestId) {
+  const Descriptor* descriptor = message.GetDescriptor();
+  // the only size computation, serializing goes by the sizes cached here
+  size_t messageSize = message.ByteSizeLong();
+  if(typeTable && typeTable->isCompact()) {
+    int id = typeTable->findEncodeId(descriptor);
+    if(id >= 0) {
+      return FrameLayout{_requestId, FrameTypeTable::COMPACT_FRAME_TAG | static_cast<uint32_t>(id), nullptr, messageSize};
+    }
+    id = typeTable->addEncodeId(descriptor);
+    if(id >= 0) {
+      // first use of this type on the connection, name sent once along with its id
+      return FrameLayout{_requestId, FrameTypeTable::DEFINE_FRAME_TAG | static_cast<uint32_t>(id), &descriptor->full_name(), messageSize};
+    }
+    // out of ids, legacy framing is still understood by the peer
+  }
+  return FrameLayout{_requestId, 0, &descriptor->full_name(), messageSize};
+}
+
+namespace {
+
+char* writeUint32(char* pos, uint32_t num) {
+  num = ::htonl(num);
+  return std::copy(reinterpret_cast<const char*>(&num), reinterpret_cast<const char*>(&num) + sizeof num, pos);
+}
+
+}
+
+char* ProtoBuf::writeFrame(char* pos, const FrameLayout& layout, const Message& message) {
+  if(layout.requestId) {
+    pos = writeUint32(pos, FrameTypeTable::MULTIPLEX_FRAME_TAG);
+    pos = writeUint32(pos, layout.requestId);
+  }
+  if(layout.tag) {
+    pos = writeUint32(pos, layout.tag);
+  }
+  if(layout.typeName) {
+    pos = writeUint32(pos, static_cast<uint32_t>(layout.typeName->size()));
+    pos = std::copy(layout.typeName->begin(), layout.typeName->end(), pos);
+  }
+  pos = writeUint32(pos, static_cast<uint32_t>(layout.messageSize));
+  auto target = reinterpret_cast<uint8_t*>(pos);
+  return reinterpret_cast<char*>(message.SerializeWithCachedSizesToArray(target));
 }
 
 void ProtoBuf::encodeIntoBuffer(std::shared_ptr<Message> message, std::shared_ptr<Buffer> buffer) {
-  const std::string& typeName = message->GetDescriptor()->full_name();
-  // write type name length to buffer
-  buffer->append_uint32(static_cast<uint32_t>(typeName.size()));
-  // write type name to buffer
-  buffer->append(typeName);
-  // write message length to buffer
-  buffer->append_uint32(static_cast<uint32_t>(message->ByteSize()));
-  // serialize message to buffer
-  message->SerializeToArray(buffer->occupy(message->ByteSize()), message->ByteSize());
-}
-
-std::shared_ptr<Message> ProtoBuf::decodeFromBuffer(std::shared_ptr<Buffer> buffer) {
+  FrameLayout layout = layoutFrame(*message, nullptr);
+  writeFrame(buffer->occupy(layout.size()), layout, *message);
+}
+
+void ProtoBuf::encodeIntoBuffer(std::shared_ptr<Message> message, std::shared_ptr<Buffer> buffer, FrameTypeTable& typeTable, uint32_t _requestId) {
+  FrameLayout layout = layoutFrame(*message, &typeTable, _requestId);
+  writeFrame(buffer->occupy(layout.size()), layout, *message);
+}
+
+void ProtoBuf::encodeIntoBuffer(const std::vector<std::shared_ptr<Message>>& messageList, std::shared_ptr<Buffer> buffer, FrameTypeTable& typeTable,
+                                const std::vector<uint32_t>* requestIdList) {
+  // reused, no allocation once grown to the largest batch of the thread
+  static thread_local std::vector<FrameLayout> layoutList;
+  layoutList.clear();
+  size_t totalSize = 0;
+  for(size_t index = 0; index < messageList.size(); index++) {
+    layoutList.push_back(layoutFrame(*messageList[index], &typeTable, requestIdList ? (*requestIdList)[index] : 0));
+    totalSize += layoutList.back().size();
+  }
+  char* pos = buffer->occupy(totalSize);
+  for(size_t index = 0; index < messageList.size(); index++) {
+    pos = writeFrame(pos, layoutList[index], *messageList[index]);
+  }
+}
+
+std::shared_ptr<const std::string> ProtoBuf::encodeIntoString(std::shared_ptr<Message> message) {
+  FrameLayout layout = layoutFrame(*message, nullptr);
+  auto encoded = std::make_shared<std::string>(layout.size(), '\0');
+  writeFrame(&(*encoded)[0], layout, *message);
+  return encoded;
+}
+
+namespace {
+
+uint32_t readUint32(const char* pos) {
+  uint32_t num = 0;
+  std::copy(pos, pos + sizeof num, reinterpret_cast<char*>(&num));
+  return ::ntohl(num);
+}
+
+}
+
+std::shared_ptr<Message> ProtoBuf::decodeFrame(const char* pos, size_t available, FrameTypeTable* typeTable, MessageArena* arena, size_t& frameSize) {
   parseResult = ParseResult::PARSING;
+  requestId = 0;
+  frameSize = 0;
 
-  auto bufSize = buffer->size();
-  auto curr_pos = buffer->begin();
   size_t sizeofSizeField = sizeof(uint32_t);
-
-  auto decodedSize = sizeofSizeField * 2;
-  if (bufSize < decodedSize) {  
+  if(available < sizeofSizeField) {
     parseResult = ParseResult::MESSAGE_INCOMPLETED;
     return nullptr;
   }
+  auto header = readUint32(pos);
+  auto tag = header & FrameTypeTable::FRAME_TAG_MASK;
+  auto id = header & ~FrameTypeTable::FRAME_TAG_MASK;
 
-  auto typeNameSize = buffer->fetch_uint32();
-  decodedSize += typeNameSize;
-  if (bufSize < decodedSize) {      
-    parseResult = ParseResult::MESSAGE_INCOMPLETED;
-    return nullptr;
+  if(typeTable && tag == FrameTypeTable::MULTIPLEX_FRAME_TAG) {
+    // request id, then a frame of its own
+    if(available < sizeofSizeField * 2) {
+      parseResult = ParseResult::MESSAGE_INCOMPLETED;
+      return nullptr;
+    }
+    // a single wrapper, the frame inside never multiplexed again ( no recursion a peer could deepen )
+    if(available >= sizeofSizeField * 3 &&
+       (readUint32(pos + sizeofSizeField * 2) & FrameTypeTable::FRAME_TAG_MASK) == FrameTypeTable::MULTIPLEX_FRAME_TAG) {
+      parseResult = ParseResult::PARSE_ERROR;
+      return nullptr;
+    }
+    auto taggedId = readUint32(pos + sizeofSizeField);
+    auto message = decodeFrame(pos + sizeofSizeField * 2, available - sizeofSizeField * 2, typeTable, arena, frameSize);
+    if(frameSize) {
+      frameSize += sizeofSizeField * 2;
+    }
+    requestId = taggedId;
+    return message;
   }
 
-  auto messageSizePos = curr_pos + sizeofSizeField + typeNameSize;
-  auto messageSize = buffer->fetch_uint32(messageSizePos);
-  decodedSize += messageSize;
-  if (bufSize < decodedSize) {    
-    parseResult = ParseResult::MESSAGE_INCOMPLETED;  
+  const Message* prototype = nullptr;
+  const char* messageSizePos = nullptr;
+  bool compactFrame = typeTable && (header & FrameTypeTable::DEFINE_FRAME_TAG);
+  if(!compactFrame) {
+    // legacy framing, header is the type name length
+    auto decodedSize = sizeofSizeField * 2 + header;
+    if(available < decodedSize) {
+      parseResult = ParseResult::MESSAGE_INCOMPLETED;
+      return nullptr;
+    }
+    messageSizePos = pos + sizeofSizeField + header;
+    if(available < decodedSize + readUint32(messageSizePos)) {
+      parseResult = ParseResult::MESSAGE_INCOMPLETED;
+      return nullptr;
+    }
+    prototype = getPrototype(pos + sizeofSizeField, header);
+  } else if(tag == FrameTypeTable::DEFINE_FRAME_TAG) {
+    auto decodedSize = sizeofSizeField * 3;
+    if(available < decodedSize) {
+      parseResult = ParseResult::MESSAGE_INCOMPLETED;
+      return nullptr;
+    }
+    auto typeNameSize = readUint32(pos + sizeofSizeField);
+    decodedSize += typeNameSize;
+    if(available < decodedSize) {
+      parseResult = ParseResult::MESSAGE_INCOMPLETED;
+      return nullptr;
+    }
+    messageSizePos = pos + sizeofSizeField * 2 + typeNameSize;
+    if(available < decodedSize + readUint32(messageSizePos)) {
+      parseResult = ParseResult::MESSAGE_INCOMPLETED;
+      return nullptr;
+    }
+    prototype = getPrototype(pos + sizeofSizeField * 2, typeNameSize);
+    // defined even if unknown here, later compact frames of it are skipped as unknown as well
+    if(!typeTable->define(id, prototype)) {
+      parseResult = ParseResult::PARSE_ERROR;
+      return nullptr;
+    }
+  } else if(tag == FrameTypeTable::COMPACT_FRAME_TAG) {
+    // fixed size header, type found by index
+    if(available < sizeofSizeField * 2) {
+      parseResult = ParseResult::MESSAGE_INCOMPLETED;
+      return nullptr;
+    }
+    messageSizePos = pos + sizeofSizeField;
+    if(available < sizeofSizeField * 2 + readUint32(messageSizePos)) {
+      parseResult = ParseResult::MESSAGE_INCOMPLETED;
+      return nullptr;
+    }
+    prototype = typeTable->getPrototype(id);
+  } else {
+    // reserved tags
+    parseResult = ParseResult::PARSE_ERROR;
     return nullptr;
   }
-  
-  // buffer size larger than or equal to message size, start parse message
-  buffer->consume(decodedSize);
-  auto message = getMessageViaName(std::string(curr_pos + sizeofSizeField, typeNameSize));
-  if(!message) {    
+
+  if(compactFrame) {
+    // the peer speaks compact framing, answer in it as well
+    typeTable->setCompact();
+  }
+
+  // complete, skipped by the caller even if it can't be parsed
+  auto messageSize = readUint32(messageSizePos);
+  frameSize = static_cast<size_t>(messageSizePos - pos) + sizeofSizeField + messageSize;
+  if(!prototype) {
     parseResult = ParseResult::UNKNOWN_MESSAGE_TYPE;
     return nullptr;
   }
-
-  if(!message->ParseFromArray(messageSizePos + sizeofSizeField, messageSize)) {
+  auto message = newMessage(prototype, arena);
+  if(!message->ParseFromArray(messageSizePos + sizeofSizeField, static_cast<int>(messageSize))) {
     parseResult = ParseResult::PARSE_ERROR;
     return nullptr;
   }
@@ -79,6 +345,48 @@ std::shared_ptr<Message> ProtoBuf::decodeFromBuffer(std::shared_ptr<Buffer> buff
   return message;
 }
 
+std::shared_ptr<Message> ProtoBuf::decodeFromBuffer(std::shared_ptr<Buffer> buffer, MessageArena* arena) {
+  size_t frameSize;
+  auto message = decodeFrame(buffer->begin(), buffer->size(), nullptr, arena, frameSize);
+  buffer->consume(frameSize);
+  return message;
+}
+
+std::shared_ptr<Message> ProtoBuf::decodeFromBuffer(std::shared_ptr<Buffer> buffer, FrameTypeTable& typeTable, MessageArena* arena) {
+  size_t frameSize;
+  auto message = decodeFrame(buffer->begin(), buffer->size(), &typeTable, arena, frameSize);
+  buffer->consume(frameSize);
+  return message;
+}
+
+ParseResult ProtoBuf::decodeAllFromBuffer(std::shared_ptr<Buffer> buffer, FrameTypeTable& typeTable, std::vector<std::shared_ptr<Message>>& messageList, 
+                                          MessageArena* arena, std::vector<uint32_t>* requestIdList) {
+  const char* pos = buffer->begin();
+  size_t available = buffer->size();
+  size_t frameSize;
+  while(true) {
+    auto message = decodeFrame(pos, available, &typeTable, arena, frameSize);
+    if(frameSize == 0) {
+      // incomplete, or the frame boundary lost
+      break;
+    }
+    pos += frameSize;
+    available -= frameSize;
+    // a complete frame failing to decode is skipped, its place kept by nullptr, the frames after it still decoded
+    messageList.push_back(parseResult == ParseResult::PARSE_SUCCESS ? std::move(message) : nullptr);
+    if(requestIdList) {
+      requestIdList->push_back(requestId);
+    }
+  }
+  // every frame walked given back at once
+  buffer->consume(buffer->size() - available);
+  return parseResult;
+}
+
 ParseResult ProtoBuf::getParseResult() {
   return parseResult;
 }
+
+uint32_t ProtoBuf::getRequestId() {
+  return requestId;
+}
@@ -1,15 +1,23 @@
 #pragma once
 
+#include <cstdint>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <vector>
 
 #include <google/protobuf/message.h>
 
+#include "Config.h"
+#include "Noncopyable.h"
+
 namespace wnet {
 
 class Buffer;
+class MessageArena;
 
 using Message = ::google::protobuf::Message;
+using Descriptor = ::google::protobuf::Descriptor;
 
 enum class ParseResult { 
   PARSING = 1,
@@ -18,22 +26,153 @@ enum class ParseResult {
   UNKNOWN_MESSAGE_TYPE,
   PARSE_ERROR,
   CONNECTION_CLOSED_BY_PEER,
-  TIMEOUT
+  TIMEOUT,
+  CANCELLED       // sub request left out by the await() policy ( AwaitPolicy )
+};
+
+// type name interning of compact framing, one per connection
+// frames:  [u32 name length][type name][u32 message length][message]           legacy, name length < 2^31
+//          [u32 100 | id][u32 name length][type name][u32 message length][message]  defines id, first use of a type
+//          [u32 101 | id][u32 message length][message]                          compact, 3 high bits tag, 29 bits id
+//          [u32 110 | 0][u32 request id][frame of any kind above]                 multiplexed, response matched by request id
+// ids given by this side and ids defined by the peer are separate
+class FrameTypeTable : public noncopyable {
+  private:
+    bool compact = false;
+    std::vector<const Descriptor*> encodeList;    // id -> type already defined to the peer
+    std::vector<const Message*> decodeList;       // id -> prototype defined by the peer, nullptr if unknown here
+
+  public:
+    static const uint32_t DEFINE_FRAME_TAG = 0x80000000;
+    static const uint32_t COMPACT_FRAME_TAG = 0xA0000000;
+    static const uint32_t MULTIPLEX_FRAME_TAG = 0xC0000000;
+    static const uint32_t FRAME_TAG_MASK = 0xE0000000;
+
+    // encode with compact framing, only when the peer is known to decode it
+    void setCompact() {
+      compact = true;
+    }
+
+    bool isCompact() const {
+      return compact;
+    }
+
+    // id of a type already defined to the peer, -1 if not yet
+    int findEncodeId(const Descriptor* descriptor) const {
+      // a connection sees a few types, linear is fine
+      for(size_t id = 0; id < encodeList.size(); id++) {
+        if(encodeList[id] == descriptor) {
+          return static_cast<int>(id);
+        }
+      }
+      return -1;
+    }
+
+    // new id for a type, -1 when FRAME_TYPE_TABLE_SIZE ids given already
+    int addEncodeId(const Descriptor* descriptor) {
+      if(encodeList.size() >= static_cast<size_t>(FRAME_TYPE_TABLE_SIZE)) {
+        return -1;
+      }
+      encodeList.push_back(descriptor);
+      return static_cast<int>(encodeList.size() - 1);
+    }
+
+    // false if id out of range
+    bool define(uint32_t id, const Message* prototype) {
+      if(id >= static_cast<uint32_t>(FRAME_TYPE_TABLE_SIZE)) {
+        return false;
+      }
+      if(id >= decodeList.size()) {
+        decodeList.resize(id + 1, nullptr);
+      }
+      decodeList[id] = prototype;
+      return true;
+    }
+
+    // nullptr if not defined or unknown
+    const Message* getPrototype(uint32_t id) const {
+      return id < decodeList.size() ? decodeList[id] : nullptr;
+    }
 };
 
 class ProtoBuf {
   private:
     static thread_local ParseResult parseResult;
+    static thread_local uint32_t requestId;
+
+    // prototypes registered at startup, copied into the cache of every thread on its first lookup
+    static std::mutex registryMutex;
+    static std::vector<const Message*> registry;
+
+    // header fields of one frame, worked out before anything is written
+    struct FrameLayout {
+      uint32_t requestId;             // multiplexed if not 0
+      uint32_t tag;                   // DEFINE_FRAME_TAG / COMPACT_FRAME_TAG with the id, 0 for legacy framing
+      const std::string* typeName;    // nullptr for compact frames
+      size_t messageSize;             // ByteSizeLong(), sizes of sub messages cached for serializing
+
+      size_t size() const;
+    };
+
+    static FrameLayout layoutFrame(const Message& message, FrameTypeTable* typeTable, uint32_t _requestId = 0);
+
+    // write a frame of exactly layout.size() bytes at pos, return the end of it
+    static char* writeFrame(char* pos, const FrameLayout& layout, const Message& message);
+
+    // decode the frame at pos in place, legacy framing only if typeTable is nullptr,
+    // frameSize set to the bytes to skip, 0 if incomplete
+    static std::shared_ptr<Message> decodeFrame(const char* pos, size_t available, FrameTypeTable* typeTable, MessageArena* arena, size_t& frameSize);
     
   public:
+    // look up a message type once at startup, e.g. ProtoBuf::registerMessageType<request::simpledata>(),
+    // so no EventLoop goes through the descriptor pool on its first message of this type
+    static void registerMessageType(const Message& prototype);
+
+    template<typename MESSAGE>
+    static void registerMessageType() {
+      registerMessageType(MESSAGE::default_instance());
+    }
+
+    // cached per thread, no allocation or lock once found, nullptr if unknown
+    static const Message* getPrototype(const char* typeName, size_t length);
+
     static std::shared_ptr<Message> getMessageViaName(const std::string& typeName);
+
+    // on arena if not nullptr, on heap otherwise
+    static std::shared_ptr<Message> newMessage(const Message* prototype, MessageArena* arena);
     
     static void encodeIntoBuffer(std::shared_ptr<Message> message, std::shared_ptr<Buffer> buffer);
 
-    static std::shared_ptr<Message> decodeFromBuffer(std::shared_ptr<Buffer> buffer);
+    // compact framing if typeTable.isCompact(), legacy framing otherwise, multiplexed if _requestId is not 0
+    static void encodeIntoBuffer(std::shared_ptr<Message> message, std::shared_ptr<Buffer> buffer, FrameTypeTable& typeTable, uint32_t _requestId = 0);
+
+    // frames of every message back to back, buffer grown once for all of them,
+    // requestIdList, if given, holds the request id of every message
+    static void encodeIntoBuffer(const std::vector<std::shared_ptr<Message>>& messageList, std::shared_ptr<Buffer> buffer, FrameTypeTable& typeTable, 
+                                 const std::vector<uint32_t>* requestIdList = nullptr);
+
+    // same bytes as encodeIntoBuffer(), encode once and write to many connections without copying,
+    // always legacy framing, ids of compact framing differ by connection
+    static std::shared_ptr<const std::string> encodeIntoString(std::shared_ptr<Message> message);
+
+    // legacy framing only, message allocated on arena if not nullptr
+    static std::shared_ptr<Message> decodeFromBuffer(std::shared_ptr<Buffer> buffer, MessageArena* arena = nullptr);
+
+    // both framings, typeTable switched to compact once the peer sends a compact framed message
+    static std::shared_ptr<Message> decodeFromBuffer(std::shared_ptr<Buffer> buffer, FrameTypeTable& typeTable, MessageArena* arena = nullptr);
+
+    // every complete frame in buffer appended to messageList, consumed once at the end, nullptr for one that failed to decode,
+    // MESSAGE_INCOMPLETED when all of them are walked, PARSE_ERROR if stopped at a frame that can't be skipped
+    // ( frame boundary lost, nothing after it decodable, left in buffer )
+    // request id of each appended to requestIdList as well if given
+    static ParseResult decodeAllFromBuffer(std::shared_ptr<Buffer> buffer, FrameTypeTable& typeTable, std::vector<std::shared_ptr<Message>>& messageList, 
+                                           MessageArena* arena = nullptr, std::vector<uint32_t>* requestIdList = nullptr);
 
     static ParseResult getParseResult();
 
+    // request id of the frame last decoded in this thread, 0 if it wasn't multiplexed
+    static uint32_t getRequestId();
+
 };
 
 }
\ No newline at end of file
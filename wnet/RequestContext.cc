@@ -0,0 +1,23 @@
+#include "Connector.h"
+#include "RequestContext.h"
+
+using namespace wnet;
+
+void RequestContext::await(std::vector<std::shared_ptr<RequestResult>> requestResultList, ContextHandler handler) {
+  await(requestResultList, AwaitPolicy::makeAll(), handler);
+}
+
+void RequestContext::await(std::vector<std::shared_ptr<RequestResult>> requestResultList, AwaitPolicy policy, ContextHandler handler) {
+  auto awaitGroup = AwaitGroup::join(connection, requestResultList, policy);
+  if(awaitGroup->tryComplete(connection, requestResultList)) {
+    handler(this);
+    return;
+  }
+  // then await SubConnectionEvent, every context of the connection is told, only the one whose policy is met goes on
+  subConnectionCallBackHandler = [=](RequestContext* const context) {
+    if(awaitGroup->tryComplete(context->connection, requestResultList)) {
+      context->subConnectionCallBackHandler = nullptr;
+      handler(context);
+    }
+  };
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "AwaitPolicy.h"
+#include "Noncopyable.h"
+#include "ProtoBuf.h"
+
+namespace wnet {
+
+class Connection;
+class RequestContext;
+class RequestResult;
+
+using ContextHandler = std::function<void(RequestContext* const)>;
+
+// one request of a pipelined connection ( Connection::setPipelinedRequestHandler() ),
+// awaits its own sub requests, several in flight on one connection at once,
+// output kept here until every request before it is finished, so responses go out in request order
+class RequestContext : public noncopyable, public std::enable_shared_from_this<RequestContext> {
+  friend class Connection;
+
+  private:
+    struct Output {
+      std::shared_ptr<Message> message;     // encoded when flushed, compact framing ids are given in wire order
+      std::string data;                     // copied, if message is nullptr
+    };
+
+    Connection* const connection;
+    const uint64_t sequence;
+    const ParseResult parseResult;
+    const uint32_t requestId;             // echoed in every message written, 0 if the peer doesn't multiplex
+
+    std::vector<Output> outputList;
+    ContextHandler subConnectionCallBackHandler;
+    bool finished;
+
+    template<typename TYPE>
+    void appendOutput(const TYPE& data, std::false_type) {
+      outputList.push_back(Output{nullptr, std::string(data)});
+    }
+
+    void appendOutput(const std::shared_ptr<Message>& message, std::true_type) {
+      outputList.push_back(Output{message, std::string()});
+    }
+
+    // SUBCONNECTION_EVENT arrived at the connection, handler called once nothing awaited is pending
+    void handleSubConnectionEvent() {
+      if(subConnectionCallBackHandler && !finished) {
+        // called through a copy, the handler replaces or clears itself ( await() / finish() )
+        ContextHandler handler = subConnectionCallBackHandler;
+        handler(this);
+      }
+    }
+
+  public:
+    RequestContext(Connection* const _connection, 
+                   uint64_t _sequence, 
+                   ParseResult _parseResult, 
+                   uint32_t _requestId = 0): connection(_connection),
+                                             sequence(_sequence),
+                                             parseResult(_parseResult),
+                                             requestId(_requestId),
+                                             finished(false) {}
+
+    std::shared_ptr<RequestContext> thisContext() {
+      return shared_from_this();
+    }
+
+    // only valid while the connection is alive, i.e. in handlers called by it
+    Connection* getConnection() {
+      return connection;
+    }
+
+    // order of the request on its connection, from 0
+    uint64_t getSequence() {
+      return sequence;
+    }
+
+    // request id of a multiplexing peer, 0 otherwise
+    uint32_t getRequestId() {
+      return requestId;
+    }
+
+    // PARSE_SUCCESS, or UNKNOWN_MESSAGE_TYPE / PARSE_ERROR with the request handler given nullptr
+    ParseResult getParseResult() {
+      return parseResult;
+    }
+
+    bool isFinished() {
+      return finished;
+    }
+
+    // std::shared_ptr<Message> ( or of a generated type ), std::string or const char*,
+    // written to the connection right away if every request before is finished, held back otherwise
+    template<typename TYPE>
+    void writeData(const TYPE& data) {
+      if(!finished) {
+        appendOutput(data, std::is_convertible<TYPE, std::shared_ptr<Message>>());
+      }
+    }
+
+    // same as Connection::await(), for this request only
+    void await(std::vector<std::shared_ptr<RequestResult>> requestResultList, ContextHandler handler);
+
+    void await(std::vector<std::shared_ptr<RequestResult>> requestResultList, AwaitPolicy policy, ContextHandler handler);
+
+    // must be called once the response is complete, frees the in flight slot of the request
+    void finish() {
+      finished = true;
+      subConnectionCallBackHandler = nullptr;
+    }
+};
+
+}
@@ -1,27 +1,165 @@
 #include "EventPoll.h"
 #include "FdCtrl.h"
+#include "Metrics.h"
+#include "SignalHandler.h"
 #include "TCPServer.h"
 
 using namespace wnet;
 
-void TCPServer::bindPort() {
+int TCPServer::listenPort() {
+  int listen_fd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if(listen_fd == -1) {
+    LOG(LogLevel::FATAL, "[TCPServer][socket()] socket fd generate failed, error: [%d]%s", errno, ::strerror(errno));
+    ::exit(EXIT_FAILURE);
+  }
+  FdCtrl::setReuseAddr(listen_fd);
+  if(enableReusePortAcceptors) {
+    // before bind(), or the port is not shared, left off otherwise so that another instance fails to bind
+    FdCtrl::setReusePort(listen_fd);
+  }
+
   bzero(&serverAddr, sizeof serverAddr);
   serverAddr.sin_family = AF_INET;
   serverAddr.sin_addr.s_addr = INADDR_ANY;
   serverAddr.sin_port = htons(port);     // Host to Network Short
-  if(::bind(server_fd, reinterpret_cast<struct sockaddr*>(&serverAddr), sizeof serverAddr) == -1) {
-    LOG(LogLevel::FATAL, "[TCPServer][fd %d][bind()] bind to port: %d failed, error: [%d]%s", server_fd, port, errno, ::strerror(errno));
+  if(::bind(listen_fd, reinterpret_cast<struct sockaddr*>(&serverAddr), sizeof serverAddr) == -1) {
+    LOG(LogLevel::FATAL, "[TCPServer][fd %d][bind()] bind to port: %d failed, error: [%d]%s", listen_fd, port, errno, ::strerror(errno));
+    ::exit(EXIT_FAILURE);
+  }
+  if(::listen(listen_fd, backlog) == -1) {
+    LOG(LogLevel::FATAL, "[TCPServer][fd %d][listen()] socket start listen failed, error: [%d]%s", listen_fd, errno, ::strerror(errno));
     ::exit(EXIT_FAILURE);
   }
-  FdCtrl::setReuseAddr(server_fd);
-  FdCtrl::setReusePort(server_fd);
-  FdCtrl::addFdFlag(server_fd, FD_CLOEXEC);
+  return listen_fd;
+}
+
+int TCPServer::openReserveFd() {
+  int reserve_fd = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+  if(reserve_fd == -1) {
+    LOG(LogLevel::ERROR, "[TCPServer][open()] reserve fd unavailable, error: [%d]%s", errno, ::strerror(errno));
+  }
+  return reserve_fd;
+}
+
+bool TCPServer::dropConnection(Acceptor& acceptor) {
+  if(acceptor.reserve_fd < 0 && (acceptor.reserve_fd = openReserveFd()) < 0) {
+    return false;   // left in the backlog until fds are freed
+  }
+  ::close(acceptor.reserve_fd);
+  int connection_fd = ::accept(acceptor.listen_fd, nullptr, nullptr);
+  if(connection_fd >= 0) {
+    ::close(connection_fd);
+  }
+  acceptor.reserve_fd = openReserveFd();
+  return connection_fd >= 0;
+}
+
+int TCPServer::listenMetricsPort() {
+  int listen_fd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if(listen_fd == -1) {
+    LOG(LogLevel::ERROR, "[TCPServer][socket()] metrics fd generate failed, error: [%d]%s", errno, ::strerror(errno));
+    return -1;
+  }
+  FdCtrl::setReuseAddr(listen_fd);
+
+  struct sockaddr_in metricsAddr;
+  bzero(&metricsAddr, sizeof metricsAddr);
+  metricsAddr.sin_family = AF_INET;
+  metricsAddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  metricsAddr.sin_port = htons(metricsPort);
+  if(::bind(listen_fd, reinterpret_cast<struct sockaddr*>(&metricsAddr), sizeof metricsAddr) == -1 ||
+     ::listen(listen_fd, SOMAXCONN) == -1) {
+    LOG(LogLevel::ERROR, "[TCPServer][fd %d] metrics port: %d unavailable, error: [%d]%s", listen_fd, metricsPort, errno, ::strerror(errno));
+    ::close(listen_fd);
+    return -1;
+  }
+  return listen_fd;
+}
+
+void TCPServer::dumpMetrics() {
+  std::string text = Metrics::snapshot();
+  std::string writingPath = metricsDumpPath + ".tmp";
+  int dump_fd = ::open(writingPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if(dump_fd == -1) {
+    LOG(LogLevel::ERROR, "[TCPServer][open()] dump metrics to %s failed, error: [%d]%s", writingPath.c_str(), errno, ::strerror(errno));
+    return;
+  }
+  size_t written = 0;
+  while(written < text.size()) {
+    ssize_t writeLen = ::write(dump_fd, text.data() + written, text.size() - written);
+    if(writeLen == -1 && errno == EINTR) {
+      continue;
+    }
+    if(writeLen <= 0) {
+      break;
+    }
+    written += static_cast<size_t>(writeLen);
+  }
+  ::close(dump_fd);
+  if(written < text.size() || ::rename(writingPath.c_str(), metricsDumpPath.c_str()) == -1) {
+    LOG(LogLevel::ERROR, "[TCPServer] dump metrics to %s failed, error: [%d]%s", metricsDumpPath.c_str(), errno, ::strerror(errno));
+    return;
+  }
+  LOG(LogLevel::INFO, "[TCPServer] metrics dumped to %s", metricsDumpPath.c_str());
 }
 
 void TCPServer::setEnableConnectionKeepAlive() {
   enableConnectionKeepAlive = true;
 }
 
+void TCPServer::setEnableRequestArena() {
+  enableRequestArena = true;
+}
+
+void TCPServer::setBacklog(int _backlog) {
+  if(running) {
+    LOG(LogLevel::ERROR, "[TCPServer] server running, set backlog failed");
+  } else {
+    backlog = _backlog;
+  }
+}
+
+void TCPServer::setEnableReusePortAcceptors() {
+  if(running) {
+    LOG(LogLevel::ERROR, "[TCPServer] server running, enable reuse port acceptors failed");
+  } else {
+    enableReusePortAcceptors = true;
+  }
+}
+
+void TCPServer::setIOBackend(IOBackend backend) {
+  if(running) {
+    LOG(LogLevel::ERROR, "[TCPServer] server running, set io backend failed");
+  } else {
+    ioBackend = backend;
+  }
+}
+
+void TCPServer::setEnableLatencyMetrics() {
+  if(running) {
+    LOG(LogLevel::ERROR, "[TCPServer] server running, enable latency metrics failed");
+  } else {
+    enableLatencyMetrics = true;
+  }
+}
+
+void TCPServer::setMetricsPort(short _port) {
+  if(running) {
+    LOG(LogLevel::ERROR, "[TCPServer] server running, set metrics port failed");
+  } else {
+    metricsPort = _port;
+  }
+}
+
+void TCPServer::setMetricsDump(int signalCode, const std::string& path) {
+  if(running) {
+    LOG(LogLevel::ERROR, "[TCPServer] server running, set metrics dump failed");
+  } else {
+    metricsDumpSignal = signalCode;
+    metricsDumpPath = path;
+  }
+}
+
 void TCPServer::setOnConnectedHandler(ConnectionHandler handler) {
   if(running) {
     LOG(LogLevel::ERROR, "[TCPServer] server running, register onConnectedHandler failed");
@@ -46,65 +184,235 @@ void TCPServer::setOnDisconnectingHandler(ConnectionHandler handler) {
   }
 }
 
+void TCPServer::setReadBudget(size_t bytes, int calls) {
+  if(running) {
+    LOG(LogLevel::ERROR, "[TCPServer] server running, set read budget failed");
+  } else {
+    readBudgetBytes = bytes;
+    readBudgetCalls = calls;
+  }
+}
+
+void TCPServer::setOutputWatermarks(size_t _highWatermark, size_t _lowWatermark) {
+  if(running) {
+    LOG(LogLevel::ERROR, "[TCPServer] server running, set output watermarks failed");
+  } else {
+    highWatermark = _highWatermark;
+    lowWatermark = _lowWatermark;
+  }
+}
+
+void TCPServer::setOutputMemoryBudget(size_t budget) {
+  if(running) {
+    LOG(LogLevel::ERROR, "[TCPServer] server running, set output memory budget failed");
+  } else {
+    Connection::setOutputMemoryBudget(budget);
+  }
+}
+
+void TCPServer::setOnHighWatermarkHandler(ConnectionHandler handler) {
+  if(running) {
+    LOG(LogLevel::ERROR, "[TCPServer] server running, register onHighWatermarkHandler failed");
+  } else {
+    onHighWatermarkHandler = handler;
+  }
+}
+
+void TCPServer::setOnLowWatermarkHandler(ConnectionHandler handler) {
+  if(running) {
+    LOG(LogLevel::ERROR, "[TCPServer] server running, register onLowWatermarkHandler failed");
+  } else {
+    onLowWatermarkHandler = handler;
+  }
+}
+
+void TCPServer::setPipelinedRequestHandler(RequestHandler handler, size_t _maxInFlight) {
+  if(running) {
+    LOG(LogLevel::ERROR, "[TCPServer] server running, register pipelinedRequestHandler failed");
+  } else {
+    pipelinedRequestHandler = handler;
+    maxInFlight = _maxInFlight;
+  }
+}
+
 void TCPServer::run() {
-  server_fd = ::socket(AF_INET, SOCK_STREAM, 0);
-  if(server_fd == -1) {
-    LOG(LogLevel::FATAL, "[TCPServer][socket()] socket fd generate failed, error: [%d]%s", errno, ::strerror(errno));
-    ::exit(EXIT_FAILURE);
+  EventPoll::setReactorMode(reactorMode);
+  EventPoll::setIOBackend(ioBackend);
+  if(enableLatencyMetrics) {
+    Metrics::setLatencyEnabled();
   }
-  FdCtrl::setNoneBlock(server_fd);
-  
   eventPoll = EventPoll::getInstance();
-  eventPoll->setServer(server_fd, shared_from_this());
-  eventPoll->addEventListener(server_fd, EventPoll::READ_EVENT, EventPoll::LEVEL_TRIGGER);   // server fd LT trigger
+  if(EventPoll::getIOBackend() == IOBackend::IO_URING) {
+    // the ring of an EventLoop is only touched by its own thread, so is the accepting
+    enableReusePortAcceptors = true;
+  }
+  if(enableReusePortAcceptors && EventPoll::getReactorMode() != ReactorMode::LOOP_PER_THREAD) {
+    LOG(LogLevel::ERROR, "[TCPServer] reuse port acceptors require ReactorMode::LOOP_PER_THREAD, accepting in master thread");
+    enableReusePortAcceptors = false;
+  }
 
-  bindPort();
-  if(::listen(server_fd, SERVER_LISTEN_QUEUE_LENGTH) == -1) {
-    LOG(LogLevel::FATAL, "[TCPServer][fd %d][listen()] socket start listen failed, error: [%d]%s", server_fd, errno, ::strerror(errno));
-    ::exit(EXIT_FAILURE);
+  int acceptorCount = enableReusePortAcceptors ? EVENT_LOOP_COUNT : 1;
+  for(int index = 0; index < acceptorCount; index++) {
+    acceptorList.push_back(Acceptor{listenPort(), openReserveFd()});
   }
-  LOG(LogLevel::INFO, "[TCPServer][port %d][fd %d] server start running", port, server_fd);
+  server_fd = acceptorList[0].listen_fd;
   running = true;
+
+  if(enableReusePortAcceptors) {
+    eventPoll->setServer(-1, shared_from_this());
+    for(int index = 0; index < acceptorCount; index++) {
+      eventPoll->addAcceptor(index, acceptorList[index].listen_fd);   // listen fd LT trigger
+    }
+  } else {
+    eventPoll->setServer(server_fd, shared_from_this());
+    eventPoll->addEventListener(server_fd, EventPoll::READ_EVENT, EventPoll::LEVEL_TRIGGER);   // server fd LT trigger
+  }
+
+  if(metricsPort >= 0 && (metrics_fd = listenMetricsPort()) >= 0) {
+    eventPoll->setMetricsFd(metrics_fd);
+  }
+  if(metricsDumpSignal > 0) {
+    // only a flag set in the handler, the snapshot is taken by the loop below
+    auto dumpRequested = metricsDumpRequested;
+    Signal::setSignalHandler(metricsDumpSignal, [dumpRequested] {
+      dumpRequested->store(true);
+    });
+  }
+
+  LOG(LogLevel::INFO, "[TCPServer][port %d][fd %d] server start running, %d acceptor(s), backlog %d", port, server_fd, acceptorCount, backlog);
   while(running) {
+    // a signal cuts the wait of poll() short, the dump follows at once
     eventPoll->poll();
+    if(metricsDumpRequested->exchange(false)) {
+      dumpMetrics();
+    }
   }
   eventPoll->shutdown();
   LOG(LogLevel::INFO, "[TCPServer] server shut down");
 }
 
-void TCPServer::handleNewConnection() {
-  if(running) {
-    bzero(&clientAddr, sizeof clientAddr);
+void TCPServer::handleNewConnection(int loopIndex) {
+  Acceptor &acceptor = acceptorList[loopIndex < 0 ? 0 : loopIndex];
+  struct sockaddr_in clientAddr;
+  // listen fd is LT triggered, whatever is left beyond the budget is accepted on the next poll
+  for(int count = 0; running && count < ACCEPT_BUDGET_PER_WAKEUP; count++) {
     socklen_t clilen = sizeof clientAddr;
-    int connection_fd = ::accept(server_fd, reinterpret_cast<struct sockaddr*>(&clientAddr), &clilen);
+    int connection_fd = ::accept4(acceptor.listen_fd,
+                                  reinterpret_cast<struct sockaddr*>(&clientAddr),
+                                  &clilen,
+                                  SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if(connection_fd >= 0) {
+      initConnection(connection_fd, clientAddr, loopIndex);
+      continue;
+    }
+
+    switch(errno) {
+      case EAGAIN:
+        return;
+
+      case EINTR:
+      case ECONNABORTED:
+      case EPROTO:
+        // peer gone before accepted, go on with the next one
+        break;
+
+      case EMFILE:
+      case ENFILE:
+        LOG(LogLevel::ERROR, "[TCPServer][fd %d][accept4()] out of fds, new connection dropped, error: [%d]%s", acceptor.listen_fd, errno, ::strerror(errno));
+        if(!dropConnection(acceptor)) {
+          return;
+        }
+        break;
+
+      default:
+        LOG(LogLevel::ERROR, "[TCPServer][fd %d][accept4()] handle new connection failed, error: [%d]%s", acceptor.listen_fd, errno, ::strerror(errno));
+        return;
+    }
+  }
+}
+
+void TCPServer::handleAcceptedConnection(int connection_fd, int loopIndex) {
+  if(!running) {
+    ::close(connection_fd);
+    return;
+  }
+  struct sockaddr_in clientAddr;
+  socklen_t clilen = sizeof clientAddr;
+  if(::getpeername(connection_fd, reinterpret_cast<struct sockaddr*>(&clientAddr), &clilen) == -1) {
+    bzero(&clientAddr, sizeof clientAddr);    // reset by peer already, found out on the first receive
+  }
+  initConnection(connection_fd, clientAddr, loopIndex);
+}
+
+void TCPServer::handleMetricsRequest() {
+  std::string text;
+  for(int count = 0; count < ACCEPT_BUDGET_PER_WAKEUP; count++) {
+    int connection_fd = ::accept4(metrics_fd, nullptr, nullptr, SOCK_CLOEXEC);
     if(connection_fd == -1) {
-      LOG(LogLevel::FATAL, "[TCPServer][fd %d][accept()] handle new connection failed, error: [%d]%s", server_fd, errno, ::strerror(errno));
-      ::exit(EXIT_FAILURE);
+      if(errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      return;   // EAGAIN, or out of fds, left in the backlog ( LT )
+    }
+    if(text.empty()) {
+      text = Metrics::snapshot();
     }
-    FdCtrl::setNoneBlock(connection_fd);
-
-    char *clientIP = ::inet_ntoa(clientAddr.sin_addr);
-    LOG(LogLevel::INFO, "[TCPServer] accept new connection from %s", clientIP);
-
-    // construct connection object and register to eventpoll connection set
-    auto connection = std::make_shared<Connection>( connection_fd, 
-                                                    eventPoll, 
-                                                    ConnectionType::PASSIVE, 
-                                                    onConnectedHandler,
-                                                    onReceiveDataHandler,
-                                                    onDisconnectingHandler );
-    connection->setServerInfo("127.0.0.1", port);
-    connection->setClientInfo(clientIP);
-    
-    eventPoll->addConnection(connection);
-    if(!enableConnectionKeepAlive) {
-      eventPoll->connectionIniIdleTimeout(connection);      // kill the connection if idle for some time
+    // a few KiB, taken by the socket buffer of a fresh connection whole, the master thread never blocks on it
+    size_t written = 0;
+    while(written < text.size()) {
+      ssize_t writeLen = ::send(connection_fd, text.data() + written, text.size() - written, MSG_NOSIGNAL | MSG_DONTWAIT);
+      if(writeLen == -1 && errno == EINTR) {
+        continue;
+      }
+      if(writeLen <= 0) {
+        break;
+      }
+      written += static_cast<size_t>(writeLen);
     }
- 
-    eventPoll->addEventListener(connection_fd, EventPoll::READ_EVENT | EventPoll::WRITE_EVENT);
+    // whatever the client sent dropped first, or close() resets the connection before the snapshot is read
+    char discard[256];
+    while(::recv(connection_fd, discard, sizeof discard, MSG_DONTWAIT) > 0) {}
+    ::close(connection_fd);
   }
 }
 
+void TCPServer::initConnection(int connection_fd, const struct sockaddr_in& clientAddr, int loopIndex) {
+  Metrics::add(MetricsCounter::ACCEPTS);
+  char clientIP[INET_ADDRSTRLEN];
+  ::inet_ntop(AF_INET, &clientAddr.sin_addr, clientIP, sizeof clientIP);
+  LOG(LogLevel::DEBUG, "[TCPServer] accept new connection from %s", clientIP);
+
+  // construct connection object and register to eventpoll connection set
+  auto connection = std::make_shared<Connection>( connection_fd, 
+                                                  eventPoll, 
+                                                  ConnectionType::PASSIVE, 
+                                                  onConnectedHandler,
+                                                  onReceiveDataHandler,
+                                                  onDisconnectingHandler );
+  if(loopIndex >= 0) {
+    connection->setLoopIndex(loopIndex);    // stays on the EventLoop that accepted it
+  }
+  connection->setServerInfo("127.0.0.1", port);
+  connection->setClientInfo(clientIP);
+  if(enableRequestArena) {
+    connection->setRequestArena();
+  }
+  if(pipelinedRequestHandler) {
+    connection->setPipelinedRequestHandler(pipelinedRequestHandler, maxInFlight);
+  }
+  connection->setReadBudget(readBudgetBytes, readBudgetCalls);
+  connection->setOutputWatermarks(highWatermark, lowWatermark);
+  connection->setOnHighWatermarkHandler(onHighWatermarkHandler);
+  connection->setOnLowWatermarkHandler(onLowWatermarkHandler);
+  
+  eventPoll->addConnection(connection);
+  if(!enableConnectionKeepAlive) {
+    eventPoll->connectionIniIdleTimeout(connection);      // kill the connection if idle for some time
+  }
+
+  eventPoll->addEventListener(connection.get(), EventPoll::READ_EVENT | EventPoll::WRITE_EVENT);
+}
+
 void TCPServer::shutdown() {
   running = false;
 }
@@ -1,17 +1,21 @@
 #pragma once
 
+#include <atomic>
 #include <cerrno>
 #include <cstdlib>
 #include <cstring>
 #include <functional>
 #include <memory>
 #include <mutex>
+#include <string>
+#include <vector>
 #include <arpa/inet.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
 #include "Config.h"
 #include "Connection.h"
+#include "EventLoop.h"
 #include "Log.h"
 #include "Noncopyable.h"
 
@@ -21,32 +25,115 @@ class EventPoll;
 
 class TCPServer : public noncopyable, public std::enable_shared_from_this<TCPServer> {
   private:
+    // a listening socket and the spare fd given up to accept and drop a connection when out of fds
+    struct Acceptor {
+      int listen_fd;
+      int reserve_fd;
+    };
+
     const short port;
-    int server_fd;
+    const ReactorMode reactorMode;
+    IOBackend ioBackend = IOBackend::EPOLL;
+    int server_fd = -1;
     std::shared_ptr<EventPoll> eventPoll;
     ConnectionHandler onConnectedHandler,
                       onReceiveDataHandler,
                       onDisconnectingHandler;
     
-    struct sockaddr_in serverAddr, clientAddr;
+    struct sockaddr_in serverAddr;
+
+    int backlog = SERVER_LISTEN_QUEUE_LENGTH;
+
+    // acceptorList[0] polled by the master thread,
+    // or acceptorList[loopIndex] by every EventLoop with reuse port acceptors
+    std::vector<Acceptor> acceptorList;
+    bool enableReusePortAcceptors = false;
     
-    bool running = false;
+    std::atomic<bool> running{false};
 
     bool enableConnectionKeepAlive = false;
 
-    void bindPort();
+    bool enableRequestArena = false;
+
+    RequestHandler pipelinedRequestHandler;
+    size_t maxInFlight = PIPELINE_MAX_IN_FLIGHT;
+
+    size_t readBudgetBytes = READ_BUDGET_BYTES;
+    int readBudgetCalls = READ_BUDGET_CALLS;
+
+    size_t highWatermark = OUTPUT_HIGH_WATERMARK;
+    size_t lowWatermark = OUTPUT_LOW_WATERMARK;
+    ConnectionHandler onHighWatermarkHandler,
+                      onLowWatermarkHandler;
+
+    bool enableLatencyMetrics = false;
+
+    // plain text snapshot of Metrics to whoever connects to 127.0.0.1:metricsPort, -1 if none
+    short metricsPort = -1;
+    int metrics_fd = -1;
+
+    // set by the handler of metricsDumpSignal, snapshot written to metricsDumpPath by the master thread,
+    // shared with the handler, which may outlive the server
+    int metricsDumpSignal = 0;
+    std::string metricsDumpPath;
+    std::shared_ptr<std::atomic<bool>> metricsDumpRequested = std::make_shared<std::atomic<bool>>(false);
+
+    // socket bound to port and listening, with SO_REUSEPORT only for reuse port acceptors ( one per EventLoop )
+    int listenPort();
+
+    static int openReserveFd();
+
+    // loopback only, -1 if unavailable
+    int listenMetricsPort();
+
+    // written aside and renamed over metricsDumpPath, so a reader never sees half of it
+    void dumpMetrics();
+
+    // out of fds, accept a pending connection on the reserve fd and close it at once,
+    // so the peer is told instead of left in the backlog, return false if nothing pending
+    bool dropConnection(Acceptor& acceptor);
+
+    void initConnection(int connection_fd, const struct sockaddr_in& clientAddr, int loopIndex);
 
   public:
-    TCPServer(short _port): port(_port), 
-                            onConnectedHandler(nullptr), 
-                            onReceiveDataHandler(nullptr), 
-                            onDisconnectingHandler(nullptr) {}
+    // ReactorMode::MASTER_DISPATCH:  master thread polls every connection and dispatches events to EventLoops
+    // ReactorMode::LOOP_PER_THREAD:  accepted connections are handed to an EventLoop once, 
+    //                                which polls and handles them inline in its own thread
+    TCPServer(short _port, 
+              ReactorMode _reactorMode = ReactorMode::MASTER_DISPATCH): port(_port), 
+                                                                        reactorMode(_reactorMode),
+                                                                        onConnectedHandler(nullptr), 
+                                                                        onReceiveDataHandler(nullptr), 
+                                                                        onDisconnectingHandler(nullptr) {}
     ~TCPServer() {
       LOG(LogLevel::DEBUG, "[TCPServer] destructing");
-      ::close(server_fd);
+      for(auto &acceptor : acceptorList) {
+        ::close(acceptor.listen_fd);
+        if(acceptor.reserve_fd >= 0) {
+          ::close(acceptor.reserve_fd);
+        }
+      }
+      if(metrics_fd >= 0) {
+        ::close(metrics_fd);
+      }
     }
 
     void setEnableConnectionKeepAlive();
+
+    // listen() backlog, SERVER_LISTEN_QUEUE_LENGTH by default, capped by net.core.somaxconn
+    void setBacklog(int _backlog);
+
+    // ReactorMode::LOOP_PER_THREAD only, every EventLoop accepts on its own SO_REUSEPORT socket,
+    // the kernel spreads new connections between them, which then stay on the EventLoop that accepted them
+    void setEnableReusePortAcceptors();
+
+    // IOBackend::IO_URING, ReactorMode::LOOP_PER_THREAD only, reuse port acceptors turned on along,
+    // every EventLoop accepts with multishot accept, receives into provided buffers and batches its sends,
+    // IOBackend::EPOLL used if the kernel lacks support ( EventPoll::getIOBackend() )
+    void setIOBackend(IOBackend backend);
+
+    // messages of every connection allocated on a per connection protobuf Arena ( Connection::setRequestArena() )
+    void setEnableRequestArena();
     
     void setOnConnectedHandler(ConnectionHandler handler);
 
@@ -54,9 +141,43 @@ class TCPServer : public noncopyable, public std::enable_shared_from_this<TCPSer
 
     void setOnDisconnectingHandler(ConnectionHandler handler);
 
+    // every connection in pipelined mode ( Connection::setPipelinedRequestHandler() ), onReceiveDataHandler not called
+    void setPipelinedRequestHandler(RequestHandler handler, size_t _maxInFlight = PIPELINE_MAX_IN_FLIGHT);
+
+    // bytes and readv() calls of every connection per turn of its EventLoop ( Connection::setReadBudget() )
+    void setReadBudget(size_t bytes, int calls);
+
+    // pending output bytes of every connection pausing / resuming its reading ( Connection::setOutputWatermarks() )
+    void setOutputWatermarks(size_t _highWatermark, size_t _lowWatermark);
+
+    // pending output bytes of all connections, passive and active, beyond which the ones above their low watermark pause
+    void setOutputMemoryBudget(size_t budget);
+
+    // e.g. to shut a connection not reading its responses down
+    void setOnHighWatermarkHandler(ConnectionHandler handler);
+
+    void setOnLowWatermarkHandler(ConnectionHandler handler);
+
+    // queue wait, handler time and sub request round trip histograms of Metrics, a clock read on both ends of each
+    void setEnableLatencyMetrics();
+
+    // admin port, every connection to 127.0.0.1:port gets a plain text snapshot of Metrics and is closed
+    void setMetricsPort(short port);
+
+    // on signalCode ( e.g. SIGUSR1 ), a plain text snapshot of Metrics written to path
+    void setMetricsDump(int signalCode, const std::string& path);
+
     void run();
 
-    void handleNewConnection();
+    // accept until nothing pending or ACCEPT_BUDGET_PER_WAKEUP reached,
+    // loopIndex -1 for the acceptor of the master thread
+    void handleNewConnection(int loopIndex = -1);
+
+    // IOBackend::IO_URING, connection_fd accepted by EventLoop loopIndex already
+    void handleAcceptedConnection(int connection_fd, int loopIndex);
+
+    // metrics fd readable, in the master thread
+    void handleMetricsRequest();
 
     void shutdown();
 
@@ -3,25 +3,159 @@
 
 using namespace wnet;
 
-TimeoutEntry::~TimeoutEntry() {
-  if(timeoutHandler) {
+std::shared_ptr<Connection> TimeoutEntry::getConnection() {
+  auto connectionPtr = connection.lock();
+  if (!connectionPtr) {
+    LOG(LogLevel::DEBUG, "[TimeoutEntry] connection already perished");
+    return nullptr;
+  } else {
+    return connectionPtr;
+  }
+}
+
+TimeoutManager::~TimeoutManager() {
+  std::vector<std::shared_ptr<TimeoutEntry>> droppedList;
+  for(auto &level : wheel) {
+    for(auto &slot : level) {
+      while(slot.next != &slot) {
+        auto entry = static_cast<TimeoutEntry*>(slot.next);
+        unlink(entry);
+        droppedList.push_back(std::move(entry->self));
+      }
+    }
+  }
+}
+
+uint64_t TimeoutManager::toTicks(std::chrono::milliseconds timeout) {
+  if(timeout.count() <= 0) {
+    return 1;   // expire on next tick
+  }
+  uint64_t ticks = (static_cast<uint64_t>(timeout.count()) + TIMER_RESOLUTION_MS - 1) / TIMER_RESOLUTION_MS;
+  return ticks > MAX_TIMEOUT_TICKS ? MAX_TIMEOUT_TICKS : ticks;
+}
+
+void TimeoutManager::link(TimeoutEntry* entry) {
+  uint64_t delta = entry->expireTick > currentTick ? entry->expireTick - currentTick : 0;
+  int level = 0;
+  while(level < LEVEL_COUNT - 1 && delta >= (static_cast<uint64_t>(1) << (SLOT_BITS * (level + 1)))) {
+    level++;
+  }
+  // overdue entries (only while cascading) go to the slot about to be fired
+  uint64_t expireTick = delta == 0 ? currentTick : entry->expireTick;
+  TimeoutNode &slot = wheel[level][(expireTick >> (SLOT_BITS * level)) & SLOT_MASK];
+
+  entry->prev = slot.prev;
+  entry->next = &slot;
+  slot.prev->next = entry;
+  slot.prev = entry;
+}
+
+void TimeoutManager::schedule(const std::shared_ptr<TimeoutEntry>& entry, uint64_t ticks) {
+  if(entry->self) {
+    unlink(entry.get());
+  } else {
+    entry->self = entry;
+    scheduledCount++;
+  }
+  entry->expireTick = currentTick + ticks;
+  link(entry.get());
+}
+
+void TimeoutManager::cascade(int level, uint64_t slotIndex) {
+  TimeoutNode &slot = wheel[level][slotIndex];
+  while(slot.next != &slot) {
+    auto entry = static_cast<TimeoutEntry*>(slot.next);
+    unlink(entry);
+    link(entry);
+  }
+}
+
+void TimeoutManager::fire(const std::shared_ptr<TimeoutEntry>& entry) {
+  if(entry->timeoutHandler) {
     // self-defined timeout behaviour
-    timeoutHandler();
+    entry->timeoutHandler();
   } else {
     // connection lifetime timeout control (terminate if idle for a while)
-    auto connectionPtr = getConnection();
+    auto connectionPtr = entry->getConnection();
     if(connectionPtr) {
-      connectionPtr->terminate(); 
+      // activity only recorded on connection, checked here lazily instead of rescheduling on every write
+      uint64_t deadline = connectionPtr->getLastActiveTick() + entry->idleTicks;
+      if(deadline > now()) {
+        std::lock_guard<std::mutex> guard(mutx);
+        schedule(entry, deadline - currentTick);
+        return;
+      }
+      connectionPtr->terminate();
     }
   }
 }
 
-std::shared_ptr<Connection> TimeoutEntry::getConnection() {
-  auto connectionPtr = connection.lock();
-  if (!connectionPtr) {
-    LOG(LogLevel::DEBUG, "[TimeoutEntry] connection already perished");
-    return nullptr;
-  } else {
-    return connectionPtr;
+std::shared_ptr<TimeoutEntry> TimeoutManager::setTimeout( std::chrono::milliseconds timeout,
+                                                          std::shared_ptr<Connection> connection,
+                                                          std::function<void()> timeoutHandler) {
+  auto entry = std::make_shared<TimeoutEntry>(connection, timeoutHandler);
+  std::lock_guard<std::mutex> guard(mutx);
+  schedule(entry, toTicks(timeout));
+  return entry;
+}
+
+std::shared_ptr<TimeoutEntry> TimeoutManager::setIdleTimeout(std::chrono::milliseconds timeout, std::shared_ptr<Connection> connection) {
+  uint64_t ticks = toTicks(timeout);
+  auto entry = std::make_shared<TimeoutEntry>(connection, nullptr, ticks);
+  std::lock_guard<std::mutex> guard(mutx);
+  schedule(entry, ticks);
+  return entry;
+}
+
+void TimeoutManager::reschedule(const std::shared_ptr<TimeoutEntry>& entry, std::chrono::milliseconds timeout) {
+  std::lock_guard<std::mutex> guard(mutx);
+  schedule(entry, toTicks(timeout));
+}
+
+void TimeoutManager::cancel(const std::shared_ptr<TimeoutEntry>& entry) {
+  // destructed after mutx released, the handler may hold the last reference to something that calls back
+  std::shared_ptr<TimeoutEntry> cancelled;
+  std::lock_guard<std::mutex> guard(mutx);
+  if(entry && entry->self) {
+    unlink(entry.get());
+    cancelled = std::move(entry->self);
+    scheduledCount--;
+  }
+}
+
+void TimeoutManager::tickTock(uint64_t expireTimes) {
+  for(uint64_t i = 0; i < expireTimes; i++) {
+    {
+      std::lock_guard<std::mutex> guard(mutx);
+      if(scheduledCount == 0) {
+        currentTick += expireTimes - i;   // nothing to fire, skip the remaining ticks at once
+        coarseClock.store(currentTick, std::memory_order_relaxed);
+        return;
+      }
+
+      currentTick += 1;
+      coarseClock.store(currentTick, std::memory_order_relaxed);
+      // a new round of level n - 1 starts, bring entries of the current level n slot down
+      for(int level = 1; level < LEVEL_COUNT; level++) {
+        if((currentTick & ((static_cast<uint64_t>(1) << (SLOT_BITS * level)) - 1)) != 0) {
+          break;
+        }
+        cascade(level, (currentTick >> (SLOT_BITS * level)) & SLOT_MASK);
+      }
+
+      TimeoutNode &slot = wheel[0][currentTick & SLOT_MASK];
+      while(slot.next != &slot) {
+        auto entry = static_cast<TimeoutEntry*>(slot.next);
+        unlink(entry);
+        expiredList.push_back(std::move(entry->self));
+        scheduledCount--;
+      }
+    }
+
+    // handlers may set / cancel timeouts, so called without mutx
+    for(auto &entry : expiredList) {
+      fire(entry);
+    }
+    expiredList.clear();
   }
-}
\ No newline at end of file
+}
@@ -1,75 +1,140 @@
 #pragma once
 
-#include <algorithm>
 #include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
 #include <memory>
 #include <mutex>
-#include <set>
+#include <vector>
 
 #include "Config.h"
 #include "Log.h"
+#include "Noncopyable.h"
 #include "Timer.h"
 
 namespace wnet {
 
 class Connection;
 
-class TimeoutEntry {
-  private: 
+// intrusive node of a timing wheel slot list, sentinel of every slot is a bare TimeoutNode
+struct TimeoutNode {
+  TimeoutNode* prev;
+  TimeoutNode* next;
+
+  TimeoutNode(): prev(this), next(this) {}
+};
+
+class TimeoutEntry : public TimeoutNode, public noncopyable {
+  friend class TimeoutManager;
+
+  private:
     std::weak_ptr<Connection> connection;
     std::function<void()> timeoutHandler;
 
+    uint64_t expireTick = 0;
+
+    // idle timeout only, 0 for plain timeouts
+    uint64_t idleTicks = 0;
+
+    // held by the wheel while scheduled, so callers may drop their handle,
+    // nullptr once expired or cancelled
+    std::shared_ptr<TimeoutEntry> self;
+
   public:
     TimeoutEntry( std::shared_ptr<Connection> _connection,
-                  std::function<void()> _timeoutHandler = nullptr): connection(_connection), 
-                                                                    timeoutHandler(_timeoutHandler) {}
-
-    ~TimeoutEntry();
+                  std::function<void()> _timeoutHandler = nullptr,
+                  uint64_t _idleTicks = 0): connection(_connection),
+                                            timeoutHandler(_timeoutHandler),
+                                            idleTicks(_idleTicks) {}
 
     std::shared_ptr<Connection> getConnection();
-    
+
 };
 
-class TimeoutManager {
+// hierarchical timing wheel, TIMING_WHEEL_LEVEL_COUNT levels of TIMING_WHEEL_SLOT_COUNT slots,
+// one tick = TIMER_RESOLUTION_MS, level n slot covers TIMING_WHEEL_SLOT_COUNT ^ n ticks
+// entries on upper levels cascade down when their slot comes round, insert / cancel / reschedule are O(1)
+//
+// owned by one EventLoop and ticked in its thread, but may be scheduled from other threads, hence the mutex
+class TimeoutManager : public noncopyable {
   private:
-    std::array<std::set<std::shared_ptr<TimeoutEntry>>, CONNECTION_MAX_SURVIVE_TICK_TOCK> TimeoutCircle;
-    int index = 0;
+    static constexpr int SLOT_BITS = TIMING_WHEEL_SLOT_BITS;
+    static constexpr int SLOT_COUNT = 1 << SLOT_BITS;
+    static constexpr uint64_t SLOT_MASK = SLOT_COUNT - 1;
+    static constexpr int LEVEL_COUNT = TIMING_WHEEL_LEVEL_COUNT;
+    static constexpr uint64_t MAX_TIMEOUT_TICKS = (static_cast<uint64_t>(1) << (SLOT_BITS * LEVEL_COUNT)) - 1;
+
+    std::array<std::array<TimeoutNode, SLOT_COUNT>, LEVEL_COUNT> wheel;
+    uint64_t currentTick = 0;
+    size_t scheduledCount = 0;
+
+    // copy of currentTick readable from any thread without mutx, see now()
+    std::atomic<uint64_t> coarseClock;
     std::mutex mutx;
 
+    // entries expired in one tick, handlers are called after mutx released, capacity reused
+    std::vector<std::shared_ptr<TimeoutEntry>> expiredList;
+
+    static uint64_t toTicks(std::chrono::milliseconds timeout);
+
+    static void unlink(TimeoutNode* node) {
+      node->prev->next = node->next;
+      node->next->prev = node->prev;
+      node->prev = node->next = node;
+    }
+
+    // put entry into the slot its expireTick belongs to, mutx held
+    void link(TimeoutEntry* entry);
+
+    // (re)schedule entry to expire ticks later, mutx held
+    void schedule(const std::shared_ptr<TimeoutEntry>& entry, uint64_t ticks);
+
+    // move every entry in wheel[level][slot] down to lower levels, mutx held
+    void cascade(int level, uint64_t slot);
+
+    // call handler of an expired entry, or check and terminate the idle connection, mutx not held
+    void fire(const std::shared_ptr<TimeoutEntry>& entry);
+
   public:
-    TimeoutManager() {}
-
-    ~TimeoutManager() {}
-
-    void setTimeout(int seconds, 
-                    std::shared_ptr<Connection> connection, 
-                    std::function<void()> timeoutHandler) {
-      TimeoutCircle[
-        (std::min({ seconds / TIME_ACCURACY, CONNECTION_MAX_SURVIVE_TICK_TOCK }) + index) % CONNECTION_MAX_SURVIVE_TICK_TOCK
-        ].insert(
-        std::make_shared<TimeoutEntry>(connection, timeoutHandler)
-      );
+    TimeoutManager(): coarseClock(0) {}
+
+    // entries still scheduled are dropped without being fired
+    ~TimeoutManager();
+
+    std::shared_ptr<TimeoutEntry> setTimeout( int seconds,
+                                              std::shared_ptr<Connection> connection,
+                                              std::function<void()> timeoutHandler) {
+      return setTimeout(std::chrono::seconds(seconds), connection, timeoutHandler);
     }
 
-    void clockIn(std::shared_ptr<TimeoutEntry> entry) {
-      if(entry) { // not nullptr
-        std::lock_guard<std::mutex> guard(mutx);
-        if(index == 0) {
-          TimeoutCircle[CONNECTION_MAX_SURVIVE_TICK_TOCK - 1].insert(entry);
-        } else {
-          TimeoutCircle[index - 1].insert(entry);
-        }
-      }
+    // timeout is rounded up to TIMER_RESOLUTION_MS, handle returned for cancel() / reschedule()
+    std::shared_ptr<TimeoutEntry> setTimeout( std::chrono::milliseconds timeout,
+                                              std::shared_ptr<Connection> connection,
+                                              std::function<void()> timeoutHandler);
+
+    // expire timeout later from now on, entry already expired or cancelled is scheduled again
+    void reschedule(const std::shared_ptr<TimeoutEntry>& entry, std::chrono::milliseconds timeout);
+
+    // no-op if entry already expired or cancelled
+    void cancel(const std::shared_ptr<TimeoutEntry>& entry);
+
+    // terminate connection once it's idle for timeout,
+    // activity is recorded by Connection::clockIn() and only checked when the entry expires
+    std::shared_ptr<TimeoutEntry> setIdleTimeout(std::chrono::milliseconds timeout, std::shared_ptr<Connection> connection);
+
+    // ticks since construction, coarse (TIMER_RESOLUTION_MS) but a single load
+    uint64_t now() const {
+      return coarseClock.load(std::memory_order_relaxed);
     }
 
-    void tickTock(uint64_t expireTimes) {
-      for(uint64_t i = 0; i < expireTimes; i++) {
-        TimeoutCircle[index].clear();
-        index += 1;
-        if(index == CONNECTION_MAX_SURVIVE_TICK_TOCK) {
-          index = 0;   // make it circle
-        }
-      }
+    // advance the wheel by expireTimes ticks and fire everything expired
+    void tickTock(uint64_t expireTimes);
+
+    size_t size() {
+      std::lock_guard<std::mutex> guard(mutx);
+      return scheduledCount;
     }
 };
 
@@ -18,11 +18,10 @@ class Timer : public noncopyable {
     int timer_fd;
     struct itimerspec timerDetail;
 
-    void setTimerDetail(int interval = TIME_ACCURACY) {
-      timerDetail.it_interval.tv_sec = interval;
-      timerDetail.it_interval.tv_nsec = 0;
-      timerDetail.it_value.tv_sec = interval;
-      timerDetail.it_value.tv_nsec = 0;
+    void setTimerDetail(int intervalMs = TIMER_RESOLUTION_MS) {
+      timerDetail.it_interval.tv_sec = intervalMs / 1000;
+      timerDetail.it_interval.tv_nsec = (intervalMs % 1000) * 1000000L;
+      timerDetail.it_value = timerDetail.it_interval;
       // tv_sec tv_nsec
       // Setting either field of timerDetail.it_value to a nonzero value arms the timer.
       // Setting both fields of timerDetail.it_value to zero disarms the timer.
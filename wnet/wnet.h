@@ -1,8 +1,11 @@
 #pragma once
 
+#include "AsyncLog.h"
+#include "AwaitPolicy.h"
 #include "Buffer.h"
 #include "Config.h"
 #include "Connection.h"
+#include "ConnectionTable.h"
 #include "Connector.h"
 #include "Context.h"
 #include "Daemon.h"
@@ -12,9 +15,14 @@
 #include "EventQueue.h"
 #include "FdCtrl.h"
 #include "Log.h"
+#include "MPSCQueue.h"
+#include "MessageArena.h"
+#include "Metrics.h"
 #include "Noncopyable.h"
+#include "OutputChain.h"
 #include "ParseParam.h"
 #include "ProtoBuf.h"
+#include "RequestContext.h"
 #include "SignalHandler.h"
 #include "TCPServer.h"
 #include "TimeoutManager.h"